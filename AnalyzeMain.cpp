@@ -0,0 +1,493 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// AnalyzeMain.cpp
+//    Headless batch analysis of whole motion libraries. It walks directory
+//    trees for ASF/AMC and BVH clips, loads them through the clip library
+//    on every core, and writes one report of per-clip statistics: frame
+//    count, duration, steps and cadence, root speed and channel ranges.
+//    SKA's file readers are not reentrant, so the clip library parses
+//    one file at a time under its io_mutex: on a cold cache parsing
+//    dominates and runs on one core, and only the rest spreads out.
+//    Clips go through the motion cache, so a second run over the same
+//    files skips the parsing and the foot contact analysis.
+//    Usage: analyze0003 [-o report.csv|report.json] [-threads T] [dir ...]
+//    Without directories, the app's AMC and BVH data paths are analyzed.
+//-----------------------------------------------------------------------------
+// SKA configuration.
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+using namespace std;
+// SKA modules
+#include <Core/BasicException.h>
+#include <Core/Utilities.h>
+// local application
+#include "AppConfig.h"
+#include "BoneHierarchy.h"
+#include "ClipLibrary.h"
+#include "FootContacts.h"
+#include "PoseClip.h"
+#include "PoseMath.h"
+#include "StreamingClip.h"
+#include "WorkerPool.h"
+
+typedef chrono::steady_clock Clock;
+
+struct AnalyzeOptions {
+	string report_path;
+	unsigned short num_threads;
+	vector<string> roots;
+	AnalyzeOptions() : report_path("clip_report.csv"), num_threads(0) { }
+};
+
+// one motion file found under a root, and its skeleton for AMC files
+struct ClipFile {
+	MOCAP_TYPE mocap_type;
+	// full paths (the root's joined with the file's), so files of the same
+	// name under different roots load as different clips
+	string motion_file;
+	string skeleton_file;
+	bool operator<(const ClipFile& _other) const { return motion_file < _other.motion_file; }
+	bool operator==(const ClipFile& _other) const { return motion_file == _other.motion_file; }
+};
+
+struct ChannelRange {
+	string bone;
+	CHANNEL_TYPE channel_type;
+	float low;
+	float high;
+};
+
+// statistics of one clip; error is empty if it was analyzed
+struct ClipReport {
+	string error;
+	long num_frames;
+	float duration;
+	unsigned int num_steps;
+	// steps per minute
+	float cadence;
+	// horizontal root speed, in the file's units per second
+	float mean_root_speed;
+	float max_root_speed;
+	vector<ChannelRange> ranges;
+	// time spent measuring the loaded clip
+	double analysis_seconds;
+	ClipReport() : num_frames(0), duration(0.0f), num_steps(0), cadence(0.0f), mean_root_speed(0.0f), max_root_speed(0.0f), analysis_seconds(0.0) { }
+};
+
+static void printUsage()
+{
+	cout << "usage: analyze0003 [-o report.csv|report.json] [-threads T] [dir ...]" << endl;
+	cout << "   dir             directory tree to search for .amc (with their .asf) and .bvh" << endl;
+	cout << "                   files (default: the app's AMC and BVH data directories)" << endl;
+	cout << "   -o file         report to write; .json writes JSON, anything else CSV" << endl;
+	cout << "                   (default: clip_report.csv)" << endl;
+	cout << "   -threads T      loading threads (default: 0 = one per hardware thread)" << endl;
+}
+
+static bool parseArguments(int argc, char **argv, AnalyzeOptions& _options)
+{
+	for (int a = 1; a < argc; a++)
+	{
+		bool has_value = (a + 1 < argc);
+		if (strcmp(argv[a], "-o") == 0 && has_value)
+			_options.report_path = argv[++a];
+		else if (strcmp(argv[a], "-threads") == 0 && has_value)
+			_options.num_threads = (unsigned short)atoi(argv[++a]);
+		else if (argv[a][0] == '-')
+			return false;
+		else
+			_options.roots.push_back(argv[a]);
+	}
+	if (_options.roots.empty())
+	{
+		_options.roots.push_back(AMC_MOTION_FILE_PATH);
+		_options.roots.push_back(BVH_MOTION_FILE_PATH);
+	}
+	return !_options.report_path.empty();
+}
+
+static string lowerCase(const string& _s)
+{
+	string lower;
+	for (unsigned int i = 0; i < _s.size(); i++) lower += (char)tolower((unsigned char)_s[i]);
+	return lower;
+}
+
+static bool hasExtension(const string& _name, const char* _extension)
+{
+	size_t length = strlen(_extension);
+	return _name.size() > length && lowerCase(_name.substr(_name.size() - length)) == _extension;
+}
+
+// listDirectory() lists the entries of _path (without . and ..), split
+// into subdirectories and files
+static void listDirectory(const string& _path, vector<string>& _directories, vector<string>& _files)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((_path + "\\*").c_str(), &entry);
+	if (find == INVALID_HANDLE_VALUE) return;
+	do
+	{
+		string name = entry.cFileName;
+		if (name == "." || name == "..") continue;
+		if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) _directories.push_back(name);
+		else _files.push_back(name);
+	} while (FindNextFileA(find, &entry));
+	FindClose(find);
+#else
+	DIR* directory = opendir(_path.c_str());
+	if (directory == NULL) return;
+	struct dirent* entry;
+	while ((entry = readdir(directory)) != NULL)
+	{
+		string name = entry->d_name;
+		if (name == "." || name == "..") continue;
+		struct stat info;
+		if (stat((_path + "/" + name).c_str(), &info) != 0) continue;
+		if (S_ISDIR(info.st_mode)) _directories.push_back(name);
+		else if (S_ISREG(info.st_mode)) _files.push_back(name);
+	}
+	closedir(directory);
+#endif
+}
+
+// findClipFiles() walks _directory down, collecting BVH files and AMC
+// files paired with their ASF skeleton: the one in the same directory
+// whose name starts the AMC's (CMU's "02.asf" for "02_01.amc"), or else
+// the only one there
+static void findClipFiles(const string& _directory, vector<ClipFile>& _clips, vector<string>& _unpaired)
+{
+	vector<string> directories, files;
+	listDirectory(_directory, directories, files);
+	sort(directories.begin(), directories.end());
+	sort(files.begin(), files.end());
+	string prefix = _directory + "/";
+
+	vector<string> skeletons;
+	for (unsigned int i = 0; i < files.size(); i++)
+		if (hasExtension(files[i], ".asf")) skeletons.push_back(files[i]);
+
+	for (unsigned int i = 0; i < files.size(); i++)
+	{
+		ClipFile clip;
+		clip.motion_file = prefix + files[i];
+		if (hasExtension(files[i], ".bvh")) clip.mocap_type = BVH;
+		else if (hasExtension(files[i], ".amc"))
+		{
+			clip.mocap_type = AMC;
+			string stem = lowerCase(files[i].substr(0, files[i].size() - 4));
+			for (unsigned int s = 0; s < skeletons.size() && clip.skeleton_file.empty(); s++)
+			{
+				string skeleton_stem = lowerCase(skeletons[s].substr(0, skeletons[s].size() - 4));
+				if (stem.compare(0, skeleton_stem.size(), skeleton_stem) == 0) clip.skeleton_file = prefix + skeletons[s];
+			}
+			if (clip.skeleton_file.empty() && skeletons.size() == 1) clip.skeleton_file = prefix + skeletons[0];
+			if (clip.skeleton_file.empty())
+			{
+				_unpaired.push_back(clip.motion_file);
+				continue;
+			}
+		}
+		else continue;
+		_clips.push_back(clip);
+	}
+
+	for (unsigned int d = 0; d < directories.size(); d++)
+		findClipFiles(prefix + directories[d], _clips, _unpaired);
+}
+
+// measureClip() fills _report from _clip's frames in _source
+static void measureClip(MotionClip* _clip, PoseSource* _source, ClipReport& _report)
+{
+	if (_source->numFrames() <= 0)
+	{
+		_report.error = "no frames";
+		return;
+	}
+
+	_report.num_frames = _source->numFrames();
+	_report.duration = _source->getDuration();
+	FootContacts* contacts = clip_library.analyzeFootContacts(_clip);
+	if (contacts != NULL)
+		for (int foot = 0; foot < NUM_FEET; foot++) _report.num_steps += (unsigned int)contacts->contacts[foot].size();
+	if (_report.duration > 0.0f) _report.cadence = 60.0f * _report.num_steps / _report.duration;
+
+	// bone names for the channel ranges, where the hierarchy has them
+	map<short, string> bone_names;
+	BoneHierarchy* hierarchy = clip_library.getHierarchy(_clip);
+	if (hierarchy != NULL)
+		for (unsigned short b = 0; b < hierarchy->numBones(); b++) bone_names[hierarchy->getBone(b).bone_id] = hierarchy->getBone(b).name;
+
+	unsigned short num_channels = _source->numChannels();
+	short root_x = -1, root_z = -1;
+	for (unsigned short c = 0; c < num_channels; c++)
+	{
+		CHANNEL_ID channel = _source->getChannel(c);
+		ChannelRange range;
+		map<short, string>::iterator name = bone_names.find(channel.bone_id);
+		range.bone = (name != bone_names.end()) ? name->second : toString(channel.bone_id);
+		range.channel_type = channel.channel_type;
+		range.low = HUGE_VALF;
+		range.high = -HUGE_VALF;
+		_report.ranges.push_back(range);
+		if (channel.bone_id == 0 && channel.channel_type == CT_TX) root_x = (short)c;
+		if (channel.bone_id == 0 && channel.channel_type == CT_TZ) root_z = (short)c;
+	}
+
+	// one pass over the frames for the ranges and the root's path
+	float* pose = allocatePoseBuffer(_source->getStride());
+	float frame_time = _report.duration / _report.num_frames;
+	float previous_x = 0.0f, previous_z = 0.0f, path_length = 0.0f;
+	for (long f = 0; f < _report.num_frames; f++)
+	{
+		_source->sampleFrame(f, pose);
+		for (unsigned short c = 0; c < num_channels; c++)
+		{
+			_report.ranges[c].low = min(_report.ranges[c].low, pose[c]);
+			_report.ranges[c].high = max(_report.ranges[c].high, pose[c]);
+		}
+		float x = (root_x >= 0) ? pose[root_x] : 0.0f, z = (root_z >= 0) ? pose[root_z] : 0.0f;
+		if (f > 0)
+		{
+			float step = sqrt((x - previous_x) * (x - previous_x) + (z - previous_z) * (z - previous_z));
+			path_length += step;
+			if (frame_time > 0.0f) _report.max_root_speed = max(_report.max_root_speed, step / frame_time);
+		}
+		previous_x = x;
+		previous_z = z;
+	}
+	freePoseBuffer(pose);
+	if (_report.num_frames > 1 && frame_time > 0.0f) _report.mean_root_speed = path_length / ((_report.num_frames - 1) * frame_time);
+}
+
+// analyzeClip() loads _file and fills _report, then lets the clip go.
+// Every file is analyzed by one job only, so no other job holds the clip.
+static void analyzeClip(const ClipFile& _file, ClipReport& _report)
+{
+	// unscaled, so speeds and ranges are in the file's own units
+	LoadSpec spec(_file.mocap_type, 1.0f, Color(1.0f, 1.0f, 1.0f), _file.motion_file, _file.skeleton_file);
+	MotionClip* clip = clip_library.getClip(spec);
+	if (clip == NULL) { _report.error = "unable to load"; return; }
+
+	PoseSource* source = clip->pose_clip;
+	if (clip->compressed_clip != NULL) source = clip->compressed_clip;
+	StreamingClip* stream = NULL;
+	if (clip->stream_layout != NULL) source = stream = new StreamingClip(*clip->stream_layout, clip_library.getStreamingBudget());
+	Clock::time_point start = Clock::now();
+	try
+	{
+		if (source != NULL) measureClip(clip, source, _report);
+		else _report.error = "no frames";
+	}
+	catch (...)
+	{
+		if (stream != NULL) delete stream;
+		clip_library.removeClip(clip);
+		throw;
+	}
+	_report.analysis_seconds = chrono::duration<double>(Clock::now() - start).count();
+	if (stream != NULL) delete stream;
+	clip_library.removeClip(clip);
+}
+
+static const char* channelName(CHANNEL_TYPE _type)
+{
+	switch (_type)
+	{
+	case CT_TX: return "tx";
+	case CT_TY: return "ty";
+	case CT_TZ: return "tz";
+	case CT_RX: return "rx";
+	case CT_RY: return "ry";
+	case CT_RZ: return "rz";
+	case CT_QW: return "qw";
+	case CT_QX: return "qx";
+	case CT_QY: return "qy";
+	case CT_QZ: return "qz";
+	default: return "?";
+	}
+}
+
+static string quoteCSV(const string& _s)
+{
+	if (_s.find_first_of(",\"\n") == string::npos) return _s;
+	string quoted = "\"";
+	for (unsigned int i = 0; i < _s.size(); i++)
+	{
+		if (_s[i] == '"') quoted += '"';
+		quoted += _s[i];
+	}
+	return quoted + "\"";
+}
+
+static string quoteJSON(const string& _s)
+{
+	string quoted = "\"";
+	for (unsigned int i = 0; i < _s.size(); i++)
+	{
+		char ch = _s[i];
+		if (ch == '"' || ch == '\\') { quoted += '\\'; quoted += ch; }
+		else if ((unsigned char)ch < 0x20) { char escape[8]; snprintf(escape, sizeof(escape), "\\u%04x", ch); quoted += escape; }
+		else quoted += ch;
+	}
+	return quoted + "\"";
+}
+
+// CSV: one row per clip; the channel ranges go in one column as
+// bone.channel:low:high entries separated by spaces
+static bool writeCSV(const string& _path, const vector<ClipFile>& _files, const vector<ClipReport>& _reports)
+{
+	FILE* out = fopen(_path.c_str(), "w");
+	if (out == NULL) return false;
+	fprintf(out, "motion_file,skeleton_file,status,frames,duration_s,steps,cadence_spm,mean_root_speed,max_root_speed,channels,channel_ranges\n");
+	for (unsigned int i = 0; i < _files.size(); i++)
+	{
+		const ClipReport& report = _reports[i];
+		const string& motion = _files[i].motion_file;
+		const string& skeleton = _files[i].skeleton_file;
+		string ranges;
+		for (unsigned int c = 0; c < report.ranges.size(); c++)
+		{
+			char entry[64];
+			snprintf(entry, sizeof(entry), ":%g:%g", report.ranges[c].low, report.ranges[c].high);
+			if (c > 0) ranges += ' ';
+			ranges += report.ranges[c].bone + "." + channelName(report.ranges[c].channel_type) + entry;
+		}
+		fprintf(out, "%s,%s,%s,%ld,%g,%u,%g,%g,%g,%u,%s\n", quoteCSV(motion).c_str(), quoteCSV(skeleton).c_str(),
+			quoteCSV(report.error.empty() ? string("ok") : report.error).c_str(), report.num_frames, report.duration,
+			report.num_steps, report.cadence, report.mean_root_speed, report.max_root_speed,
+			(unsigned)report.ranges.size(), quoteCSV(ranges).c_str());
+	}
+	return fclose(out) == 0;
+}
+
+static bool writeJSON(const string& _path, const vector<ClipFile>& _files, const vector<ClipReport>& _reports)
+{
+	FILE* out = fopen(_path.c_str(), "w");
+	if (out == NULL) return false;
+	fprintf(out, "[\n");
+	for (unsigned int i = 0; i < _files.size(); i++)
+	{
+		const ClipReport& report = _reports[i];
+		fprintf(out, "  {\"motion_file\": %s, ", quoteJSON(_files[i].motion_file).c_str());
+		if (!_files[i].skeleton_file.empty())
+			fprintf(out, "\"skeleton_file\": %s, ", quoteJSON(_files[i].skeleton_file).c_str());
+		if (!report.error.empty())
+			fprintf(out, "\"error\": %s", quoteJSON(report.error).c_str());
+		else
+		{
+			fprintf(out, "\"frames\": %ld, \"duration_s\": %g, \"steps\": %u, \"cadence_spm\": %g, \"mean_root_speed\": %g, \"max_root_speed\": %g,\n",
+				report.num_frames, report.duration, report.num_steps, report.cadence, report.mean_root_speed, report.max_root_speed);
+			fprintf(out, "   \"channel_ranges\": [");
+			for (unsigned int c = 0; c < report.ranges.size(); c++)
+				fprintf(out, "%s{\"bone\": %s, \"channel\": \"%s\", \"min\": %g, \"max\": %g}", (c > 0) ? ", " : "",
+					quoteJSON(report.ranges[c].bone).c_str(), channelName(report.ranges[c].channel_type), report.ranges[c].low, report.ranges[c].high);
+			fprintf(out, "]");
+		}
+		fprintf(out, "}%s\n", (i + 1 < _files.size()) ? "," : "");
+	}
+	fprintf(out, "]\n");
+	return fclose(out) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	AnalyzeOptions options;
+	if (!parseArguments(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	try
+	{
+		vector<ClipFile> files;
+		vector<string> unpaired;
+		for (unsigned int r = 0; r < options.roots.size(); r++)
+		{
+			string root = options.roots[r];
+			while (root.size() > 1 && (root[root.size() - 1] == '/' || root[root.size() - 1] == '\\')) root.erase(root.size() - 1);
+			findClipFiles(root, files, unpaired);
+		}
+		// a root given twice, or inside another, must not analyze (and
+		// free) the same clip in two jobs at once
+		sort(files.begin(), files.end());
+		files.erase(unique(files.begin(), files.end()), files.end());
+		for (unsigned int i = 0; i < unpaired.size(); i++)
+			cerr << "No skeleton found for " << unpaired[i] << "; skipped." << endl;
+		if (files.empty())
+		{
+			cerr << "No motion files found." << endl;
+			return 1;
+		}
+
+		WorkerPool pool(options.num_threads);
+		vector<ClipReport> reports(files.size());
+		Clock::time_point start = Clock::now();
+		pool.parallelFor((unsigned int)files.size(), 1,
+			[&files, &reports](unsigned int _begin, unsigned int _end) {
+				// WorkerPool abandons the whole job when a task throws, so one
+				// bad file is recorded in its row instead
+				for (unsigned int i = _begin; i < _end; i++)
+				{
+					try { analyzeClip(files[i], reports[i]); }
+					catch (BasicException& excpt) { reports[i].error = string("exception: ") + excpt.msg; }
+					catch (exception& excpt) { reports[i].error = string("exception: ") + excpt.what(); }
+					catch (...) { reports[i].error = "unknown exception"; }
+				}
+			});
+		double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+		bool json = hasExtension(options.report_path, ".json");
+		if (!(json ? writeJSON(options.report_path, files, reports) : writeCSV(options.report_path, files, reports)))
+		{
+			cerr << "Unable to write report " << options.report_path << endl;
+			return 1;
+		}
+
+		unsigned int num_failed = 0;
+		long num_frames = 0;
+		double analysis_seconds = 0.0;
+		for (unsigned int i = 0; i < reports.size(); i++)
+		{
+			if (!reports[i].error.empty()) num_failed++;
+			num_frames += reports[i].num_frames;
+			analysis_seconds += reports[i].analysis_seconds;
+		}
+		printf("clips:                      %u analyzed, %u failed, %u without a skeleton\n",
+			(unsigned)(files.size() - num_failed), num_failed, (unsigned)unpaired.size());
+		printf("report:                     %s\n", options.report_path.c_str());
+		printf("threads:                    %u\n", (unsigned)pool.numThreads());
+		printf("wall time:                  %.3f s\n", seconds);
+		printf("parse time:                 %.3f s, serialized (one file at a time)\n", clip_library.getParseSeconds());
+		printf("analysis time:              %.3f s, summed over threads\n", analysis_seconds);
+		if (seconds > 0.0)
+			printf("throughput:                 %.1f files/s, %.0f frames/s\n", files.size() / seconds, num_frames / seconds);
+	}
+	catch (BasicException& excpt)
+	{
+		logout << "BasicException caught at top level." << endl;
+		logout << "Exception message: " << excpt.msg << endl;
+		cerr << "Aborting due to exception. See log file for details." << endl;
+		return 1;
+	}
+	return 0;
+}
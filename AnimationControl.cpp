@@ -8,6 +8,10 @@
 // SKA configuration
 #include <Core/SystemConfiguration.h>
 // C/C++ libraries
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <mutex>
 #include <cstdio>
 #include <complex>
 // SKA modules
@@ -21,24 +25,18 @@
 // local application
 #include "AppConfig.h"
 #include "AnimationControl.h"
+#include "BoneHierarchy.h"
 #include "RenderLists.h"
 #include "OpenMotionSequenceController.h"
+#include "ClipLibrary.h"
+#include "PoseClip.h"
+#include "StreamingClip.h"
+#include "FootContacts.h"
+#include "Tracing.h"
 
 // global single instance of the animation controller
 AnimationControl anim_ctrl;
 
-enum MOCAP_TYPE { BVH, AMC };
-
-struct LoadSpec {
-	MOCAP_TYPE mocap_type;
-	float scale;
-	Color color;
-	string motion_file;
-	string skeleton_file;
-	LoadSpec(MOCAP_TYPE _mocap_type, float _scale, Color& _color, string& _motion_file, string& _skeleton_file=string(""))
-		: mocap_type(_mocap_type), scale(_scale), color(_color), motion_file(_motion_file), skeleton_file(_skeleton_file) { }
-};
-
 const short NUM_CHARACTERS = 3;
 LoadSpec load_specs[NUM_CHARACTERS] = {
 	LoadSpec(AMC, 1.0f, Color(0.8f,0.4f,0.8f), string("02/02_01.amc"), string("02/02.asf")),
@@ -46,81 +44,638 @@ LoadSpec load_specs[NUM_CHARACTERS] = {
 	LoadSpec(BVH, 0.2f, Color(0.0f,1.0f,0.0f), string("avoid/Avoid 9.bvh"))
 };
 
-Object* createMarkerBox(Vector3D position, Color _color)
-{
-	ModelSpecification markerspec("Box", _color);
-	markerspec.addSpec("length", "0.5");
-	markerspec.addSpec("width", "0.5");
-	markerspec.addSpec("height", "0.5");
-	Object* marker = new Object(markerspec,	position, Vector3D(0.0f, 0.0f, 0.0f));
-	return marker;
-}
+// When more characters are requested than there are load specs, the extra
+// instances of each spec are laid out on a grid with this spacing, and are
+// spread out in time so the crowd does not move in lockstep.
+const float CROWD_SPACING = 20.0f;
+const float CROWD_TIME_SPREAD = 0.618f;
+
+// characters handed to a worker at a time by updateAnimation()
+const unsigned int UPDATE_CHUNK_SIZE = 8;
+
+// blend layers reserved per character: a crossfade, another started
+// before it finished, and an additive layer
+const unsigned short CHARACTER_BLEND_LAYERS = 3;
 
 AnimationControl::AnimationControl() 
-	: ready(false), run_time(0.0f), 
+	: ready(false), run_time(0.0f), previous_run_time(0.0f), 
 	global_timewarp(1.0f),
-	next_marker_time(0.1f), marker_time_interval(0.1f), max_marker_time(20.0f)
-{ } 
+	next_marker_time(0.1f), marker_time_interval(0.1f), max_marker_time(20.0f),
+	markers_enabled(true), interpolation(false),
+	step_sync(false), lead_character(-1), lead_cursor(0), sync_phase(0.0f),
+	batched_bones(false),
+	lod_enabled(false), lod_viewpoint(0.0f, 0.0f, 0.0f), lod_pass(0), lod_step(0.0f), lod_last_time(0.0f),
+	num_crossfading(0),
+	update_pool(1),
+	pipelining(false), pipeline_stopping(false), pose_job_ready(false), pose_job_running(false),
+	poses_prepared(false), pose_job_time(0.0f), pose_job_sync(false), pose_job_phase(0.0f),
+	num_requested(0), next_request(0), loading(false)
+{
+	for (int l = 0; l < NUM_LODS; l++) lod_counts[l] = 0;
+	for (int l = 0; l < NUM_LODS; l++) lod_ahead_times[l] = lod_ahead_phases[l] = 0.0f;
+} 
 
 AnimationControl::~AnimationControl()	
 {		
+	setPipelining(false);
+	finishLoading();
 	for (unsigned short c=0; c<characters.size(); c++)
 		if (characters[c] != NULL) delete characters[c]; 
+	for (unsigned short w = 0; w < clip_warps.size(); w++)
+		if (clip_warps[w] != NULL) delete clip_warps[w];
 }
 
 void AnimationControl::restart()
 { 
+	finishPoses();
 	render_lists.eraseErasables();
+	// fade times would run again from 0, so fades end here instead
+	settleCrossfades(true);
 	run_time = 0; 
+	previous_run_time = 0;
 	updateAnimation(0.0f); 
 	next_marker_time = marker_time_interval;
 }
 
-bool AnimationControl::updateAnimation(float _elapsed_time)
+void AnimationControl::setNumThreads(unsigned short _num_threads)
 {
-	if (!ready) return false;
+	// the pipeline thread may be using the pool
+	finishPoses();
+	update_pool.setNumThreads(_num_threads);
+}
 
-	// the global time warp can be applied directly to the elapsed time between updates
-	float warped_elapsed_time = global_timewarp * _elapsed_time;
+void AnimationControl::setInterpolation(bool _interpolation)
+{
+	// prepared poses are dropped, since they were sampled the other way
+	finishPoses();
+	interpolation = _interpolation;
+	for (unsigned short c = 0; c < characters.size(); c++)
+	{
+		// (dangerous upcast)
+		OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[c]->getMotionController();
+		if (controller != NULL) controller->setInterpolation(interpolation);
+	}
+}
 
-	run_time += warped_elapsed_time;
+void AnimationControl::setStreamingBudget(size_t _bytes)
+{
+	clip_library.setStreamingBudget(_bytes);
+}
+
+void AnimationControl::setCompression(bool _compress, const CompressionSettings& _settings)
+{
+	clip_library.setCompression(_compress, _settings);
+}
+
+void AnimationControl::getStreamingStats(size_t& _resident_bytes, unsigned long& _blocking_reads, unsigned long& _prefetch_reads)
+{
+	_resident_bytes = 0;
+	_blocking_reads = 0;
+	_prefetch_reads = 0;
 	for (unsigned short c = 0; c < characters.size(); c++)
 	{
-		if (characters[c] != NULL) characters[c]->update(run_time);
+		// (dangerous upcast)
+		OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[c]->getMotionController();
+		StreamingClip* stream = dynamic_cast<StreamingClip*>(controller->getPoseSource());
+		if (stream == NULL) continue;
+		_resident_bytes += stream->residentBytes();
+		_blocking_reads += stream->numBlockingReads();
+		_prefetch_reads += stream->numPrefetchReads();
+	}
+}
 
-		// pull local time and frame out of each skeleton's controller
+BoneHandle AnimationControl::findBone(unsigned short _character, const string& _name)
+{
+	BoneHandle handle;
+	if (_character >= bone_poses.numCharacters() || bone_poses.getHierarchy(_character) == NULL) return handle;
+	handle.character = (short)_character;
+	handle.bone = bone_poses.getHierarchy(_character)->resolveBone(_name);
+	return handle;
+}
+
+bool AnimationControl::getBonePositions(BoneHandle _bone, Vector3D& _start, Vector3D& _end)
+{
+	if (!_bone.isValid()) return false;
+	BoneHierarchy* hierarchy = bone_poses.getHierarchy(_bone.character);
+	float start[3], end[3];
+	if (bone_poses.isSolved(_bone.character))
+	{
+		// straight from the batched transforms
+		const float* transforms = bone_poses.getTransforms(_bone.character);
+		for (int i = 0; i < 3; i++) start[i] = transforms[_bone.bone * BoneHierarchy::TRANSFORM_FLOATS + 9 + i];
+		hierarchy->boneEnd(transforms, (unsigned short)_bone.bone, end);
+	}
+	else
+	{
+		// the pose buffer has moved on; solve just the bone's chain
+		// (dangerous upcast)
+		OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[_bone.character]->getMotionController();
+		hierarchy->bonePositions(controller->getPose(), (unsigned short)_bone.bone, start, end);
+	}
+	_start = Vector3D(start[0], start[1], start[2]);
+	_end = Vector3D(end[0], end[1], end[2]);
+	return true;
+}
+
+void AnimationControl::getBoneObjects(unsigned short _c, unsigned int& _first, unsigned int& _end)
+{
+	_first = bone_object_starts[_c];
+	_end = (_c + 1u < bone_object_starts.size()) ? bone_object_starts[_c + 1] : (unsigned int)render_lists.bones.size();
+}
+
+unsigned long AnimationControl::poseDigest()
+{
+	// FNV-1a over the bytes of every character's pose buffer
+	unsigned long hash = 2166136261UL;
+	for (unsigned short c = 0; c < characters.size(); c++)
+	{
 		// (dangerous upcast)
 		OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[c]->getMotionController();
+		const unsigned char* bytes = (const unsigned char*)controller->getPose();
+		if (bytes == NULL) continue;
+		size_t num_bytes = controller->numChannels() * sizeof(float);
+		for (size_t i = 0; i < num_bytes; i++)
+			hash = ((hash ^ bytes[i]) * 16777619UL) & 0xffffffffUL;
+	}
+	return hash;
+}
+
+float AnimationControl::characterTime(unsigned int _c, float _time, bool _sync, float _phase, size_t* _cursor)
+{
+	CharacterWarp& character_warp = character_warps[_c];
+	if (!_sync || character_warp.warp == NULL) return _time;
+
+	float phase = _phase + character_warp.phase_offset;
+	float clip_time = (_cursor != NULL) ? character_warp.warp->time_curve.evaluate(phase, *_cursor)
+		: character_warp.warp->time_curve.evaluate(phase);
+	// the controller adds its own time offset back on
+	// (dangerous upcast)
+	OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[_c]->getMotionController();
+	return clip_time - controller->getTimeOffset();
+}
+
+// updates between the poses of a character at _level
+static unsigned int lodInterval(unsigned char _level)
+{
+	return (_level == LOD_HALF) ? 2 : (_level == LOD_QUARTER) ? 4 : 1;
+}
+
+void AnimationControl::updateLODs()
+{
+	TraceSpan span("update", "lods");
+	lod_pass++;
+	for (int l = 0; l < NUM_LODS; l++) lod_counts[l] = 0;
+	float half2 = lod_settings.half_distance * lod_settings.half_distance;
+	float quarter2 = lod_settings.quarter_distance * lod_settings.quarter_distance;
+	float root2 = lod_settings.root_distance * lod_settings.root_distance;
+	for (unsigned int c = 0; c < characters.size(); c++)
+	{
+		ANIMATION_LOD level = LOD_FULL;
+		if (lod_enabled && characters[c] != NULL)
+		{
+			// (dangerous upcast)
+			OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[c]->getMotionController();
+			Vector3D root = controller->getRootPosition();
+			float dx = root.x - lod_viewpoint.x, dy = root.y - lod_viewpoint.y, dz = root.z - lod_viewpoint.z;
+			float distance2 = dx * dx + dy * dy + dz * dz;
+			if (distance2 >= root2) level = batched_bones ? LOD_ROOT : LOD_QUARTER;
+			else if (distance2 >= quarter2) level = LOD_QUARTER;
+			else if (distance2 >= half2) level = LOD_HALF;
+		}
+		character_lods[c] = (unsigned char)level;
+		lod_counts[level]++;
+		lod_due[c] = ((lod_pass + c) % lodInterval(level)) == 0;
+	}
+}
+
+void AnimationControl::updateLODTimes(float _time)
+{
+	// the next updates are assumed to come at the pace of the last one
+	if (_time > lod_last_time) lod_step = _time - lod_last_time;
+	lod_last_time = _time;
+	if (!lod_enabled) return;
+	bool sync = step_sync && lead_character >= 0;
+	for (int l = 0; l < NUM_LODS; l++)
+	{
+		lod_ahead_times[l] = _time + lodInterval((unsigned char)l) * lod_step;
+		lod_ahead_phases[l] = sync ? character_warps[lead_character].warp->phase_curve.evaluate(lod_ahead_times[l]) : 0.0f;
+	}
+}
+
+unsigned int AnimationControl::crossfadeCharacters(float _duration)
+{
+	// the layers must not change while the pipeline samples them
+	finishPoses();
+	TraceSpan span("update", "crossfade");
+	for (unsigned int c = 0; c < characters.size(); c++)
+	{
+		if (characters[c] == NULL) continue;
+		// (dangerous upcast)
+		OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[c]->getMotionController();
+		short from = (crossfade_specs[c] >= 0) ? crossfade_specs[c] : character_specs[c];
+		// the pose left is matched as the clip it mostly comes from, which
+		// mid-crossfade may be a layer's; an unshared (streamed) clip can
+		// only be the character's own
+		long frame;
+		PoseSource* dominant = controller->dominantSource(frame);
+		short playing = character_specs[c];
+		for (short s = 0; s < (short)spec_sources.size(); s++)
+			if (spec_sources[s] != NULL && spec_sources[s] == dominant) playing = s;
+		const float* features = feature_index.frameFeatures(spec_feature_clips[playing], frame);
+		for (short step = 1; step < NUM_CHARACTERS; step++)
+		{
+			short to = (from + step) % NUM_CHARACTERS;
+			if (spec_sources[to] == NULL) continue;
+			// enter at the best match for the current frame, looped into the clip
+			float start_time = controller->getPoseTime();
+			float time_offset = controller->getTimeOffset();
+			FeatureMatch match;
+			if (features != NULL && spec_feature_clips[to] >= 0
+				&& feature_index.findNearest(features, 1, &match, spec_feature_clips[to]) == 1)
+			{
+				float duration = spec_sources[to]->getDuration();
+				time_offset = fmod(match.frame * duration / spec_sources[to]->numFrames() - start_time, duration);
+				if (time_offset < 0.0f) time_offset += duration;
+			}
+			// only clips with the same channels are accepted
+			if (!controller->crossfadeTo(spec_sources[to], start_time, _duration, time_offset)) continue;
+			if (crossfade_specs[c] < 0) num_crossfading++;
+			crossfade_specs[c] = to;
+			break;
+		}
+	}
+	return num_crossfading;
+}
+
+void AnimationControl::settleCrossfades(bool _all)
+{
+	if (num_crossfading == 0) return;
+	TraceSpan span("update", "crossfades");
+	for (unsigned int c = 0; c < characters.size(); c++)
+	{
+		if (crossfade_specs[c] < 0) continue;
+		// (dangerous upcast)
+		OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[c]->getMotionController();
+		bool clip_changed = controller->settleLayers(_all ? HUGE_VALF : controller->getPoseTime());
+		if (!controller->isCrossfading())
+		{
+			crossfade_specs[c] = -1;
+			num_crossfading--;
+		}
+		if (!clip_changed) continue;
+
+		// An earlier fade may finish while a later one is still pending
+		// ('t' pressed twice within the fade time), so the spec now playing
+		// is found from the clip the controller took over
+		short spec = -1;
+		for (short s = 0; s < (short)spec_sources.size() && spec < 0; s++)
+			if (spec_sources[s] != NULL && spec_sources[s] == controller->getPoseSource()) spec = s;
+		if (spec < 0) continue;
+		character_specs[c] = spec;
+
+		// step in time by the new clip's warp, if it has one
+		CharacterWarp& character_warp = character_warps[c];
+		character_warp.warp = clip_warps[spec];
+		character_warp.cursor = 0;
+		character_warp.phase_offset = 0.0f;
+		if (character_warp.warp != NULL)
+			character_warp.phase_offset = floor(character_warp.warp->phase_curve.evaluate(controller->getTimeOffset()) + 0.5f);
+		if ((short)c == lead_character && character_warp.warp == NULL)
+		{
+			lead_character = -1;
+			for (unsigned int w = 0; w < character_warps.size() && lead_character < 0; w++)
+				if (character_warps[w].warp != NULL) lead_character = (short)w;
+		}
+		if ((short)c == lead_character) lead_cursor = 0;
+	}
+}
+
+void AnimationControl::poseCharacter(unsigned int _c, float _time)
+{
+	// (dangerous upcast)
+	OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[_c]->getMotionController();
+	// SKA's skeleton runs its own forward kinematics, so unbatched
+	// characters only need their bounds for culling; tracked bones solve
+	// their own chains from the pose (see getBonePositions())
+	if (!batched_bones)
+	{
+		characters[_c]->update(_time);
+		bone_poses.solveBounds((unsigned short)_c, controller->getPose());
+		return;
+	}
+	if (!controller->hasPose(_time)) controller->samplePose(_time);
+	if (character_lods[_c] == LOD_ROOT) bone_poses.solveRoot((unsigned short)_c, controller->getPose());
+	else bone_poses.solve((unsigned short)_c, controller->getPose());
+}
+
+void AnimationControl::updateCharacters(unsigned int _begin, unsigned int _end, float _time)
+{
+	bool sync = step_sync && lead_character >= 0;
+	for (unsigned int c = _begin; c < _end; c++)
+	{
+		if (characters[c] == NULL) continue;
+		TraceSpan span("update", "character", "index", (int)c);
+		float time = characterTime(c, _time, sync, sync_phase, &character_warps[c].cursor);
+		// (dangerous upcast)
+		OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[c]->getMotionController();
+		// reduced rate characters sample a span up to their next update, and
+		// blend along it in between; poseCharacter() finds the pose in place
+		unsigned char level = character_lods[c];
+		if (!lod_due[c]) controller->blendSpan(time);
+		else if (lodInterval(level) > 1)
+			controller->sampleSpan(time, characterTime(c, lod_ahead_times[level], sync, lod_ahead_phases[level], NULL));
+		poseCharacter(c, time);
+
+		// pull local time and frame out of each skeleton's controller
 		display_data.sequence_time[c] = controller->getSequenceTime();
 		display_data.sequence_frame[c] = controller->getSequenceFrame();
 	}
+}
+
+void AnimationControl::updateSyncPhase(float _time)
+{
+	// step phase of the lead character, shared by every synchronized character
+	if (step_sync && lead_character >= 0)
+		sync_phase = character_warps[lead_character].warp->phase_curve.evaluate(_time, lead_cursor);
+}
 
-	if (run_time >= next_marker_time && run_time <= max_marker_time)
+void AnimationControl::poseCharacters(float _time)
+{
+	settleCrossfades();
+	updateLODs();
+	updateSyncPhase(_time);
+	updateLODTimes(_time);
+
+	// characters are independent; each one only writes its own display slots
+	update_pool.parallelFor((unsigned int)characters.size(), UPDATE_CHUNK_SIZE,
+		[this, _time](unsigned int _begin, unsigned int _end) { updateCharacters(_begin, _end, _time); });
+}
+
+void AnimationControl::dropMarkers(bool _posed)
+{
+	if (markers_enabled && run_time >= next_marker_time && run_time <= max_marker_time)
 	{
+		// Markers follow the simulation steps, whatever time is being
+		// displayed. The pipeline thread may be sampling the 1st character
+		// meanwhile, and its source (a StreamingClip's chunk slots, say) must
+		// not be sampled twice at once, so the job is waited for first; its
+		// poses are still applied as usual. The warp cursors are left to the
+		// pipeline. The marker bone is found from the pose buffer, so the
+		// skeleton itself need not be updated. A character the level of
+		// detail skipped, or moves by its root only, is not posed either.
+		if (!_posed || !lod_due[0] || character_lods[0] == LOD_ROOT)
+		{
+			waitForPoses();
+			updateSyncPhase(run_time);
+			// (dangerous upcast)
+			OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[0]->getMotionController();
+			controller->samplePose(characterTime(0, run_time, step_sync && lead_character >= 0, sync_phase, NULL));
+			bone_poses.invalidate(0);
+		}
+
 		Color color = Color(0.8f, 0.3f, 0.3f);
 		Vector3D start, end;
 		// drop box at left toes of 1st character
-		// CAREFUL - bones names are different in different skeletons
-		characters[0]->getBonePositions("ltoes", start, end);
-		Object* marker = createMarkerBox(end, color);
-		render_lists.erasables.push_back(marker);
+		if (getBonePositions(marker_bone, start, end))
+			render_lists.marker_trail.record(end, color);
 		next_marker_time += marker_time_interval;
 	}
+}
 
+void AnimationControl::setPipelining(bool _pipelining)
+{
+	if (_pipelining == pipelining) return;
+	if (_pipelining)
+	{
+		pipeline_stopping = false;
+		pipeline_thread = thread([this]() { pipelineLoop(); });
+	}
+	else
+	{
+		finishPoses();
+		{
+			lock_guard<mutex> lock(pipeline_mutex);
+			pipeline_stopping = true;
+		}
+		pipeline_wake.notify_one();
+		pipeline_thread.join();
+	}
+	pipelining = _pipelining;
+}
+
+void AnimationControl::pipelineLoop()
+{
+	tracer.nameThread("pipeline");
+	unique_lock<mutex> lock(pipeline_mutex);
+	while (true)
+	{
+		pipeline_wake.wait(lock, [this]() { return pose_job_ready || pipeline_stopping; });
+		if (pipeline_stopping) break;
+		pose_job_ready = false;
+		float time = pose_job_time;
+		bool sync = pose_job_sync;
+		float phase = pose_job_phase;
+		lock.unlock();
+
+		bool prepared = true;
+		try
+		{
+			TraceSpan span("update", "preparePoses");
+			update_pool.parallelFor((unsigned int)characters.size(), UPDATE_CHUNK_SIZE,
+				[this, time, sync, phase](unsigned int _begin, unsigned int _end) { prepareCharacters(_begin, _end, time, sync, phase); });
+		}
+		catch (BasicException&) { prepared = false; }
+		// anything else would reach std::terminate on this thread; the poses
+		// are sampled on the main thread instead, as for a failed job
+		catch (exception& excpt)
+		{
+			clip_library.log(string("AnimationControl::pipelineLoop: Poses not prepared: ") + excpt.what());
+			prepared = false;
+		}
+		catch (...)
+		{
+			clip_library.log("AnimationControl::pipelineLoop: Poses not prepared: unknown exception");
+			prepared = false;
+		}
+
+		lock.lock();
+		pose_job_running = false;
+		poses_prepared = prepared;
+		pipeline_done.notify_all();
+	}
+}
+
+void AnimationControl::startPoses(float _time)
+{
+	updateSyncPhase(_time);
+	updateLODTimes(_time);
+	{
+		lock_guard<mutex> lock(pipeline_mutex);
+		pose_job_time = _time;
+		pose_job_sync = step_sync && lead_character >= 0;
+		pose_job_phase = sync_phase;
+		pose_job_ready = true;
+		pose_job_running = true;
+	}
+	pipeline_wake.notify_one();
+}
+
+bool AnimationControl::finishPoses()
+{
+	if (!pipelining) return false;
+	unique_lock<mutex> lock(pipeline_mutex);
+	pipeline_done.wait(lock, [this]() { return !pose_job_running; });
+	bool prepared = poses_prepared;
+	poses_prepared = false;
+	return prepared;
+}
+
+void AnimationControl::waitForPoses()
+{
+	if (!pipelining) return;
+	unique_lock<mutex> lock(pipeline_mutex);
+	pipeline_done.wait(lock, [this]() { return !pose_job_running; });
+}
+
+void AnimationControl::prepareCharacters(unsigned int _begin, unsigned int _end, float _time, bool _sync, float _phase)
+{
+	for (unsigned int c = _begin; c < _end; c++)
+	{
+		if (characters[c] == NULL || !lod_due[c]) continue;
+		TraceSpan span("update", "prepare", "index", (int)c);
+		// (dangerous upcast)
+		OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[c]->getMotionController();
+		float time = characterTime(c, _time, _sync, _phase, &character_warps[c].cursor);
+		unsigned char level = character_lods[c];
+		if (lodInterval(level) > 1)
+			controller->prepareSpan(time, characterTime(c, lod_ahead_times[level], _sync, lod_ahead_phases[level], NULL));
+		else controller->preparePose(time);
+	}
+}
+
+void AnimationControl::applyCharacters(unsigned int _begin, unsigned int _end, float _time)
+{
+	for (unsigned int c = _begin; c < _end; c++)
+	{
+		if (characters[c] == NULL) continue;
+		TraceSpan span("update", "apply", "index", (int)c);
+		// (dangerous upcast)
+		OpenMotionSequenceController* controller = (OpenMotionSequenceController*)characters[c]->getMotionController();
+		// the skeleton reads the swapped in pose, so no sampling happens here;
+		// characters without one (new, or reset meanwhile) are sampled now.
+		// Nothing was prepared for reduced rate characters that were not due;
+		// they blend along the span swapped in at their last update.
+		if (!lod_due[c])
+		{
+			float time = characterTime(c, _time, pose_job_sync, pose_job_phase, &character_warps[c].cursor);
+			controller->blendSpan(time);
+			poseCharacter(c, time);
+		}
+		else if (controller->swapPose())
+		{
+			if (!batched_bones)
+			{
+				characters[c]->update(controller->getPoseTime());
+				bone_poses.solveBounds((unsigned short)c, controller->getPose());
+			}
+			else if (character_lods[c] == LOD_ROOT) bone_poses.solveRoot((unsigned short)c, controller->getPose());
+			else bone_poses.solve((unsigned short)c, controller->getPose());
+		}
+		else poseCharacter(c, _time);
+
+		display_data.sequence_time[c] = controller->getSequenceTime();
+		display_data.sequence_frame[c] = controller->getSequenceFrame();
+	}
+}
+
+void AnimationControl::presentCharacters(float _time)
+{
+	if (!pipelining)
+	{
+		poseCharacters(_time);
+		return;
+	}
+
+	// the single sync point: show what the pipeline finished, then start on _time
+	if (finishPoses())
+	{
+		float shown_time = pose_job_time;
+		update_pool.parallelFor((unsigned int)characters.size(), UPDATE_CHUNK_SIZE,
+			[this, shown_time](unsigned int _begin, unsigned int _end) { applyCharacters(_begin, _end, shown_time); });
+		// levels for the job about to start; applying used the previous job's
+		settleCrossfades();
+		updateLODs();
+	}
+	else poseCharacters(_time);
+	startPoses(_time);
+}
+
+bool AnimationControl::updateAnimation(float _elapsed_time)
+{
+	if (!ready) return false;
+	TraceSpan span("update", "updateAnimation");
+
+	// the global time warp can be applied directly to the elapsed time between updates
+	float warped_elapsed_time = global_timewarp * _elapsed_time;
+
+	run_time += warped_elapsed_time;
+	previous_run_time = run_time;
+
+	if (pipelining)
+	{
+		// the marker pose is replaced by the pipelined one right after
+		dropMarkers(false);
+		presentCharacters(run_time);
+	}
+	else
+	{
+		poseCharacters(run_time);
+		dropMarkers(true);
+	}
+	return true;
+}
+
+bool AnimationControl::stepAnimation(float _step)
+{
+	if (!ready) return false;
+	TraceSpan span("update", "stepAnimation");
+
+	previous_run_time = run_time;
+	run_time += global_timewarp * _step;
+	dropMarkers(false);
+	return true;
+}
+
+bool AnimationControl::presentAnimation(float _alpha)
+{
+	if (!ready) return false;
+	TraceSpan span("update", "presentAnimation");
+
+	// poses are sampled from the clips at any time, so sampling in between
+	// the last two steps interpolates between their poses
+	presentCharacters(previous_run_time + _alpha * (run_time - previous_run_time));
 	return true;
 }
 
 static Skeleton* buildCharacter(
 	Skeleton* _skel, 
 	MotionSequence* _ms, 
+	PoseSource* _source,
+	bool _owns_source,
+	bool _interpolation,
 	Color _bone_color, 
 	const string& _description1, 
 	const string& _description2,
+	float _time_offset,
+	const Vector3D& _root_offset,
 	vector<Object*>& _render_list)
 {
-	if ((_skel == NULL) || (_ms == NULL)) return NULL;
+	if ((_skel == NULL) || ((_ms == NULL) && (_source == NULL))) return NULL;
 
-	OpenMotionSequenceController* controller = new OpenMotionSequenceController(_ms);
+	OpenMotionSequenceController* controller = new OpenMotionSequenceController(_ms, _source, _owns_source);
+	controller->setInterpolation(_interpolation);
+	controller->setTimeOffset(_time_offset);
+	controller->setRootOffset(_root_offset);
 
 	//! Hack. The skeleton expects a list<Object*>, we're using a vector<Object*>
 	list<Object*> tmp;
@@ -135,101 +690,244 @@ static Skeleton* buildCharacter(
 	return _skel;
 }
 
-void AnimationControl::loadCharacters()
+// One unique load spec, read on a background thread: its clip plus a
+// skeleton for each instance that will play it.
+struct AnimationControl::LoadJob {
+	short spec;
+	unsigned short num_instances;
+	MotionClip* clip;
+	vector<Skeleton*> skeletons;
+	atomic<bool> done;
+	LoadJob() : spec(0), num_instances(0), clip(NULL), done(false) { }
+};
+
+void AnimationControl::loadCharacters(unsigned short _num_characters)
 {
+	startLoading(_num_characters);
+	if (loader_thread.joinable()) loader_thread.join();
+	pollLoading();
+}
+
+void AnimationControl::startLoading(unsigned short _num_characters)
+{
+	finishLoading();
+
+	num_requested = _num_characters;
+	if (num_requested == 0) num_requested = NUM_CHARACTERS;
+	next_request = 0;
+
 	data_manager.addFileSearchPath(AMC_MOTION_FILE_PATH);
 	data_manager.addFileSearchPath(BVH_MOTION_FILE_PATH);
 
-	Skeleton* skel = NULL;
-	MotionSequence* ms = NULL;
-	string descr1, descr2;
-	char* filename1 = NULL;
-	char* filename2 = NULL;
-	Skeleton* character = NULL;
-	pair<Skeleton*, MotionSequence*> read_result;
+	// one job per load spec; request r is instance r/NUM_CHARACTERS of spec r%NUM_CHARACTERS
+	for (short c = 0; c < NUM_CHARACTERS && c < num_requested; c++)
+	{
+		LoadJob* job = new LoadJob;
+		job->spec = c;
+		job->num_instances = (num_requested - c + NUM_CHARACTERS - 1) / NUM_CHARACTERS;
+		load_jobs.push_back(job);
+	}
+
+	if (clip_warps.size() < (size_t)NUM_CHARACTERS) clip_warps.resize(NUM_CHARACTERS, NULL);
+
+	loading = true;
+	loader_thread = thread([this]() {
+		tracer.nameThread("loader");
+		TraceSpan span("load", "loadCharacters");
+		WorkerPool loader_pool(0);
+		loader_pool.parallelFor((unsigned int)load_jobs.size(), 1,
+			[this](unsigned int _begin, unsigned int _end) {
+				for (unsigned int j = _begin; j < _end; j++) runLoadJob(load_jobs[j]);
+			});
+	});
+}
 
-	for (short c = 0; c < NUM_CHARACTERS; c++)
+void AnimationControl::runLoadJob(LoadJob* _job)
+{
+	try
 	{
-		if (load_specs[c].mocap_type == AMC)
+		// every instance of a spec shares the clip's motion
+		_job->clip = clip_library.getClip(load_specs[_job->spec]);
+		if (_job->clip != NULL)
 		{
-			try
 			{
-				filename1 = data_manager.findFile(load_specs[c].skeleton_file.c_str());
-				if (filename1 == NULL)
-				{
-					logout << "AnimationControl::loadCharacters: Unable to find character ASF file <" << load_specs[c].skeleton_file << ">. Aborting load." << endl;
-					throw BasicException("ABORT 1A");
-				}
-				filename2 = data_manager.findFile(load_specs[c].motion_file.c_str());
-				if (filename2 == NULL)
-				{
-					logout << "AnimationControl::loadCharacters: Unable to find character AMC file <" << load_specs[c].motion_file << ">. Aborting load." << endl;
-					throw BasicException("ABORT 1B");
-				}
-				try {
-					read_result = data_manager.readASFAMC(filename1, filename2);
-				}
-				catch (const DataManagementException& dme)
-				{
-					logout << "AnimationControl::loadCharacters: Unable to load character data files. Aborting load." << endl;
-					logout << "   Failure due to " << dme.msg << endl;
-					throw BasicException("ABORT 1C");
-				}
+				TraceSpan span("load", "hierarchy", "file", load_specs[_job->spec].motion_file);
+				clip_library.getHierarchy(_job->clip);
 			}
-			catch (BasicException&) {}
-		}
-		else if (load_specs[c].mocap_type == BVH)
-		{
-			try
+			// sync frames for time warping, read from the motion cache after the first run
 			{
-				filename1 = data_manager.findFile(load_specs[c].motion_file.c_str());
-				if (filename1 == NULL)
-				{
-					logout << "AnimationControl::loadCharacters: Unable to find character BVH file <" << load_specs[c].motion_file << ">. Aborting load." << endl;
-					throw BasicException("ABORT 2A");
-				}
-				try
-				{
-					read_result = data_manager.readBVH(filename1);
-				}
-				catch (const DataManagementException& dme)
-				{
-					logout << "AnimationControl::loadCharacters: Unable to load character data files. Aborting load." << endl;
-					logout << "   Failure due to " << dme.msg << endl;
-					throw BasicException("ABORT 2C");
-				}
+				TraceSpan span("load", "contacts", "file", load_specs[_job->spec].motion_file);
+				clip_library.analyzeFootContacts(_job->clip);
 			}
-			catch (BasicException&) {}
+			// pose features for the nearest-frame index, cached the same way
+			{
+				TraceSpan span("load", "features", "file", load_specs[_job->spec].motion_file);
+				clip_library.analyzePoseFeatures(_job->clip);
+			}
+			TraceSpan span("load", "skeletons", "instances", (int)_job->num_instances);
+			for (unsigned short i = 0; i < _job->num_instances; i++)
+				_job->skeletons.push_back(clip_library.createSkeleton(_job->clip));
 		}
+	}
+	// nothing thrown may escape the loader thread; the spec's characters
+	// are left out, as for a clip that failed to load, and the job still
+	// counts as done
+	catch (BasicException& excpt)
+	{
+		clip_library.log("AnimationControl::runLoadJob: Skipping <" + load_specs[_job->spec].motion_file + ">: " + string(excpt.msg));
+	}
+	catch (exception& excpt)
+	{
+		clip_library.log("AnimationControl::runLoadJob: Skipping <" + load_specs[_job->spec].motion_file + ">: " + excpt.what());
+	}
+	catch (...)
+	{
+		clip_library.log("AnimationControl::runLoadJob: Skipping <" + load_specs[_job->spec].motion_file + ">: unknown exception");
+	}
+	_job->done.store(true, memory_order_release);
+}
 
-		try
-		{
-			skel = read_result.first;
-			ms = read_result.second;
-			
-			skel->scaleBoneLengths(load_specs[c].scale);
-			ms->scaleChannel(CHANNEL_ID(0, CT_TX), load_specs[c].scale);
-			ms->scaleChannel(CHANNEL_ID(0, CT_TY), load_specs[c].scale);
-			ms->scaleChannel(CHANNEL_ID(0, CT_TZ), load_specs[c].scale);
-
-			// create a character to link all the pieces together.
-			descr1 = string("skeleton: ") + load_specs[c].skeleton_file;
-			descr2 = string("motion: ") + load_specs[c].motion_file;
-
-			character = buildCharacter(skel, ms, load_specs[c].color, descr1, descr2, render_lists.bones);
-			if (character != NULL) characters.push_back(character);
-		}
-		catch (BasicException&) {}
-		
-		strDelete(filename1); filename1 = NULL;
-		strDelete(filename2); filename2 = NULL;
+bool AnimationControl::pollLoading()
+{
+	if (!loading) return false;
+	TraceSpan span("load", "pollLoading");
+
+	unsigned short num_before = (unsigned short)characters.size();
+	bool pipeline_idle = false;
+	while (next_request < num_requested)
+	{
+		LoadJob* job = load_jobs[next_request % NUM_CHARACTERS];
+		if (!job->done.load(memory_order_acquire)) break;
+		// the pipeline thread must not be walking the characters as they grow
+		if (!pipeline_idle) { finishPoses(); pipeline_idle = true; }
+		buildRequestedCharacter(next_request);
+		next_request++;
 	}
 
-	display_data.num_characters = (short)characters.size();
-	display_data.sequence_time.resize(characters.size());
-	display_data.sequence_frame.resize(characters.size());
+	if (characters.size() != num_before)
+	{
+		display_data.num_characters = (short)characters.size();
+		display_data.sequence_time.resize(characters.size());
+		display_data.sequence_frame.resize(characters.size());
+		if (characters.size() > 0) ready = true;
+	}
 
-	if (characters.size() > 0) ready = true;
+	if (next_request == num_requested)
+	{
+		// once over every clip, rather than per clip added
+		feature_index.normalize();
+		finishLoading();
+	}
+	return loading;
 }
 
+void AnimationControl::finishLoading()
+{
+	if (loader_thread.joinable()) loader_thread.join();
+	for (unsigned short j = 0; j < load_jobs.size(); j++)
+	{
+		// skeletons that were never built into characters
+		for (unsigned short i = 0; i < load_jobs[j]->skeletons.size(); i++)
+			if (load_jobs[j]->skeletons[i] != NULL) delete load_jobs[j]->skeletons[i];
+		delete load_jobs[j];
+	}
+	load_jobs.clear();
+	loading = false;
+}
+
+void AnimationControl::buildRequestedCharacter(unsigned short _request)
+{
+	short c = _request % NUM_CHARACTERS;
+	unsigned short instance = _request / NUM_CHARACTERS;
+	LoadJob* job = load_jobs[c];
+
+	MotionClip* clip = job->clip;
+	if (clip == NULL || instance >= job->skeletons.size()) return;
+	Skeleton* skel = job->skeletons[instance];
+	job->skeletons[instance] = NULL;
+	if (skel == NULL) return;
+
+	// square grid large enough for the instances of any one spec
+	unsigned short instances_per_spec = (num_requested + NUM_CHARACTERS - 1) / NUM_CHARACTERS;
+	unsigned short grid_columns = (unsigned short)ceil(sqrt(float(instances_per_spec)));
+
+	float time_offset = 0.0f;
+	Vector3D root_offset(0.0f, 0.0f, 0.0f);
+	Color color = load_specs[c].color;
+	if (instance > 0)
+	{
+		float duration = clip->getDuration();
+		time_offset = fmod(instance * CROWD_TIME_SPREAD * duration, duration);
+		root_offset = Vector3D(CROWD_SPACING * (instance % grid_columns), 0.0f, CROWD_SPACING * (instance / grid_columns));
+		float shade = 1.0f - 0.04f * ((instance * 7) % 10);
+		color = Color(color.r * shade, color.g * shade, color.b * shade);
+	}
+
+	// create a character to link all the pieces together.
+	string descr1 = string("skeleton: ") + load_specs[c].skeleton_file;
+	string descr2 = string("motion: ") + load_specs[c].motion_file;
 
+	// streamed clips need a stream per instance, since each plays a different part
+	PoseSource* source = clip->pose_clip;
+	if (clip->compressed_clip != NULL) source = clip->compressed_clip;
+	bool owns_source = false;
+	if (clip->stream_layout != NULL)
+	{
+		StreamingClip* stream = new StreamingClip(*clip->stream_layout, clip_library.getStreamingBudget());
+		if (!stream->isOpen())
+		{
+			logout << "AnimationControl::loadCharacters: Unable to open motion cache <" << clip->stream_layout->path << "> for streaming." << endl;
+			delete stream;
+			delete skel;
+			return;
+		}
+		source = stream;
+		owns_source = true;
+	}
+
+	unsigned int first_bone_object = (unsigned int)render_lists.bones.size();
+	Skeleton* character = buildCharacter(skel, clip->motion, source, owns_source, interpolation, color, descr1, descr2, time_offset, root_offset, render_lists.bones);
+	if (character == NULL) { delete skel; return; }
+	characters.push_back(character);
+	bone_object_starts.push_back(first_bone_object);
+	// (dangerous upcast)
+	((OpenMotionSequenceController*)character->getMotionController())->reserveLayers(CHARACTER_BLEND_LAYERS);
+	character_specs.push_back(c);
+	crossfade_specs.push_back(-1);
+	if (spec_sources.size() < (size_t)NUM_CHARACTERS) spec_sources.resize(NUM_CHARACTERS, NULL);
+	if (!owns_source) spec_sources[c] = source;
+	if (spec_feature_clips.size() < (size_t)NUM_CHARACTERS) spec_feature_clips.resize(NUM_CHARACTERS, -1);
+	if (spec_feature_clips[c] < 0 && clip->pose_features != NULL)
+	{
+		TraceSpan span("load", "index", "file", load_specs[c].motion_file);
+		spec_feature_clips[c] = feature_index.addClip(*clip->pose_features);
+	}
+	bone_poses.addCharacter(clip_library.getHierarchy(clip), color);
+	character_lods.push_back(LOD_FULL);
+	lod_due.push_back(1);
+	if (characters.size() == 1)
+	{
+		marker_bone = findBone(0, "ltoes");
+		if (!marker_bone.isValid())
+			logout << "AnimationControl::loadCharacters: The 1st character has no left toes; no markers will be dropped." << endl;
+	}
+
+	// step warp of the clip, from the foot contacts found while loading
+	if (clip_warps[c] == NULL && clip->foot_contacts != NULL && source != NULL)
+	{
+		StepWarp* warp = new StepWarp;
+		if (warp->build(*clip->foot_contacts, source->numFrames(), source->getDuration())) clip_warps[c] = warp;
+		else delete warp;
+	}
+	CharacterWarp character_warp;
+	character_warp.warp = clip_warps[c];
+	character_warp.phase_offset = 0.0f;
+	character_warp.cursor = 0;
+	if (character_warp.warp != NULL)
+	{
+		// keep the crowd spread in time, but on whole steps so feet still land together
+		character_warp.phase_offset = floor(character_warp.warp->phase_curve.evaluate(time_offset) + 0.5f);
+		if (lead_character < 0) lead_character = (short)(characters.size() - 1);
+	}
+	character_warps.push_back(character_warp);
+}
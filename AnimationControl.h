@@ -10,13 +10,53 @@
 // SKA configuration
 #include <Core/SystemConfiguration.h>
 // C/C++ libraries
+#include <condition_variable>
 #include <list>
+#include <mutex>
+#include <thread>
 #include <vector>
 using namespace std;
 // SKA modules
+#include <Math/Vector3D.h>
 #include <Objects/Object.h>
+// local application
+#include "BonePoses.h"
+#include "CompressedClip.h"
+#include "PoseFeatures.h"
+#include "TimeWarp.h"
+#include "WorkerPool.h"
 
 class Skeleton;
+class BoneHierarchy;
+class PoseSource;
+
+// A bone of one character, resolved from its name once by
+// AnimationControl::findBone(), so that tracking it every frame involves
+// no name lookups.
+struct BoneHandle {
+	short character;
+	// index in the character's bone hierarchy, -1 if unresolved
+	short bone;
+	BoneHandle() : character(-1), bone(-1) { }
+	bool isValid() { return bone >= 0; }
+};
+
+// Animation level of detail, by distance from the viewpoint. Characters
+// at LOD_HALF and LOD_QUARTER are sampled on every 2nd and 4th update
+// (staggered, so each update samples a similar share of them), at that
+// update's time and one interval ahead, and in between their poses are
+// blended from the two. LOD_ROOT characters keep their joints still and only
+// move with the clip's root motion; that needs batched bones, without
+// which they are treated as LOD_QUARTER.
+enum ANIMATION_LOD { LOD_FULL, LOD_HALF, LOD_QUARTER, LOD_ROOT, NUM_LODS };
+
+struct LODSettings {
+	// distances from the viewpoint at which each level starts
+	float half_distance;
+	float quarter_distance;
+	float root_distance;
+	LODSettings() : half_distance(150.0f), quarter_distance(300.0f), root_distance(600.0f) { }
+};
 
 struct AnimationControl
 {
@@ -24,6 +64,8 @@ private:
 	// state for basic functionality
 	bool ready;
 	float run_time;
+	// run_time before the last stepAnimation()
+	float previous_run_time;
 	vector<Skeleton*> characters;
 
 	// state for enhanced functionality
@@ -31,6 +73,135 @@ private:
 	float next_marker_time;
 	float marker_time_interval;
 	float max_marker_time;
+	bool markers_enabled;
+	bool interpolation;
+
+	// step synchronization: every character with foot contacts is warped
+	// to step in time with the lead character (the first one built with
+	// contacts). The lead's warp gives the step phase of run_time once per
+	// update, and each character's warp turns that phase into clip time.
+	bool step_sync;
+	struct CharacterWarp {
+		// shared by the instances of a clip; NULL if the clip has no steps
+		StepWarp* warp;
+		// whole steps by which an instance leads or trails the lead character
+		float phase_offset;
+		// last segment looked up, so advancing lookups are O(1)
+		size_t cursor;
+	};
+	vector<CharacterWarp> character_warps;
+	// one warp per load spec, built with its first character
+	vector<StepWarp*> clip_warps;
+	short lead_character;
+	size_t lead_cursor;
+	float sync_phase;
+
+	// world transforms of all the characters' bones, solved whenever they
+	// are posed; each character's bone hierarchy (shared per clip) is
+	// kept there, NULL if it could not be read
+	BonePoses bone_poses;
+	// bone the marker trail follows
+	BoneHandle marker_bone;
+	// index in render_lists.bones of each character's first bone object
+	vector<unsigned int> bone_object_starts;
+	// batched bones: only the pose buffers and bone_poses are updated, and
+	// the renderer draws the bones from bone_poses; SKA's skeletons are
+	// left as they are
+	bool batched_bones;
+
+	// level of detail: the level each character was last assigned, whether
+	// it is due to be posed in the current update, and per level counts
+	bool lod_enabled;
+	LODSettings lod_settings;
+	Vector3D lod_viewpoint;
+	vector<unsigned char> character_lods;
+	vector<unsigned char> lod_due;
+	unsigned long lod_pass;
+	unsigned int lod_counts[NUM_LODS];
+	// updateLODs() assigns the levels for the next update; it must not run
+	// while the pipeline is preparing poses
+	void updateLODs();
+	// the last update's step, estimated from the times it was given, and
+	// per level the time (and step phase) one interval past the current
+	// update, where the spans of characters at that level end
+	float lod_step;
+	float lod_last_time;
+	float lod_ahead_times[NUM_LODS];
+	float lod_ahead_phases[NUM_LODS];
+	void updateLODTimes(float _time);
+
+	// crossfades (see crossfadeCharacters()): the load spec each character
+	// plays, the one it is fading to last (-1 if none), and each spec's clip as
+	// a source any character may blend in (NULL for streamed clips, which
+	// are not shared)
+	vector<short> character_specs;
+	vector<short> crossfade_specs;
+	vector<PoseSource*> spec_sources;
+	unsigned int num_crossfading;
+	// pose features of every loaded clip, and each load spec's clip in it
+	// (-1 if its features could not be found); crossfades enter the new
+	// clip at the frame that best matches the pose they leave
+	PoseFeatureIndex feature_index;
+	vector<short> spec_feature_clips;
+	// settleCrossfades() hands finished crossfades their new clip and step
+	// warp; like updateLODs(), only while the pipeline is idle. _all
+	// finishes every crossfade at once.
+	void settleCrossfades(bool _all = false);
+
+	// threads that share the per-character updates
+	WorkerPool update_pool;
+
+	// time to pose character _c at for global time _time; with _sync, its
+	// step warp is applied to step phase _phase, starting from *_cursor
+	float characterTime(unsigned int _c, float _time, bool _sync, float _phase, size_t* _cursor);
+	// poses character _c at _time (its skeleton too, unless batched_bones)
+	void poseCharacter(unsigned int _c, float _time);
+	void updateCharacters(unsigned int _begin, unsigned int _end, float _time);
+	void updateSyncPhase(float _time);
+	void poseCharacters(float _time);
+	// drops a marker if one is due at run_time; _posed if the characters
+	// already hold their run_time poses
+	void dropMarkers(bool _posed);
+
+	// Pipelined posing (see setPipelining()). The pipeline thread samples
+	// the poses of one job into the controllers' back buffers; the
+	// characters and their warps must not change while a job is running.
+	bool pipelining;
+	thread pipeline_thread;
+	mutex pipeline_mutex;
+	condition_variable pipeline_wake;
+	condition_variable pipeline_done;
+	bool pipeline_stopping;
+	bool pose_job_ready;
+	bool pose_job_running;
+	// a finished job whose poses have not been applied yet
+	bool poses_prepared;
+	float pose_job_time;
+	bool pose_job_sync;
+	float pose_job_phase;
+
+	void pipelineLoop();
+	void startPoses(float _time);
+	// waits for the running job; true if it left poses to apply
+	bool finishPoses();
+	// waits for the running job too, but leaves its poses to finishPoses()
+	void waitForPoses();
+	void prepareCharacters(unsigned int _begin, unsigned int _end, float _time, bool _sync, float _phase);
+	void applyCharacters(unsigned int _begin, unsigned int _end, float _time);
+	// poses the characters for display at _time, pipelined or not
+	void presentCharacters(float _time);
+
+	// asynchronous loading state (see startLoading())
+	struct LoadJob;
+	vector<LoadJob*> load_jobs;
+	unsigned short num_requested;
+	unsigned short next_request;
+	bool loading;
+	thread loader_thread;
+
+	void runLoadJob(LoadJob* _job);
+	void buildRequestedCharacter(unsigned short _request);
+	void finishLoading();
 
 public:
 	AnimationControl();
@@ -39,12 +210,40 @@ public:
 	// loadCharacters() sets up the characters and their motion control.
 	// It places all the bone objects for each character into the render list,
 	// so that they can be drawn by the graphics subsystem.
-	void loadCharacters();
+	// _num_characters > 0 cycles through the load specs until that many
+	// characters have been requested. Repeated specs become crowd instances
+	// that share one parsed clip, each with its own time offset, root
+	// placement and color.
+	// loadCharacters() blocks until every character is loaded; it is
+	// startLoading() followed by waiting for the background work.
+	void loadCharacters(unsigned short _num_characters = 0);
+
+	// startLoading() starts reading the mocap files for the requested
+	// characters on background threads and returns immediately.
+	void startLoading(unsigned short _num_characters = 0);
+	// pollLoading() builds, in request order, the characters whose files
+	// have been read. It must be called from the thread that renders and
+	// updates the characters (once per frame). Returns true while loading
+	// is still in progress.
+	bool pollLoading();
+	bool isLoading() { return loading; }
+	unsigned short numRequested() { return num_requested; }
+
+	unsigned short numCharacters() { return (unsigned short)characters.size(); }
 
 	// updateAnimation() should be called every frame to update all characters.
 	// _elapsed_time should be the time (in seconds) since the last frame/update.
 	bool updateAnimation(float _elapsed_time);
 
+	// Fixed timestep alternative to updateAnimation(): stepAnimation()
+	// advances the simulation (time, markers) by _step seconds without
+	// posing the characters, and presentAnimation() poses them for display
+	// at fraction _alpha (0..1) of the way from the previous step to the
+	// latest one. Called this way, simulation results do not depend on the
+	// frame rate.
+	bool stepAnimation(float _step);
+	bool presentAnimation(float _alpha);
+
 	bool isReady() { return ready; }
 
 	float getRunTime() { return run_time; }
@@ -55,6 +254,92 @@ public:
 	void increaseGlobalTimeWarp() { global_timewarp *= 2.0f; }
 	void decreaseGlobalTimeWarp() { global_timewarp /= 2.0f; }
 	float getGlobalTimeWarp() { return global_timewarp;  }
+
+	// number of threads used by updateAnimation(), counting the caller;
+	// 0 uses every hardware thread. Results do not depend on the count.
+	void setNumThreads(unsigned short _num_threads);
+	unsigned short numThreads() { return update_pool.numThreads(); }
+
+	// Pipelined mode: updateAnimation() and presentAnimation() hand the
+	// sampling of the new poses to a pipeline thread and return at once,
+	// and the characters show the poses finished during the previous frame,
+	// so sampling overlaps rendering at the cost of one frame of latency.
+	// Skeletons apply the finished poses at the start of the next update.
+	void setPipelining(bool _pipelining);
+	void togglePipelining() { setPipelining(!pipelining); }
+	bool isPipelining() { return pipelining; }
+
+	// blend between mocap frames instead of snapping to the lower frame
+	void setInterpolation(bool _interpolation);
+	void toggleInterpolation() { setInterpolation(!interpolation); }
+	bool isInterpolating() { return interpolation; }
+
+	// warp each character's clip time so that its steps match the lead's
+	void setStepSync(bool _step_sync) { step_sync = _step_sync; }
+	void toggleStepSync() { setStepSync(!step_sync); }
+	bool isStepSyncing() { return step_sync; }
+
+	// Clips with more than _bytes of frame data are streamed from the
+	// motion cache, keeping at most _bytes resident per character
+	// (see ClipLibrary::setStreamingBudget()). Set before loading.
+	void setStreamingBudget(size_t _bytes);
+	// totals over the streamed characters: frame bytes held in memory,
+	// chunk reads that stalled playback, and chunk reads done ahead of it
+	void getStreamingStats(size_t& _resident_bytes, unsigned long& _blocking_reads, unsigned long& _prefetch_reads);
+
+	// findBone() resolves _name on character _character once, trying the
+	// names the bone has in other skeleton formats too ("ltoes" finds a BVH
+	// "LeftToeBase"). getBonePositions() then gives the world positions of
+	// the bone's start and end in the character's current pose; it returns
+	// false for an unresolved handle.
+	BoneHandle findBone(unsigned short _character, const string& _name);
+	bool getBonePositions(BoneHandle _bone, Vector3D& _start, Vector3D& _end);
+
+	// character _c's bone objects are render_lists.bones[_first.._end-1]
+	void getBoneObjects(unsigned short _c, unsigned int& _first, unsigned int& _end);
+	// bounding sphere of character _c's current pose, for view culling;
+	// false if it has none (no bone hierarchy, or not yet posed)
+	bool getCharacterBounds(unsigned short _c, Vector3D& _center, float& _radius) { return bone_poses.getBounds(_c, _center, _radius); }
+
+	// Batched bones skip SKA's per-bone skeleton update; the renderer
+	// should then draw getBonePoses() instead of render_lists.bones.
+	void setBatchedBones(bool _batched) { batched_bones = _batched; }
+	void toggleBatchedBones() { setBatchedBones(!batched_bones); }
+	bool isBatchingBones() { return batched_bones; }
+	BonePoses& getBonePoses() { return bone_poses; }
+
+	// Level of detail (see ANIMATION_LOD), measured from _viewpoint, which
+	// should be kept up to date with the camera. Off by default.
+	void setLOD(bool _enabled) { lod_enabled = _enabled; }
+	void toggleLOD() { setLOD(!lod_enabled); }
+	bool isLODEnabled() { return lod_enabled; }
+	void setLODSettings(const LODSettings& _settings) { lod_settings = _settings; }
+	LODSettings getLODSettings() { return lod_settings; }
+	void setViewpoint(const Vector3D& _viewpoint) { lod_viewpoint = _viewpoint; }
+	// characters at _level in the last update
+	unsigned int numAtLOD(ANIMATION_LOD _level) { return lod_counts[_level]; }
+
+	// crossfadeCharacters() fades every character, over _duration seconds,
+	// to the next load spec's clip that has the same channels as its own
+	// (so calling it again fades back), entering it at the frame whose pose
+	// features are nearest its current frame's; characters without one,
+	// or whose clips are streamed, keep playing. Runs in the controllers'
+	// preallocated blend layers. Returns the number of characters fading.
+	unsigned int crossfadeCharacters(float _duration);
+	unsigned int numCrossfading() { return num_crossfading; }
+	// index over the pose features of the loaded clips
+	PoseFeatureIndex& getFeatureIndex() { return feature_index; }
+
+	// 32-bit hash of the characters' current poses, for checking that two
+	// runs (or builds) produced the same animation
+	unsigned long poseDigest();
+
+	// Clips held in memory are stored compressed, within _settings' error
+	// bounds (see ClipLibrary::setCompression()). Set before loading.
+	void setCompression(bool _compress, const CompressionSettings& _settings);
+
+	// the marker trail follows the 1st character's left toes; headless runs turn it off
+	void enableMarkers(bool _enabled) { markers_enabled = _enabled; }
 };
 
 // global single instance of the animation controller
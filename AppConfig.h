@@ -15,5 +15,7 @@
 #define BVH_MOTION_FILE_PATH "../../data/motion/BVH"
 // textures are BMP files that are used to color some objects (such as the sky)
 #define TEXTURE_FILE_PATH "../../data/textures"
+// derived data written on first load (skeleton stubs, cached clips)
+#define MOTION_CACHE_PATH "motion_cache"
 
 #endif // APPCONFIG_DOT_H
@@ -9,8 +9,11 @@
 // SKA configuration.
 #include <Core/SystemConfiguration.h>
 // C/C++ libraries
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 using namespace std;
 // openGL library
@@ -30,8 +33,12 @@ using namespace std;
 #include "AppConfig.h"
 #include "AnimationControl.h"
 #include "CameraControl.h"
+#include "FrameTimers.h"
+#include "HUDText.h"
+#include "InputLog.h"
 #include "InputProcessing.h"
 #include "RenderLists.h"
+#include "Tracing.h"
 
 // default window size
 static int window_height = 800;
@@ -45,12 +52,84 @@ static bool SHOW_COORD_AXIS = false;
 //  background color (black)
 static float clear_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f};
 
+// Frame scheduling. With fixed_step on, the animation is stepped at
+// simulation_rate steps per second whatever the frame rate, the poses drawn
+// are interpolated between the last two steps, and frames are paced to
+// target_fps by sleeping in GLUT's event loop instead of spinning in its
+// idle callback. -free-run (or 'f') goes back to one variable step per frame.
+static bool fixed_step = true;
+static float simulation_rate = 60.0f;
+static float target_fps = 60.0f;
+// longest stretch of time simulated in one frame, so a stall cannot
+// start a spiral of ever more catch-up steps
+const double MAX_FRAME_TIME = 0.25;
+static double simulation_lag = 0.0;
+typedef chrono::steady_clock FrameClock;
+static FrameClock::time_point next_frame_time;
+static bool frame_timer_pending = false;
+
+// frame timings are written here on 'p' and at exit
+const char* FRAME_TIMES_CSV = "frame_times.csv";
+
+void dumpFrameTimes()
+{
+	if (frame_timers.writeCSV(FRAME_TIMES_CSV))
+		logout << "Frame times written to <" << FRAME_TIMES_CSV << ">." << endl;
+	else
+		logout << "dumpFrameTimes: Unable to write <" << FRAME_TIMES_CSV << ">." << endl;
+}
+
+// heads-up display = 2D text on screen
+static HUDText hud_text;
+
+// shutDown() is only reached from GLUT callbacks, so the GL context is
+// still current for freeing the HUD's display lists
 void shutDown(int _exit_code)
 {
+	// the digest of the final poses lets a replay be checked against its recording
+	if (input_log.isRecording() || input_log.isReplaying() || input_log.replayFinished())
+		logout << "Input log: " << input_log.numFrames() << " frames, pose digest "
+			<< hex << anim_ctrl.poseDigest() << dec << "." << endl;
+	input_log.close();
+	dumpFrameTimes();
+	hud_text.release();
+	tracer.stop();
 	exit(_exit_code);
 }
 
-// heads-up display = 2D text on screen
+// view culling of characters, markers and background objects ('c')
+static bool culling = true;
+// objects drawn and culled in the last frame, for the HUD
+struct CullCounts {
+	unsigned int drawn;
+	unsigned int culled;
+	CullCounts() : drawn(0), culled(0) { }
+	void reset() { drawn = culled = 0; }
+	void count(bool _drawn) { if (_drawn) drawn++; else culled++; }
+};
+static CullCounts background_culls, marker_culls, character_culls;
+
+void toggleCulling()
+{
+	culling = !culling;
+}
+
+static bool inView(const Vector3D& _center, float _radius)
+{
+	return !culling || camera.isSphereVisible(_center, _radius);
+}
+
+// character rows shown at a time; larger crowds are paged with 'n'
+const short HUD_CHARACTER_ROWS = 12;
+static unsigned short hud_page = 0;
+// frames between refreshes of the frame time statistics
+const unsigned int HUD_STATS_FRAMES = 15;
+
+void nextHUDPage()
+{
+	hud_page++;
+}
+
 void drawHUD()
 {
 	glMatrixMode(GL_PROJECTION);
@@ -64,107 +143,382 @@ void drawHUD()
 	float y;
 	float row_height = 0.05f;
 
-	string s;
+	char s[64];
+	hud_text.beginFrame();
 
 	// first column
 	y = 0.9f;
-	s = "Global Time: ";
-	renderString(x1, y, 0.0f, color, s.c_str());
-	s = toString(anim_ctrl.getRunTime());
-	renderString(x2, y, 0.0f, color, s.c_str());
+	hud_text.draw(x1, y, color, "Global Time: ");
+	hud_text.draw(x2, y, color, anim_ctrl.getRunTime());
 	
 	y -= row_height;
 
-	s = "Global Time Warp: ";
-	renderString(x1, y, 0.0f, color, s.c_str());
-	s = toString(anim_ctrl.getGlobalTimeWarp());
-	renderString(x2, y, 0.0f, color, s.c_str());
+	hud_text.draw(x1, y, color, "Global Time Warp: ");
+	hud_text.draw(x2, y, color, anim_ctrl.getGlobalTimeWarp());
 
 	y -= row_height;
 
+	hud_text.draw(x1, y, color, "Frame Blend (b): ");
+	hud_text.draw(x2, y, color, anim_ctrl.isInterpolating() ? "on" : "off");
+
+	y -= row_height;
+
+	hud_text.draw(x1, y, color, "Step Sync (y): ");
+	hud_text.draw(x2, y, color, anim_ctrl.isStepSyncing() ? "on" : "off");
+
+	y -= row_height;
+
+	hud_text.draw(x1, y, color, "Fixed Step (f): ");
+	if (fixed_step) snprintf(s, sizeof(s), "%g Hz, %g fps", simulation_rate, target_fps);
+	else snprintf(s, sizeof(s), "off");
+	hud_text.draw(x2, y, color, s);
+
+	y -= row_height;
+
+	hud_text.draw(x1, y, color, "Pipelined (g): ");
+	hud_text.draw(x2, y, color, anim_ctrl.isPipelining() ? "on" : "off");
+
+	y -= row_height;
+
+	hud_text.draw(x1, y, color, "Batched Bones (h): ");
+	hud_text.draw(x2, y, color, anim_ctrl.isBatchingBones() ? "on" : "off");
+
+	y -= row_height;
+
+	// drawn / total over the objects that could be culled
+	hud_text.draw(x1, y, color, "Culling (c): ");
+	if (culling)
+		snprintf(s, sizeof(s), "%u/%u chars, %u/%u markers, %u/%u bg",
+			character_culls.drawn, character_culls.drawn + character_culls.culled,
+			marker_culls.drawn, marker_culls.drawn + marker_culls.culled,
+			background_culls.drawn, background_culls.drawn + background_culls.culled);
+	else snprintf(s, sizeof(s), "off");
+	hud_text.draw(x2, y, color, s);
+
+	y -= row_height;
+
+	// characters at each level: full / half rate / quarter rate / root only
+	hud_text.draw(x1, y, color, "Level of Detail (v): ");
+	if (anim_ctrl.isLODEnabled())
+		snprintf(s, sizeof(s), "%u / %u / %u / %u", anim_ctrl.numAtLOD(LOD_FULL), anim_ctrl.numAtLOD(LOD_HALF),
+			anim_ctrl.numAtLOD(LOD_QUARTER), anim_ctrl.numAtLOD(LOD_ROOT));
+	else snprintf(s, sizeof(s), "off");
+	hud_text.draw(x2, y, color, s);
+
+	y -= row_height;
+
+	hud_text.draw(x1, y, color, "Crossfading (t): ");
+	hud_text.draw(x2, y, color, (long)anim_ctrl.numCrossfading());
+
+	y -= row_height;
+
+	if (input_log.isRecording() || input_log.isReplaying())
+	{
+		hud_text.draw(x1, y, color, input_log.isRecording() ? "Recording: " : "Replaying: ");
+		hud_text.draw(x2, y, color, (long)input_log.numFrames());
+		y -= row_height;
+	}
+
+	if (anim_ctrl.isLoading())
+	{
+		hud_text.draw(x1, y, color, "Loading: ");
+		snprintf(s, sizeof(s), "%d / %d", (int)display_data.num_characters, (int)anim_ctrl.numRequested());
+		hud_text.draw(x2, y, color, s);
+		y -= row_height;
+	}
+
+	// recent frame times of each phase of display()
+	static PhaseStats stats[NUM_FRAME_PHASES];
+	static unsigned int frames_since_stats = HUD_STATS_FRAMES;
+	if (++frames_since_stats >= HUD_STATS_FRAMES)
+	{
+		frame_timers.getStats(stats);
+		frames_since_stats = 0;
+	}
+	hud_text.draw(x1, y, color, "Phase (p: save): ");
+	hud_text.draw(x2, y, color, "min / avg / p99 ms");
+	y -= row_height;
+	for (int p = 0; p < NUM_FRAME_PHASES; p++)
+	{
+		snprintf(s, sizeof(s), "%s: ", phaseName((FRAME_PHASE)p));
+		hud_text.draw(x1, y, color, s);
+		snprintf(s, sizeof(s), "%.2f / %.2f / %.2f", stats[p].min_ms, stats[p].avg_ms, stats[p].p99_ms);
+		hud_text.draw(x2, y, color, s);
+		y -= row_height;
+	}
+
 	y = 0.9f;
-	s = "Character: ";
-	renderString(x3, y, 0.0f, color, s.c_str());
-	s = "Time: ";
-	renderString(x4, y, 0.0f, color, s.c_str());
-	s = "Frame: ";
-	renderString(x5, y, 0.0f, color, s.c_str());
+	hud_text.draw(x3, y, color, "Character: ");
+	hud_text.draw(x4, y, color, "Time: ");
+	hud_text.draw(x5, y, color, "Frame: ");
 
 	y -= row_height;
 
-	for (short i = 0; i < display_data.num_characters; i++)
+	// one page of characters, so the cost does not grow with the crowd
+	short num_characters = display_data.num_characters;
+	short num_pages = (num_characters + HUD_CHARACTER_ROWS - 1) / HUD_CHARACTER_ROWS;
+	short first = 0;
+	if (num_pages > 1) first = (hud_page % num_pages) * HUD_CHARACTER_ROWS;
+	short last = min(num_characters, (short)(first + HUD_CHARACTER_ROWS));
+	for (short i = first; i < last; i++)
 	{
-		s = toString(i);
-		renderString(x3, y, 0.0f, color, s.c_str());
-		s = toString(display_data.sequence_time[i]);
-		renderString(x4, y, 0.0f, color, s.c_str());
-		s = toString(display_data.sequence_frame[i]);
-		renderString(x5, y, 0.0f, color, s.c_str());
+		hud_text.draw(x3, y, color, (long)i);
+		hud_text.draw(x4, y, color, display_data.sequence_time[i]);
+		hud_text.draw(x5, y, color, display_data.sequence_frame[i]);
 		y -= row_height;
 	}
+	if (num_pages > 1)
+	{
+		snprintf(s, sizeof(s), "%d-%d of %d (n: next page)", (int)first, (int)last - 1, (int)num_characters);
+		hud_text.draw(x3, y, color, s);
+	}
+}
+
+// drawMarkerTrail() draws the markers of _trail that are in view, with one
+// glDrawArrays() call per run of neighbouring slots
+static void drawMarkerTrail(MarkerTrail& _trail)
+{
+	marker_culls.reset();
+	if (_trail.numVertices() == 0) return;
+	glPushAttrib(GL_ENABLE_BIT);
+	glEnable(GL_COLOR_MATERIAL);
+	glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, _trail.positions());
+	glNormalPointer(GL_FLOAT, 0, _trail.normals());
+	glColorPointer(4, GL_FLOAT, 0, _trail.colors());
+	unsigned int run_start = 0;
+	for (unsigned int m = 0; m <= _trail.numMarkers(); m++)
+	{
+		bool drawn = (m < _trail.numMarkers()) && inView(_trail.markerPosition(m), _trail.markerRadius());
+		if (m < _trail.numMarkers()) marker_culls.count(drawn);
+		if (drawn) continue;
+		if (m > run_start)
+			glDrawArrays(GL_QUADS, (GLint)(run_start * MarkerTrail::VERTICES_PER_MARKER),
+				(GLsizei)((m - run_start) * MarkerTrail::VERTICES_PER_MARKER));
+		run_start = m + 1;
+	}
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glPopAttrib();
+}
+
+// drawBonePoses() draws the bones of the characters in view as lines from
+// _poses, with one glDrawArrays() call per run of neighbouring characters
+static void drawBonePoses(BonePoses& _poses)
+{
+	character_culls.reset();
+	if (_poses.numLineVertices() == 0) return;
+	glPushAttrib(GL_ENABLE_BIT | GL_LINE_BIT);
+	glDisable(GL_LIGHTING);
+	glLineWidth(3.0f);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, _poses.linePositions());
+	glColorPointer(4, GL_FLOAT, 0, _poses.lineColors());
+	unsigned short run_start = 0;
+	for (unsigned short c = 0; c <= _poses.numCharacters(); c++)
+	{
+		bool drawn = false;
+		if (c < _poses.numCharacters())
+		{
+			Vector3D center;
+			float radius;
+			drawn = !_poses.getBounds(c, center, radius) || inView(center, radius);
+			character_culls.count(drawn);
+			if (drawn) continue;
+		}
+		if (c > run_start)
+		{
+			unsigned int first = _poses.firstLineVertex(run_start);
+			unsigned int end = _poses.firstLineVertex(c - 1) + _poses.numLineVertices(c - 1);
+			glDrawArrays(GL_LINES, (GLint)first, (GLsizei)(end - first));
+		}
+		run_start = c + 1;
+	}
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glPopAttrib();
+}
+
+static void frameTimer(int)
+{
+	frame_timer_pending = false;
+	glutPostRedisplay();
+}
+
+// scheduleNextFrame() asks GLUT to redraw at the next frame time
+static void scheduleNextFrame()
+{
+	if (frame_timer_pending) return;
+	FrameClock::time_point now = FrameClock::now();
+	next_frame_time += chrono::duration_cast<FrameClock::duration>(chrono::duration<double>(1.0 / target_fps));
+	// after a slow frame, pace from now rather than rushing to catch up
+	if (next_frame_time < now) next_frame_time = now;
+	long wait_ms = (long)chrono::duration_cast<chrono::milliseconds>(next_frame_time - now).count();
+	// a fast replay runs its frames back to back
+	if (input_log.isFastReplay()) wait_ms = 0;
+	frame_timer_pending = true;
+	glutTimerFunc((unsigned int)wait_ms, frameTimer, 0);
+}
+
+void display(void);
+
+void toggleFixedStep()
+{
+	fixed_step = !fixed_step;
+	simulation_lag = 0.0;
+	if (fixed_step)
+	{
+		glutIdleFunc(NULL);
+		next_frame_time = FrameClock::now();
+		scheduleNextFrame();
+	}
+	else glutIdleFunc(display);
 }
 
 // display() is the call back function from the openGL rendering loop.
 // All recurring processing is initiated from this function.
 void display(void)
 {
+	frame_timers.beginFrame();
+	TraceSpan span("render", "frame");
+
 	// Determine how much time has passed since the previous frame.
-	double elapsed_time = system_timer.elapsedTime();
+	// Recorded runs log it; replays substitute the recorded time.
+	double elapsed_time = input_log.elapsedTime(system_timer.elapsedTime());
+	if (input_log.replayFinished()) shutDown(0);
 
 	// Check to see if any user inputs have been received since the last frame.
-	input_processor.processInputs(elapsed_time);
+	{
+		PhaseTimer timer(frame_timers, PHASE_INPUT);
+		input_processor.processInputs(elapsed_time);
+	}
+
+	// Add any characters that finished loading since the last frame.
+	if (anim_ctrl.isLoading())
+	{
+		PhaseTimer timer(frame_timers, PHASE_LOADING);
+		anim_ctrl.pollLoading();
+		if (!anim_ctrl.isLoading() && !anim_ctrl.isReady())
+		{
+			logout << "main(): Unable to load characters. Aborting program." << endl;
+			shutDown(1);
+		}
+	}
 
 	// Set up openGL to draw next frame.
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
 	camera.setSceneView();
+	camera.captureView();
 	glMatrixMode(GL_MODELVIEW);
+	anim_ctrl.setViewpoint(camera.getEyePosition());
 
 	// draw background objects
-	for (unsigned short b=0; b < render_lists.background.size(); b++)
 	{
-		Object* go = render_lists.background[b];
-		if (go->isVisible())
+		PhaseTimer timer(frame_timers, PHASE_BACKGROUND);
+		background_culls.reset();
+		for (unsigned short b=0; b < render_lists.background.size(); b++)
 		{
-			Matrix4x4 world_xform;
-			go->render(world_xform);
+			Object* go = render_lists.background[b];
+			if (go->isVisible())
+			{
+				BoundingSphere bounds;
+				if (b < render_lists.background_bounds.size()) bounds = render_lists.background_bounds[b];
+				bool drawn = inView(bounds.center, bounds.radius);
+				background_culls.count(drawn);
+				if (!drawn) continue;
+				Matrix4x4 world_xform;
+				go->render(world_xform);
+			}
 		}
 	}
 
-	// draw erasable objects
-	for (unsigned short b = 0; b < render_lists.erasables.size(); b++)
+	// draw erasable objects and the marker trail
 	{
-		Object* go = render_lists.erasables[b];
-		if (go->isVisible())
+		PhaseTimer timer(frame_timers, PHASE_MARKERS);
+		for (unsigned short b = 0; b < render_lists.erasables.size(); b++)
 		{
-			Matrix4x4 world_xform;
-			go->render(world_xform);
+			Object* go = render_lists.erasables[b];
+			if (go->isVisible())
+			{
+				Matrix4x4 world_xform;
+				go->render(world_xform);
+			}
 		}
+		drawMarkerTrail(render_lists.marker_trail);
 	}
 
 	// Tell the animation subsystem to update the character, then redraw it.
 	if (anim_ctrl.isReady())
 	{
-		if (anim_ctrl.updateAnimation(elapsed_time))
+		bool updated;
 		{
-			for (unsigned short b = 0; b < render_lists.bones.size(); b++)
+			PhaseTimer timer(frame_timers, PHASE_UPDATE);
+			if (fixed_step)
 			{
-				Object* go = render_lists.bones[b];
-				if (go->isVisible())
+				float step = 1.0f / simulation_rate;
+				simulation_lag += min(elapsed_time, MAX_FRAME_TIME);
+				while (simulation_lag >= step)
 				{
-					Matrix4x4 world_xform;
-					go->render(world_xform);
+					anim_ctrl.stepAnimation(step);
+					simulation_lag -= step;
+				}
+				updated = anim_ctrl.presentAnimation(float(simulation_lag / step));
+			}
+			else updated = anim_ctrl.updateAnimation(elapsed_time);
+		}
+		if (updated && anim_ctrl.isBatchingBones())
+		{
+			PhaseTimer timer(frame_timers, PHASE_BONES);
+			drawBonePoses(anim_ctrl.getBonePoses());
+		}
+		else if (updated)
+		{
+			PhaseTimer timer(frame_timers, PHASE_BONES);
+			character_culls.reset();
+			for (unsigned short c = 0; c < anim_ctrl.numCharacters(); c++)
+			{
+				Vector3D center;
+				float radius;
+				bool drawn = !anim_ctrl.getCharacterBounds(c, center, radius) || inView(center, radius);
+				character_culls.count(drawn);
+				if (!drawn) continue;
+				unsigned int first, end;
+				anim_ctrl.getBoneObjects(c, first, end);
+				for (unsigned int b = first; b < end; b++)
+				{
+					Object* go = render_lists.bones[b];
+					if (go->isVisible())
+					{
+						Matrix4x4 world_xform;
+						go->render(world_xform);
+					}
 				}
 			}
 		}
 	}
 
 	// draw the heads-up display
-	drawHUD();
+	{
+		PhaseTimer timer(frame_timers, PHASE_HUD);
+		drawHUD();
+	}
 
 	// Activate the new frame.
-	glutSwapBuffers();
+	{
+		PhaseTimer timer(frame_timers, PHASE_SWAP);
+		glutSwapBuffers();
+	}
+
+	frame_timers.endFrame();
+
+	if (fixed_step) scheduleNextFrame();
 
 	// Record any redering errors.
 	checkOpenGLError(203);
@@ -185,6 +539,8 @@ void buildObjects()
 		Object* sky = new Object(skymod, Vector3D(0.0f,0.0f,0.0f), Vector3D(0.0f,0.0f,0.0f));
 		// store sky object for rendering
 		render_lists.background.push_back(sky);
+		// the sky surrounds the camera, so it is never culled
+		render_lists.background_bounds.push_back(BoundingSphere());
 	}
 
 	if (SHOW_GROUND)
@@ -196,6 +552,8 @@ void buildObjects()
 			Vector3D(0.0f,0.0f,0.0f), Vector3D(0.0f,0.0f,0.0f), Vector3D(1.0f,1.0f,1.0f));
 		// store ground object for rendering
 		render_lists.background.push_back(ground);
+		// (the ground model's extent is not known here, so it is never culled)
+		render_lists.background_bounds.push_back(BoundingSphere());
 	}
 
 	if (SHOW_COORD_AXIS)
@@ -208,6 +566,7 @@ void buildObjects()
 			Vector3D(0.0f,0.0f,0.0f), Vector3D(0.0f,0.0f,0.0f));
 		// store coordinate axes object for rendering
 		render_lists.background.push_back(caxis);
+		render_lists.background_bounds.push_back(BoundingSphere(Vector3D(0.0f, 0.0f, 0.0f), 100.0f));
 	}
 }
 
@@ -251,15 +610,70 @@ void initializeGLUT(int argc, char **argv)
 
 int main(int argc, char **argv)
 {
-	// initialize the animation subsystem, which reads the
-	// mocap data files and sets up the character(s)
-	anim_ctrl.loadCharacters();
-	if (!anim_ctrl.isReady())
+	// -trace <file> writes a timeline of loading, updating and rendering
+	// -free-run, -sim-rate <steps/s>, -fps <frames/s> set the frame scheduling
+	// -pipeline samples the next poses while the current frame is drawn
+	// -batched-bones draws the bones from the batched transforms
+	// -lod <half>,<quarter>,<root> turns on the animation level of detail
+	// with those distances
+	// -record <file> logs each frame's elapsed time and input; -replay <file>
+	// plays such a log back at its recorded pace, -replay-fast <file> as
+	// fast as frames can be drawn
+	tracer.nameThread("main");
+	for (int a = 1; a < argc; a++)
 	{
-		logout << "main(): Unable to load characters. Aborting program." << endl;
-		return 1;
+		bool has_value = (a + 1 < argc);
+		if (strcmp(argv[a], "-trace") == 0 && has_value)
+		{
+			if (!tracer.start(argv[++a]))
+				logout << "main(): Unable to write trace file <" << argv[a] << ">." << endl;
+		}
+		else if (strcmp(argv[a], "-free-run") == 0)
+			fixed_step = false;
+		else if (strcmp(argv[a], "-pipeline") == 0)
+			anim_ctrl.setPipelining(true);
+		else if (strcmp(argv[a], "-batched-bones") == 0)
+			anim_ctrl.setBatchedBones(true);
+		else if (strcmp(argv[a], "-lod") == 0 && has_value)
+		{
+			LODSettings lod;
+			if (sscanf(argv[++a], "%f,%f,%f", &lod.half_distance, &lod.quarter_distance, &lod.root_distance) == 3)
+			{
+				anim_ctrl.setLODSettings(lod);
+				anim_ctrl.setLOD(true);
+			}
+			else logout << "main(): -lod expects half,quarter,root distances, not <" << argv[a] << ">." << endl;
+		}
+		else if (strcmp(argv[a], "-sim-rate") == 0 && has_value)
+			simulation_rate = max(1.0f, (float)atof(argv[++a]));
+		else if (strcmp(argv[a], "-fps") == 0 && has_value)
+			target_fps = max(1.0f, (float)atof(argv[++a]));
+		else if (strcmp(argv[a], "-record") == 0 && has_value)
+		{
+			if (!input_log.record(argv[++a]))
+				logout << "main(): Unable to write input log <" << argv[a] << ">." << endl;
+		}
+		else if ((strcmp(argv[a], "-replay") == 0 || strcmp(argv[a], "-replay-fast") == 0) && has_value)
+		{
+			bool fast = (strcmp(argv[a], "-replay-fast") == 0);
+			if (!input_log.replay(argv[++a], fast))
+			{
+				logout << "main(): Unable to read input log <" << argv[a] << ">. Aborting program." << endl;
+				exit(1);
+			}
+		}
 	}
 
+	// initialize the animation subsystem, which reads the
+	// mocap data files and sets up the character(s)
+	// Loading runs in the background; display() adds the characters
+	// as their files finish loading.
+	// Recorded and replayed runs load everything first, so that the
+	// characters' arrival does not depend on how fast the files are read.
+	anim_ctrl.setNumThreads(0);
+	if (input_log.isRecording() || input_log.isReplaying()) anim_ctrl.loadCharacters();
+	else anim_ctrl.startLoading();
+
 	// initialize openGL and enter its rendering loop.
 	try
 	{
@@ -273,7 +687,8 @@ int main(int argc, char **argv)
 
 		glutReshapeFunc(reshape);
 		glutDisplayFunc(display);
-		glutIdleFunc(display);
+		// fixed_step frames are paced by scheduleNextFrame() instead
+		if (!fixed_step) glutIdleFunc(display);
 
 		// Call into the SKA Graphics module to select the default lights.
 		initializeDefaultLighting();
@@ -289,6 +704,7 @@ int main(int argc, char **argv)
 
 		// Start the global system timer/clock.
 		system_timer.reset();
+		next_frame_time = FrameClock::now();
 
 		// Jump into the openGL render loop.
 		glutMainLoop();
@@ -0,0 +1,373 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// BenchmarkMain.cpp
+//    Headless driver for the animation subsystem. It loads the characters
+//    without opening a window and ticks AnimationControl::updateAnimation()
+//    at a fixed timestep, then reports throughput and per-frame latency.
+//    Usage: bench0003 [-characters N] [-frames M] [-timestep dt] [-warmup W]
+//           [-interpolate] [-threads T] [-scaling] [-stream-budget MB]
+//           [-compress] [-max-angle-error deg] [-max-position-error units]
+//           [-step-sync] [-batched-bones] [-lod half,quarter,root] [-crossfade s]
+//           [-trace file]
+//-----------------------------------------------------------------------------
+// SKA configuration.
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+using namespace std;
+// SKA modules
+#include <Core/BasicException.h>
+#include <Core/Utilities.h>
+// local application
+#include "AnimationControl.h"
+#include "ClipLibrary.h"
+#include "CompressedClip.h"
+#include "PoseMath.h"
+#include "Tracing.h"
+#include "WorkerPool.h"
+
+typedef chrono::steady_clock Clock;
+
+struct BenchmarkOptions {
+	unsigned short num_characters;
+	long num_frames;
+	long num_warmup_frames;
+	float timestep;
+	bool interpolate;
+	bool step_sync;
+	bool batched_bones;
+	bool lod;
+	LODSettings lod_settings;
+	float crossfade;
+	unsigned short num_threads;
+	bool scaling;
+	float stream_budget_mb;
+	bool compress;
+	CompressionSettings compression;
+	string trace_path;
+	BenchmarkOptions()
+		: num_characters(0), num_frames(1000), num_warmup_frames(10), timestep(1.0f/60.0f),
+		interpolate(false), step_sync(false), batched_bones(false), lod(false), crossfade(0.0f), num_threads(0), scaling(false), stream_budget_mb(0.0f), compress(false) { }
+};
+
+// -lod distances are measured from here, where the app's camera starts
+const Vector3D LOD_VIEWPOINT(100.0f, 10.0f, 0.0f);
+
+// timing results of one measured run
+struct BenchmarkRun {
+	unsigned short num_threads;
+	double wall_seconds;
+	double updates_per_second;
+	// per-frame update latency in milliseconds, sorted ascending
+	vector<double> frame_ms;
+};
+
+static void printUsage()
+{
+	cout << "usage: bench0003 [-characters N] [-frames M] [-timestep dt] [-warmup W]" << endl;
+	cout << "                 [-interpolate] [-threads T] [-scaling] [-stream-budget MB]" << endl;
+	cout << "                 [-compress] [-max-angle-error deg] [-max-position-error units]" << endl;
+	cout << "                 [-step-sync] [-batched-bones] [-lod half,quarter,root] [-crossfade s]" << endl;
+	cout << "                 [-trace file]" << endl;
+	cout << "   -characters N   number of characters to load (default: one per load spec)" << endl;
+	cout << "   -frames M       number of measured updates (default: 1000)" << endl;
+	cout << "   -timestep dt    seconds of animation time per update (default: 1/60)" << endl;
+	cout << "   -warmup W       unmeasured updates before timing starts (default: 10)" << endl;
+	cout << "   -interpolate    blend between mocap frames" << endl;
+	cout << "   -step-sync      time warp every character to step with the first one" << endl;
+	cout << "   -batched-bones  pose into the batched bone transforms only, skipping SKA's skeletons" << endl;
+	cout << "   -lod half,quarter,root  animation level of detail with these distances from" << endl;
+	cout << "                   the app's initial camera position" << endl;
+	cout << "   -crossfade s    crossfade every character to another clip over s seconds," << endl;
+	cout << "                   starting every 2s seconds of animation time" << endl;
+	cout << "   -threads T      update threads (default: 0 = one per hardware thread)" << endl;
+	cout << "   -scaling        repeat the run for 1, 2, 4 ... T threads and report speedup" << endl;
+	cout << "   -stream-budget MB  stream clips larger than MB megabytes from the motion cache" << endl;
+	cout << "   -compress       store clips quantized to 16 bits, dropping constant channels" << endl;
+	cout << "   -max-angle-error deg, -max-position-error units" << endl;
+	cout << "                   compress, also dropping frames rebuilt within these errors" << endl;
+	cout << "   -trace file     write a Chrome trace-event timeline of loading and updates" << endl;
+}
+
+static bool parseArguments(int argc, char **argv, BenchmarkOptions& _options)
+{
+	for (int a = 1; a < argc; a++)
+	{
+		bool has_value = (a + 1 < argc);
+		if (strcmp(argv[a], "-characters") == 0 && has_value)
+			_options.num_characters = (unsigned short)atoi(argv[++a]);
+		else if (strcmp(argv[a], "-frames") == 0 && has_value)
+			_options.num_frames = atol(argv[++a]);
+		else if (strcmp(argv[a], "-timestep") == 0 && has_value)
+			_options.timestep = (float)atof(argv[++a]);
+		else if (strcmp(argv[a], "-warmup") == 0 && has_value)
+			_options.num_warmup_frames = atol(argv[++a]);
+		else if (strcmp(argv[a], "-interpolate") == 0)
+			_options.interpolate = true;
+		else if (strcmp(argv[a], "-step-sync") == 0)
+			_options.step_sync = true;
+		else if (strcmp(argv[a], "-batched-bones") == 0)
+			_options.batched_bones = true;
+		else if (strcmp(argv[a], "-lod") == 0 && has_value)
+		{
+			LODSettings& lod = _options.lod_settings;
+			if (sscanf(argv[++a], "%f,%f,%f", &lod.half_distance, &lod.quarter_distance, &lod.root_distance) != 3) return false;
+			_options.lod = true;
+		}
+		else if (strcmp(argv[a], "-crossfade") == 0 && has_value)
+			_options.crossfade = (float)atof(argv[++a]);
+		else if (strcmp(argv[a], "-threads") == 0 && has_value)
+			_options.num_threads = (unsigned short)atoi(argv[++a]);
+		else if (strcmp(argv[a], "-scaling") == 0)
+			_options.scaling = true;
+		else if (strcmp(argv[a], "-stream-budget") == 0 && has_value)
+			_options.stream_budget_mb = (float)atof(argv[++a]);
+		else if (strcmp(argv[a], "-trace") == 0 && has_value)
+			_options.trace_path = argv[++a];
+		else if (strcmp(argv[a], "-compress") == 0)
+			_options.compress = true;
+		else if (strcmp(argv[a], "-max-angle-error") == 0 && has_value)
+		{
+			_options.compress = true;
+			_options.compression.max_angle_error = (float)atof(argv[++a]);
+		}
+		else if (strcmp(argv[a], "-max-position-error") == 0 && has_value)
+		{
+			_options.compress = true;
+			_options.compression.max_position_error = (float)atof(argv[++a]);
+		}
+		else
+			return false;
+	}
+	return (_options.num_frames > 0) && (_options.timestep > 0.0f) && (_options.stream_budget_mb >= 0.0f) && (_options.crossfade >= 0.0f)
+		&& (_options.compression.max_angle_error >= 0.0f) && (_options.compression.max_position_error >= 0.0f);
+}
+
+// value at fraction _p (0..1) of an ascending sorted sample set
+static double percentile(const vector<double>& _sorted, double _p)
+{
+	if (_sorted.empty()) return 0.0;
+	size_t index = size_t(_p * (_sorted.size() - 1) + 0.5);
+	return _sorted[index];
+}
+
+// runFrames() restarts the animation and times num_frames updates
+static BenchmarkRun runFrames(const BenchmarkOptions& _options, unsigned short _num_threads)
+{
+	BenchmarkRun run;
+	anim_ctrl.setNumThreads(_num_threads);
+	anim_ctrl.restart();
+	run.num_threads = anim_ctrl.numThreads();
+
+	for (long f = 0; f < _options.num_warmup_frames; f++)
+		anim_ctrl.updateAnimation(_options.timestep);
+
+	// crossfades start inside the measured frames, so any cost shows up there
+	float next_crossfade = anim_ctrl.getRunTime() + _options.crossfade;
+	run.frame_ms.resize((size_t)_options.num_frames);
+	Clock::time_point run_start = Clock::now();
+	for (long f = 0; f < _options.num_frames; f++)
+	{
+		Clock::time_point frame_start = Clock::now();
+		if (_options.crossfade > 0.0f && anim_ctrl.getRunTime() >= next_crossfade)
+		{
+			anim_ctrl.crossfadeCharacters(_options.crossfade);
+			next_crossfade += 2.0f * _options.crossfade;
+		}
+		anim_ctrl.updateAnimation(_options.timestep);
+		run.frame_ms[f] = chrono::duration<double, milli>(Clock::now() - frame_start).count();
+	}
+	run.wall_seconds = chrono::duration<double>(Clock::now() - run_start).count();
+
+	double update_seconds = 0.0;
+	for (size_t f = 0; f < run.frame_ms.size(); f++) update_seconds += run.frame_ms[f] / 1000.0;
+	sort(run.frame_ms.begin(), run.frame_ms.end());
+
+	run.updates_per_second = 0.0;
+	if (update_seconds > 0.0)
+		run.updates_per_second = double(anim_ctrl.numCharacters()) * _options.num_frames / update_seconds;
+	return run;
+}
+
+// printCompression() reports the size and accuracy of the compressed
+// clips, and how long decoding a whole pose takes
+static void printCompression()
+{
+	size_t raw_bytes = 0, compressed_bytes = 0;
+	unsigned int num_channels = 0, num_constant = 0;
+	float angle_error = 0.0f, position_error = 0.0f;
+	double decode_seconds = 0.0;
+	long num_decoded = 0;
+
+	vector<MotionClip*> clips = clip_library.getClips();
+	for (unsigned short i = 0; i < clips.size(); i++)
+	{
+		if (clips[i] == NULL || clips[i]->compressed_clip == NULL) continue;
+		CompressedClip* clip = clips[i]->compressed_clip;
+		raw_bytes += clip->uncompressedBytes();
+		compressed_bytes += clip->compressedBytes();
+		num_channels += clip->numChannels();
+		num_constant += clip->numConstantChannels();
+		angle_error = max(angle_error, clip->maxAngleError());
+		position_error = max(position_error, clip->maxPositionError());
+
+		float* pose = allocatePoseBuffer(clip->getStride());
+		Clock::time_point start = Clock::now();
+		for (long f = 0; f < clip->numFrames(); f++) clip->sampleBlend(f, 0.5f, pose);
+		decode_seconds += chrono::duration<double>(Clock::now() - start).count();
+		num_decoded += clip->numFrames();
+		freePoseBuffer(pose);
+	}
+	if (compressed_bytes == 0) return;
+
+	printf("clip storage:               %.2f MB -> %.2f MB compressed (%.1f:1), %u of %u channels constant\n",
+		raw_bytes / (1024.0 * 1024.0), compressed_bytes / (1024.0 * 1024.0), double(raw_bytes) / compressed_bytes,
+		num_constant, num_channels);
+	printf("compression error:          max %.4f deg rotation, %.4f units translation\n", angle_error, position_error);
+	printf("decode cost:                %.1f ns per blended pose\n", 1.0e9 * decode_seconds / num_decoded);
+}
+
+static void printFootContacts()
+{
+	unsigned int num_clips = 0, num_steps = 0;
+	vector<MotionClip*> clips = clip_library.getClips();
+	for (unsigned short i = 0; i < clips.size(); i++)
+	{
+		if (clips[i] == NULL || clips[i]->foot_contacts == NULL) continue;
+		num_clips++;
+		for (int foot = 0; foot < NUM_FEET; foot++) num_steps += (unsigned int)clips[i]->foot_contacts->contacts[foot].size();
+	}
+	printf("foot contacts:              %u steps in %u of %u clips\n", num_steps, num_clips, (unsigned)clips.size());
+}
+
+// printPoseFeatures() reports the size of the pose feature index, and
+// how long finding a frame's 5 nearest frames takes
+static void printPoseFeatures()
+{
+	PoseFeatureIndex& index = anim_ctrl.getFeatureIndex();
+	if (index.numFrames() == 0) return;
+
+	const unsigned int NUM_QUERIES = 1000;
+	FeatureMatch matches[5];
+	Clock::time_point start = Clock::now();
+	for (unsigned int q = 0; q < NUM_QUERIES; q++)
+	{
+		short clip = (short)(q % index.numClips());
+		index.findNearest(index.frameFeatures(clip, long(q * 7919) % index.numFrames(clip)), 5, matches);
+	}
+	double query_seconds = chrono::duration<double>(Clock::now() - start).count();
+	printf("pose features:              %lu frames in %u clips, %.1f us per 5-nearest query\n",
+		index.numFrames(), (unsigned)index.numClips(), 1.0e6 * query_seconds / NUM_QUERIES);
+}
+
+static void printRun(const BenchmarkRun& _run)
+{
+	printf("threads:                    %u\n", (unsigned)_run.num_threads);
+	printf("total wall time:            %.3f s\n", _run.wall_seconds);
+	printf("characters updated per sec: %.0f\n", _run.updates_per_second);
+	printf("frame latency (ms):         min %.4f  p50 %.4f  p90 %.4f  p99 %.4f  max %.4f\n",
+		_run.frame_ms.front(), percentile(_run.frame_ms, 0.50), percentile(_run.frame_ms, 0.90),
+		percentile(_run.frame_ms, 0.99), _run.frame_ms.back());
+}
+
+int main(int argc, char **argv)
+{
+	BenchmarkOptions options;
+	if (!parseArguments(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	tracer.nameThread("main");
+	if (!options.trace_path.empty() && !tracer.start(options.trace_path))
+	{
+		cerr << "Unable to write trace file " << options.trace_path << endl;
+		return 1;
+	}
+
+	try
+	{
+		Clock::time_point load_start = Clock::now();
+		anim_ctrl.enableMarkers(false);
+		anim_ctrl.setInterpolation(options.interpolate);
+		anim_ctrl.setStepSync(options.step_sync);
+		anim_ctrl.setBatchedBones(options.batched_bones);
+		anim_ctrl.setLOD(options.lod);
+		anim_ctrl.setLODSettings(options.lod_settings);
+		anim_ctrl.setViewpoint(LOD_VIEWPOINT);
+		anim_ctrl.setStreamingBudget(size_t(options.stream_budget_mb * 1024.0f * 1024.0f));
+		anim_ctrl.setCompression(options.compress, options.compression);
+		anim_ctrl.loadCharacters(options.num_characters);
+		double load_seconds = chrono::duration<double>(Clock::now() - load_start).count();
+		if (!anim_ctrl.isReady())
+		{
+			logout << "main(): Unable to load characters. Aborting benchmark." << endl;
+			cerr << "Unable to load characters. See log file for details." << endl;
+			return 1;
+		}
+
+		printf("characters:                 %u (%u unique clips)\n", (unsigned)anim_ctrl.numCharacters(), (unsigned)clip_library.numClips());
+		printf("frames:                     %ld (timestep %g s, %s%s%s)\n", options.num_frames, options.timestep,
+			options.interpolate ? "interpolated" : "snapped", options.step_sync ? ", step synced" : "",
+			options.batched_bones ? ", batched bones" : "");
+		printf("load time:                  %.3f s\n", load_seconds);
+		if (options.compress) printCompression();
+		printFootContacts();
+		printPoseFeatures();
+
+		unsigned short max_threads = options.num_threads;
+		if (max_threads == 0) max_threads = WorkerPool::hardwareThreads();
+
+		if (!options.scaling)
+		{
+			printRun(runFrames(options, max_threads));
+		}
+		else
+		{
+			vector<unsigned short> thread_counts;
+			for (unsigned short t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+			thread_counts.push_back(max_threads);
+
+			double serial_rate = 0.0;
+			printf("%8s %14s %9s %10s %10s\n", "threads", "chars/sec", "speedup", "p50 ms", "p99 ms");
+			for (unsigned short i = 0; i < thread_counts.size(); i++)
+			{
+				BenchmarkRun run = runFrames(options, thread_counts[i]);
+				if (i == 0) serial_rate = run.updates_per_second;
+				double speedup = (serial_rate > 0.0) ? run.updates_per_second / serial_rate : 0.0;
+				printf("%8u %14.0f %8.2fx %10.4f %10.4f\n", (unsigned)run.num_threads, run.updates_per_second,
+					speedup, percentile(run.frame_ms, 0.50), percentile(run.frame_ms, 0.99));
+			}
+		}
+
+		if (options.lod)
+			printf("level of detail:            %u full, %u half rate, %u quarter rate, %u root only\n",
+				anim_ctrl.numAtLOD(LOD_FULL), anim_ctrl.numAtLOD(LOD_HALF), anim_ctrl.numAtLOD(LOD_QUARTER), anim_ctrl.numAtLOD(LOD_ROOT));
+
+		if (options.stream_budget_mb > 0.0f)
+		{
+			size_t resident_bytes;
+			unsigned long blocking_reads, prefetch_reads;
+			anim_ctrl.getStreamingStats(resident_bytes, blocking_reads, prefetch_reads);
+			printf("streamed frame data:        %.2f MB resident, %lu chunks read ahead, %lu blocking reads\n",
+				resident_bytes / (1024.0 * 1024.0), prefetch_reads, blocking_reads);
+		}
+	}
+	catch (BasicException& excpt)
+	{
+		logout << "BasicException caught at top level." << endl;
+		logout << "Exception message: " << excpt.msg << endl;
+		cerr << "Aborting due to exception. See log file for details." << endl;
+		return 1;
+	}
+	tracer.stop();
+	return 0;
+}
@@ -0,0 +1,518 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// BoneHierarchy.cpp
+//    Bone hierarchy read straight from an ASF or BVH file, with a forward
+//    kinematics solver that works on whole pose buffers.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+// local application
+#include "BoneHierarchy.h"
+#include "PoseSource.h"
+
+const float DEGREES_TO_RADIANS = 3.14159265f / 180.0f;
+
+//-----------------------------------------------------------------------------
+// 3x3 row-major matrix helpers
+
+static void setIdentity(float* _m)
+{
+	for (int i = 0; i < 9; i++) _m[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+}
+
+// _out = _a * _b (_out must not alias either input)
+static void multiply(const float* _a, const float* _b, float* _out)
+{
+	for (int r = 0; r < 3; r++)
+		for (int c = 0; c < 3; c++)
+			_out[r * 3 + c] = _a[r * 3] * _b[c] + _a[r * 3 + 1] * _b[3 + c] + _a[r * 3 + 2] * _b[6 + c];
+}
+
+// _out = _a * transpose(_b)
+static void multiplyTransposed(const float* _a, const float* _b, float* _out)
+{
+	for (int r = 0; r < 3; r++)
+		for (int c = 0; c < 3; c++)
+			_out[r * 3 + c] = _a[r * 3] * _b[c * 3] + _a[r * 3 + 1] * _b[c * 3 + 1] + _a[r * 3 + 2] * _b[c * 3 + 2];
+}
+
+static void transform(const float* _m, const float* _v, float* _out)
+{
+	_out[0] = _m[0] * _v[0] + _m[1] * _v[1] + _m[2] * _v[2];
+	_out[1] = _m[3] * _v[0] + _m[4] * _v[1] + _m[5] * _v[2];
+	_out[2] = _m[6] * _v[0] + _m[7] * _v[1] + _m[8] * _v[2];
+}
+
+// _m = _m * R(_axis, _radians)
+static void rotate(float* _m, CHANNEL_TYPE _axis, float _radians)
+{
+	float c = cos(_radians), s = sin(_radians);
+	float r[9];
+	setIdentity(r);
+	if (_axis == CT_RX) { r[4] = c; r[5] = -s; r[7] = s; r[8] = c; }
+	else if (_axis == CT_RY) { r[0] = c; r[2] = s; r[6] = -s; r[8] = c; }
+	else { r[0] = c; r[1] = -s; r[3] = s; r[4] = c; }
+	float product[9];
+	multiply(_m, r, product);
+	for (int i = 0; i < 9; i++) _m[i] = product[i];
+}
+
+//-----------------------------------------------------------------------------
+// parsing helpers
+
+static string lowerCase(const string& _text)
+{
+	string result = _text;
+	for (unsigned int i = 0; i < result.size(); i++) result[i] = (char)tolower((unsigned char)result[i]);
+	return result;
+}
+
+static vector<string> splitWords(const string& _line)
+{
+	vector<string> words;
+	istringstream in(_line);
+	string word;
+	while (in >> word) words.push_back(word);
+	return words;
+}
+
+// rotation axis named by _name ("rx", "Xrotation", "X", ...), or -1
+static int rotationAxis(const string& _name)
+{
+	string name = lowerCase(_name);
+	if (name == "rx" || name == "xrotation" || name == "x") return CT_RX;
+	if (name == "ry" || name == "yrotation" || name == "y") return CT_RY;
+	if (name == "rz" || name == "zrotation" || name == "z") return CT_RZ;
+	return -1;
+}
+
+// 0, 1 or 2 for rotations about x, y or z
+static int axisIndex(CHANNEL_TYPE _axis)
+{
+	if (_axis == CT_RX) return 0;
+	if (_axis == CT_RY) return 1;
+	return 2;
+}
+
+// ASF axis orders such as "XYZ" name the rotations innermost first
+static void setAxisOrder(HierarchyBone& _bone, const string& _order)
+{
+	_bone.num_rotations = 0;
+	for (unsigned int i = 0; i < _order.size() && _bone.num_rotations < 3; i++)
+	{
+		int axis = rotationAxis(_order.substr(i, 1));
+		if (axis >= 0) _bone.rotation_order[_bone.num_rotations++] = (CHANNEL_TYPE)axis;
+	}
+}
+
+// rest orientation from three ASF axis angles applied in _order
+static void setAxisMatrix(float* _m, const float* _angles, const string& _order, float _angle_scale)
+{
+	HierarchyBone order;
+	setAxisOrder(order, _order);
+	setIdentity(_m);
+	for (int k = order.num_rotations - 1; k >= 0; k--)
+		rotate(_m, order.rotation_order[k], _angles[axisIndex(order.rotation_order[k])] * _angle_scale);
+}
+
+static HierarchyBone makeBone(const string& _name, short _bone_id)
+{
+	HierarchyBone bone;
+	bone.name = _name;
+	bone.bone_id = _bone_id;
+	bone.parent = -1;
+	for (int i = 0; i < 3; i++) { bone.offset[i] = 0.0f; bone.tip[i] = 0.0f; }
+	setIdentity(bone.axis);
+	bone.num_rotations = 0;
+	return bone;
+}
+
+//-----------------------------------------------------------------------------
+// BoneHierarchy
+
+BoneHierarchy::BoneHierarchy()
+	: angle_scale(DEGREES_TO_RADIANS)
+{
+	translation_slots[0] = translation_slots[1] = translation_slots[2] = -1;
+}
+
+short BoneHierarchy::findBone(const string& _name)
+{
+	for (unsigned short i = 0; i < bones.size(); i++)
+		if (bones[i].name == _name) return (short)i;
+	return -1;
+}
+
+// Names the same bone goes by in different skeletons: the ASF (Acclaim)
+// name first, then the usual BVH names. NULL ends a short row.
+const int NUM_BONE_NAMES = 4;
+static const char* const BONE_ALIASES[][NUM_BONE_NAMES] = {
+	{ "root", "Hips", "hip", NULL },
+	{ "lowerback", "Spine", "abdomen", NULL },
+	{ "thorax", "Spine1", "chest", NULL },
+	{ "neck", "Neck", NULL, NULL },
+	{ "head", "Head", NULL, NULL },
+	{ "lclavicle", "LeftShoulder", "lCollar", NULL },
+	{ "lhumerus", "LeftArm", "lShldr", NULL },
+	{ "lradius", "LeftForeArm", "lForeArm", NULL },
+	{ "lhand", "LeftHand", "lHand", NULL },
+	{ "rclavicle", "RightShoulder", "rCollar", NULL },
+	{ "rhumerus", "RightArm", "rShldr", NULL },
+	{ "rradius", "RightForeArm", "rForeArm", NULL },
+	{ "rhand", "RightHand", "rHand", NULL },
+	{ "lfemur", "LeftUpLeg", "LeftHip", "lThigh" },
+	{ "ltibia", "LeftLeg", "LeftKnee", "lShin" },
+	{ "lfoot", "LeftFoot", "LeftAnkle", "lFoot" },
+	{ "ltoes", "LeftToeBase", "LeftToe", "lToe" },
+	{ "rfemur", "RightUpLeg", "RightHip", "rThigh" },
+	{ "rtibia", "RightLeg", "RightKnee", "rShin" },
+	{ "rfoot", "RightFoot", "RightAnkle", "rFoot" },
+	{ "rtoes", "RightToeBase", "RightToe", "rToe" },
+};
+
+short BoneHierarchy::resolveBone(const string& _name)
+{
+	short found = findBone(_name);
+	if (found >= 0) return found;
+
+	// otherwise any name in _name's alias row, ignoring case
+	string name = lowerCase(_name);
+	for (unsigned int row = 0; row < sizeof(BONE_ALIASES) / sizeof(BONE_ALIASES[0]); row++)
+	{
+		bool in_row = false;
+		for (int n = 0; n < NUM_BONE_NAMES && BONE_ALIASES[row][n] != NULL; n++)
+			if (lowerCase(BONE_ALIASES[row][n]) == name) in_row = true;
+		if (!in_row) continue;
+		for (unsigned short b = 0; b < bones.size(); b++)
+		{
+			string bone_name = lowerCase(bones[b].name);
+			for (int n = 0; n < NUM_BONE_NAMES && BONE_ALIASES[row][n] != NULL; n++)
+				if (lowerCase(BONE_ALIASES[row][n]) == bone_name) return (short)b;
+		}
+	}
+	return -1;
+}
+
+bool BoneHierarchy::loadASF(const string& _path, float _scale)
+{
+	bones.clear();
+	ifstream in(_path.c_str());
+	if (!in) return false;
+
+	bones.push_back(makeBone("root", 0));
+	float axis_angle_scale = DEGREES_TO_RADIANS;
+	// per bone: direction and length, applied once the hierarchy is known
+	vector<float> tips;
+	tips.resize(3, 0.0f);
+	map<string, short> by_name;
+	by_name["root"] = 0;
+
+	string section, line;
+	HierarchyBone* bone = NULL;
+	float direction[3] = { 0.0f, 0.0f, 0.0f };
+	float length = 0.0f;
+	short next_id = 1;
+	while (getline(in, line))
+	{
+		vector<string> words = splitWords(line);
+		if (words.empty() || words[0][0] == '#') continue;
+		if (words[0][0] == ':')
+		{
+			section = lowerCase(words[0]);
+			continue;
+		}
+		string key = lowerCase(words[0]);
+
+		if (section == ":units")
+		{
+			if (key == "angle" && words.size() > 1 && lowerCase(words[1]).substr(0, 3) == "rad") axis_angle_scale = 1.0f;
+		}
+		else if (section == ":root")
+		{
+			HierarchyBone& root = bones[0];
+			if (key == "axis" && words.size() > 1) setAxisOrder(root, words[1]);
+			else if (key == "position" && words.size() > 3)
+			{
+				for (int i = 0; i < 3; i++) root.offset[i] = (float)atof(words[i + 1].c_str()) * _scale;
+			}
+			else if (key == "orientation" && words.size() > 3)
+			{
+				float angles[3];
+				for (int i = 0; i < 3; i++) angles[i] = (float)atof(words[i + 1].c_str());
+				// the orientation uses the root's axis order, given just before it
+				string order;
+				for (int k = 0; k < root.num_rotations; k++) order += char('X' + axisIndex(root.rotation_order[k]));
+				setAxisMatrix(root.axis, angles, order, axis_angle_scale);
+			}
+		}
+		else if (section == ":bonedata")
+		{
+			if (key == "begin")
+			{
+				bones.push_back(makeBone("", next_id++));
+				bone = &bones.back();
+				direction[0] = direction[1] = direction[2] = 0.0f;
+				length = 0.0f;
+			}
+			else if (bone == NULL) continue;
+			else if (key == "id" && words.size() > 1) bone->bone_id = (short)atoi(words[1].c_str());
+			else if (key == "name" && words.size() > 1) bone->name = words[1];
+			else if (key == "direction" && words.size() > 3)
+			{
+				for (int i = 0; i < 3; i++) direction[i] = (float)atof(words[i + 1].c_str());
+			}
+			else if (key == "length" && words.size() > 1) length = (float)atof(words[1].c_str());
+			else if (key == "axis" && words.size() > 4)
+			{
+				float angles[3];
+				for (int i = 0; i < 3; i++) angles[i] = (float)atof(words[i + 1].c_str());
+				setAxisMatrix(bone->axis, angles, words[4], axis_angle_scale);
+			}
+			else if (key == "dof")
+			{
+				// dof lists its rotations innermost first
+				bone->num_rotations = 0;
+				for (unsigned int i = 1; i < words.size() && bone->num_rotations < 3; i++)
+				{
+					int axis = rotationAxis(words[i]);
+					if (axis >= 0) bone->rotation_order[bone->num_rotations++] = (CHANNEL_TYPE)axis;
+				}
+			}
+			else if (key == "end")
+			{
+				by_name[bone->name] = (short)(bones.size() - 1);
+				for (int i = 0; i < 3; i++) tips.push_back(direction[i] * length * _scale);
+				bone = NULL;
+			}
+		}
+		else if (section == ":hierarchy")
+		{
+			if (key == "begin" || key == "end") continue;
+			map<string, short>::iterator parent = by_name.find(words[0]);
+			if (parent == by_name.end()) continue;
+			for (unsigned int i = 1; i < words.size(); i++)
+			{
+				map<string, short>::iterator child = by_name.find(words[i]);
+				if (child != by_name.end()) bones[child->second].parent = parent->second;
+			}
+		}
+	}
+	if (bones.size() < 2 || tips.size() != bones.size() * 3) return false;
+
+	// ASF directions are in world axes at rest, like the rotations built
+	// from the axis matrices, so a child starts at its parent's tip
+	for (unsigned short b = 0; b < bones.size(); b++)
+	{
+		for (int i = 0; i < 3; i++) bones[b].tip[i] = tips[b * 3 + i];
+		if (bones[b].parent > 0)
+			for (int i = 0; i < 3; i++) bones[b].offset[i] = tips[bones[b].parent * 3 + i];
+	}
+	sortParentsFirst();
+	return true;
+}
+
+bool BoneHierarchy::loadBVH(const string& _path, float _scale)
+{
+	bones.clear();
+	ifstream in(_path.c_str());
+	if (!in) return false;
+
+	// parents of the joints being read, innermost last; -2 marks an End Site
+	vector<short> open_joints;
+	bool tip_pending = false;
+	string line;
+	while (getline(in, line))
+	{
+		vector<string> words = splitWords(line);
+		if (words.empty()) continue;
+		string key = lowerCase(words[0]);
+
+		if (key == "motion") break;
+		else if (key == "root" || key == "joint")
+		{
+			short parent = open_joints.empty() ? -1 : open_joints.back();
+			HierarchyBone joint = makeBone((words.size() > 1) ? words[1] : string(""), (short)bones.size());
+			joint.parent = parent;
+			bones.push_back(joint);
+			tip_pending = false;
+		}
+		else if (key == "end")
+		{
+			tip_pending = true;
+		}
+		else if (key == "{")
+		{
+			open_joints.push_back(tip_pending ? -2 : (short)(bones.size() - 1));
+		}
+		else if (key == "}")
+		{
+			if (!open_joints.empty()) open_joints.pop_back();
+			tip_pending = false;
+		}
+		else if (key == "offset" && words.size() > 3)
+		{
+			float offset[3];
+			for (int i = 0; i < 3; i++) offset[i] = (float)atof(words[i + 1].c_str()) * _scale;
+			if (open_joints.empty()) continue;
+			if (open_joints.back() == -2)
+			{
+				// End Site: the tip of the joint that holds it
+				if (open_joints.size() < 2 || open_joints[open_joints.size() - 2] < 0) continue;
+				HierarchyBone& owner = bones[open_joints[open_joints.size() - 2]];
+				for (int i = 0; i < 3; i++) owner.tip[i] = offset[i];
+			}
+			else
+			{
+				HierarchyBone& joint = bones[open_joints.back()];
+				for (int i = 0; i < 3; i++) joint.offset[i] = offset[i];
+				// without an End Site, a joint ends where its first child starts
+				if (joint.parent >= 0)
+				{
+					HierarchyBone& parent = bones[joint.parent];
+					if (parent.tip[0] == 0.0f && parent.tip[1] == 0.0f && parent.tip[2] == 0.0f)
+						for (int i = 0; i < 3; i++) parent.tip[i] = offset[i];
+				}
+			}
+		}
+		else if (key == "channels" && !open_joints.empty() && open_joints.back() >= 0)
+		{
+			// BVH lists rotations outermost first
+			HierarchyBone& joint = bones[open_joints.back()];
+			vector<CHANNEL_TYPE> rotations;
+			for (unsigned int i = 2; i < words.size(); i++)
+			{
+				int axis = rotationAxis(words[i]);
+				if (axis >= 0) rotations.push_back((CHANNEL_TYPE)axis);
+			}
+			joint.num_rotations = 0;
+			for (int i = (int)rotations.size() - 1; i >= 0 && joint.num_rotations < 3; i--)
+				joint.rotation_order[joint.num_rotations++] = rotations[i];
+		}
+	}
+	return !bones.empty();
+}
+
+// sortParentsFirst() reorders the bones so every parent comes before its
+// children, which lets solve() run in a single pass. Bones that cannot be
+// reached from the root (missing from an ASF :hierarchy) are dropped.
+void BoneHierarchy::sortParentsFirst()
+{
+	vector<short> order(1, 0);
+	for (unsigned short i = 0; i < order.size(); i++)
+		for (unsigned short b = 1; b < bones.size(); b++)
+			if (bones[b].parent == order[i]) order.push_back((short)b);
+
+	vector<short> new_index(bones.size(), -1);
+	for (unsigned short i = 0; i < order.size(); i++) new_index[order[i]] = (short)i;
+	vector<HierarchyBone> sorted;
+	for (unsigned short i = 0; i < order.size(); i++)
+	{
+		sorted.push_back(bones[order[i]]);
+		if (i > 0) sorted.back().parent = new_index[sorted.back().parent];
+	}
+	bones = sorted;
+}
+
+bool BoneHierarchy::bindChannels(PoseSource* _source)
+{
+	rotation_slots.assign(bones.size() * 3, -1);
+	translation_slots[0] = translation_slots[1] = translation_slots[2] = -1;
+	angle_scale = _source->rotationsInDegrees() ? DEGREES_TO_RADIANS : 1.0f;
+
+	map<short, unsigned short> by_id;
+	for (unsigned short b = 0; b < bones.size(); b++) by_id[bones[b].bone_id] = b;
+
+	for (unsigned short c = 0; c < _source->numChannels(); c++)
+	{
+		CHANNEL_ID channel = _source->getChannel(c);
+		map<short, unsigned short>::iterator found = by_id.find(channel.bone_id);
+		if (found == by_id.end()) return false;
+		HierarchyBone& bone = bones[found->second];
+		if (found->second == 0)
+		{
+			if (channel.channel_type == CT_TX) translation_slots[0] = (short)c;
+			else if (channel.channel_type == CT_TY) translation_slots[1] = (short)c;
+			else if (channel.channel_type == CT_TZ) translation_slots[2] = (short)c;
+		}
+		for (unsigned char k = 0; k < bone.num_rotations; k++)
+			if (bone.rotation_order[k] == channel.channel_type) rotation_slots[found->second * 3 + k] = (short)c;
+	}
+	return true;
+}
+
+void BoneHierarchy::solveBone(const float* _pose, unsigned short _bone, const float* _parent, float* _world)
+{
+	const HierarchyBone& bone = bones[_bone];
+
+	// local rotation: axis * motion * axis^T
+	float motion[9];
+	setIdentity(motion);
+	for (int k = bone.num_rotations - 1; k >= 0; k--)
+	{
+		short slot = rotation_slots[_bone * 3 + k];
+		if (slot >= 0) rotate(motion, bone.rotation_order[k], _pose[slot] * angle_scale);
+	}
+	float axis_motion[9], local[9];
+	multiply(bone.axis, motion, axis_motion);
+	multiplyTransposed(axis_motion, bone.axis, local);
+
+	if (_parent == NULL)
+	{
+		for (int i = 0; i < 9; i++) _world[i] = local[i];
+		for (int i = 0; i < 3; i++)
+			_world[9 + i] = bone.offset[i] + ((translation_slots[i] >= 0) ? _pose[translation_slots[i]] : 0.0f);
+	}
+	else
+	{
+		multiply(_parent, local, _world);
+		float offset[3];
+		transform(_parent, bone.offset, offset);
+		for (int i = 0; i < 3; i++) _world[9 + i] = _parent[9 + i] + offset[i];
+	}
+}
+
+void BoneHierarchy::solve(const float* _pose, float* _transforms)
+{
+	for (unsigned short b = 0; b < bones.size(); b++)
+	{
+		const float* parent = (bones[b].parent < 0) ? NULL : _transforms + bones[b].parent * TRANSFORM_FLOATS;
+		solveBone(_pose, b, parent, _transforms + b * TRANSFORM_FLOATS);
+	}
+}
+
+void BoneHierarchy::bonePositions(const float* _pose, unsigned short _bone, float* _start, float* _end)
+{
+	// the chain from the root down to _bone, solved in that order
+	unsigned short chain[MAX_CHAIN];
+	int length = 0;
+	for (short b = (short)_bone; b >= 0 && length < MAX_CHAIN; b = bones[b].parent) chain[length++] = (unsigned short)b;
+
+	float transforms[2][TRANSFORM_FLOATS];
+	const float* parent = NULL;
+	for (int i = length - 1; i >= 0; i--)
+	{
+		float* world = transforms[i & 1];
+		solveBone(_pose, chain[i], parent, world);
+		parent = world;
+	}
+	for (int i = 0; i < 3; i++) _start[i] = parent[9 + i];
+	float tip[3];
+	transform(parent, bones[_bone].tip, tip);
+	for (int i = 0; i < 3; i++) _end[i] = parent[9 + i] + tip[i];
+}
+
+void BoneHierarchy::boneEnd(const float* _transforms, unsigned short _bone, float* _end)
+{
+	const float* world = _transforms + _bone * TRANSFORM_FLOATS;
+	float tip[3];
+	transform(world, bones[_bone].tip, tip);
+	for (int i = 0; i < 3; i++) _end[i] = world[9 + i] + tip[i];
+}
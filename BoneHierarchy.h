@@ -0,0 +1,95 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// BoneHierarchy.h
+//    Bone hierarchy read straight from an ASF or BVH file, with a forward
+//    kinematics solver that works on whole pose buffers. It is for
+//    analysis passes that need bone positions for every frame of a clip,
+//    where going through Skeleton::update() and getBonePositions() one
+//    frame at a time would be far too slow.
+//    Bone ids follow SKA's numbering: the root is 0, ASF bones use their
+//    "id" field and BVH joints are numbered in file order.
+//-----------------------------------------------------------------------------
+#ifndef BONEHIERARCHY_DOT_H
+#define BONEHIERARCHY_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <string>
+#include <vector>
+using namespace std;
+// SKA modules
+#include <Animation/MotionSequence.h>
+
+class PoseSource;
+
+struct HierarchyBone {
+	string name;
+	short bone_id;
+	// index of the parent in the hierarchy, -1 for the root
+	short parent;
+	// start of the bone relative to its parent's start, in the parent's frame
+	float offset[3];
+	// end of the bone relative to its start, in the bone's own frame
+	float tip[3];
+	// rest orientation of the rotation axes (ASF "axis"), row major
+	float axis[9];
+	// rotation channels in the order they apply to a vector, innermost first
+	CHANNEL_TYPE rotation_order[3];
+	unsigned char num_rotations;
+};
+
+class BoneHierarchy
+{
+public:
+	BoneHierarchy();
+
+	// Lengths and offsets are multiplied by _scale, matching the scale the
+	// clip was loaded with. Both return false if the file cannot be read.
+	bool loadASF(const string& _path, float _scale);
+	bool loadBVH(const string& _path, float _scale);
+
+	// bones are ordered parents first
+	unsigned short numBones() { return (unsigned short)bones.size(); }
+	const HierarchyBone& getBone(unsigned short _index) { return bones[_index]; }
+	// index of the bone called _name (case sensitive), or -1
+	short findBone(const string& _name);
+	// resolveBone() is findBone() that also tries the names the bone goes
+	// by in other skeleton formats, so "ltoes" finds a BVH "LeftToeBase"
+	short resolveBone(const string& _name);
+
+	// bindChannels() finds where each bone's channels sit in _source's
+	// poses. Returns false if _source has channels for bones that are not
+	// in the hierarchy, which means the two do not belong together.
+	bool bindChannels(PoseSource* _source);
+
+	// solve() runs forward kinematics for one pose of the bound source.
+	// _transforms receives 12 floats per bone: its world rotation (3x3,
+	// row major) followed by the world position of its start.
+	void solve(const float* _pose, float* _transforms);
+	// solveRoot() is solve() for the root (bone 0) alone
+	void solveRoot(const float* _pose, float* _transform) { solveBone(_pose, 0, NULL, _transform); }
+	// world position of the end of bone _bone, from solve()'s output
+	void boneEnd(const float* _transforms, unsigned short _bone, float* _end);
+	// bonePositions() solves only the chain from the root to _bone, for
+	// tracking a few bones; it gives the world positions of its start and end
+	void bonePositions(const float* _pose, unsigned short _bone, float* _start, float* _end);
+
+	static const unsigned int TRANSFORM_FLOATS = 12;
+	// deepest chain bonePositions() follows
+	static const int MAX_CHAIN = 64;
+
+private:
+	vector<HierarchyBone> bones;
+	// pose slots of each bone's rotation channels (by rotation_order) and
+	// of the root translation; -1 where the source has no such channel
+	vector<short> rotation_slots;
+	short translation_slots[3];
+	float angle_scale;
+
+	void sortParentsFirst();
+	// world transform of _bone from its parent's (NULL for the root)
+	void solveBone(const float* _pose, unsigned short _bone, const float* _parent, float* _world);
+};
+
+#endif // BONEHIERARCHY_DOT_H
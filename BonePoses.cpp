@@ -0,0 +1,191 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// BonePoses.cpp
+//    World transforms of every bone of every character, in one block.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+// local application
+#include "BonePoses.h"
+#include "BoneHierarchy.h"
+#include "PoseMath.h"
+
+// each character's transforms start on a cache line
+const size_t CACHE_LINE_BYTES = 64;
+const size_t CACHE_LINE_FLOATS = CACHE_LINE_BYTES / sizeof(float);
+// added to the bounding radius for the thickness SKA draws bones with
+const float BONE_PADDING = 1.0f;
+
+BonePoses::BonePoses()
+	: transforms(NULL), num_floats(0), capacity(0)
+{ }
+
+BonePoses::~BonePoses()
+{
+	freePoseBuffer(transforms);
+}
+
+unsigned short BonePoses::addCharacter(BoneHierarchy* _hierarchy, Color _color)
+{
+	CharacterBones character;
+	character.hierarchy = _hierarchy;
+	character.num_bones = (_hierarchy != NULL) ? _hierarchy->numBones() : 0;
+	character.first_float = num_floats;
+	character.first_vertex = line_colors.size() / 4;
+	character.solved = false;
+	character.bounds[0] = character.bounds[1] = character.bounds[2] = 0.0f;
+	character.bounds[3] = -1.0f;
+	// bones come parents first, so each one's distance from the root adds
+	// to its parent's; the root's own start is where the sphere centers
+	character.reach = 0.0f;
+	vector<float> distances(character.num_bones, 0.0f);
+	for (unsigned short b = 0; b < character.num_bones; b++)
+	{
+		const HierarchyBone& bone = _hierarchy->getBone(b);
+		if (bone.parent >= 0)
+			distances[b] = distances[bone.parent] + sqrt(bone.offset[0] * bone.offset[0] + bone.offset[1] * bone.offset[1] + bone.offset[2] * bone.offset[2]);
+		float tip = sqrt(bone.tip[0] * bone.tip[0] + bone.tip[1] * bone.tip[1] + bone.tip[2] * bone.tip[2]);
+		character.reach = max(character.reach, distances[b] + tip);
+	}
+	characters.push_back(character);
+
+	// grow the block, doubling it when full; the transforms are recomputed
+	// by the next solve() anyway
+	size_t character_floats = character.num_bones * BoneHierarchy::TRANSFORM_FLOATS;
+	size_t new_floats = num_floats + (character_floats + CACHE_LINE_FLOATS - 1) / CACHE_LINE_FLOATS * CACHE_LINE_FLOATS;
+	if (new_floats > capacity)
+	{
+		size_t new_capacity = max(new_floats, capacity * 2);
+		float* block = allocatePoseBuffer(new_capacity, CACHE_LINE_BYTES);
+		if (transforms != NULL) memcpy(block, transforms, num_floats * sizeof(float));
+		freePoseBuffer(transforms);
+		transforms = block;
+		capacity = new_capacity;
+	}
+	memset(transforms + num_floats, 0, (new_floats - num_floats) * sizeof(float));
+	num_floats = new_floats;
+
+	// two line vertices per bone, with the character's color
+	line_positions.resize(line_positions.size() + character.num_bones * 2 * 3, 0.0f);
+	for (unsigned int v = 0; v < character.num_bones * 2u; v++)
+	{
+		line_colors.push_back(_color.r);
+		line_colors.push_back(_color.g);
+		line_colors.push_back(_color.b);
+		line_colors.push_back(_color.a);
+	}
+	return (unsigned short)(characters.size() - 1);
+}
+
+void BonePoses::clear()
+{
+	characters.clear();
+	freePoseBuffer(transforms);
+	transforms = NULL;
+	num_floats = 0;
+	capacity = 0;
+	line_positions.clear();
+	line_colors.clear();
+}
+
+void BonePoses::solve(unsigned short _c, const float* _pose)
+{
+	CharacterBones& character = characters[_c];
+	if (character.hierarchy == NULL || _pose == NULL) return;
+	float* world = transforms + character.first_float;
+	character.hierarchy->solve(_pose, world);
+
+	float* line = &line_positions[character.first_vertex * 3];
+	for (unsigned short b = 0; b < character.num_bones; b++, line += 6)
+	{
+		const float* bone = world + b * BoneHierarchy::TRANSFORM_FLOATS;
+		for (int i = 0; i < 3; i++) line[i] = bone[9 + i];
+		character.hierarchy->boneEnd(world, b, line + 3);
+	}
+	character.solved = true;
+	updateBounds(character);
+}
+
+void BonePoses::solveBounds(unsigned short _c, const float* _pose)
+{
+	CharacterBones& character = characters[_c];
+	character.solved = false;
+	if (character.hierarchy == NULL || _pose == NULL) return;
+	float root[BoneHierarchy::TRANSFORM_FLOATS];
+	character.hierarchy->solveRoot(_pose, root);
+	for (int i = 0; i < 3; i++) character.bounds[i] = root[9 + i];
+	character.bounds[3] = character.reach + BONE_PADDING;
+}
+
+void BonePoses::updateBounds(CharacterBones& _character)
+{
+	if (_character.num_bones == 0) return;
+	// sphere around the box of the line ends
+	const float* point = &line_positions[_character.first_vertex * 3];
+	float low[3] = { point[0], point[1], point[2] };
+	float high[3] = { point[0], point[1], point[2] };
+	for (unsigned int v = 1; v < _character.num_bones * 2u; v++)
+	{
+		point += 3;
+		for (int i = 0; i < 3; i++)
+		{
+			low[i] = min(low[i], point[i]);
+			high[i] = max(high[i], point[i]);
+		}
+	}
+	float half_diagonal2 = 0.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		_character.bounds[i] = 0.5f * (low[i] + high[i]);
+		half_diagonal2 += 0.25f * (high[i] - low[i]) * (high[i] - low[i]);
+	}
+	_character.bounds[3] = sqrt(half_diagonal2) + BONE_PADDING;
+}
+
+void BonePoses::solveRoot(unsigned short _c, const float* _pose)
+{
+	CharacterBones& character = characters[_c];
+	if (character.hierarchy == NULL || _pose == NULL) return;
+	if (!character.solved)
+	{
+		solve(_c, _pose);
+		return;
+	}
+	float* world = transforms + character.first_float;
+	float root[BoneHierarchy::TRANSFORM_FLOATS];
+	character.hierarchy->solveRoot(_pose, root);
+
+	// delta = new root rotation * old root rotation^T; bones turn by
+	// delta about the old root position, then move with it
+	float delta[9];
+	for (int r = 0; r < 3; r++)
+		for (int c = 0; c < 3; c++)
+			delta[r * 3 + c] = root[r * 3] * world[c * 3] + root[r * 3 + 1] * world[c * 3 + 1] + root[r * 3 + 2] * world[c * 3 + 2];
+	float old_position[3] = { world[9], world[10], world[11] };
+
+	float* line = &line_positions[character.first_vertex * 3];
+	for (unsigned short b = 0; b < character.num_bones; b++, line += 6)
+	{
+		float* bone = world + b * BoneHierarchy::TRANSFORM_FLOATS;
+		float rotation[9];
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++)
+				rotation[r * 3 + c] = delta[r * 3] * bone[c] + delta[r * 3 + 1] * bone[3 + c] + delta[r * 3 + 2] * bone[6 + c];
+		for (int i = 0; i < 9; i++) bone[i] = rotation[i];
+		// both ends of the bone's line move the same way as its start
+		for (int v = 0; v < 2; v++)
+		{
+			float* point = line + v * 3;
+			float local[3] = { point[0] - old_position[0], point[1] - old_position[1], point[2] - old_position[2] };
+			for (int i = 0; i < 3; i++)
+				point[i] = root[9 + i] + delta[i * 3] * local[0] + delta[i * 3 + 1] * local[1] + delta[i * 3 + 2] * local[2];
+		}
+		for (int i = 0; i < 3; i++) bone[9 + i] = line[i];
+	}
+	updateBounds(character);
+}
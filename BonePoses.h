@@ -0,0 +1,110 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// BonePoses.h
+//    World transforms of every bone of every character, in one contiguous
+//    block. Each character's range starts on a cache line; within it the
+//    bones follow their hierarchy's parents-first order, TRANSFORM_FLOATS
+//    each (see BoneHierarchy::solve()). solve() fills a character's range
+//    in one linear pass straight from its pose buffer, and writes the line
+//    segments the renderer draws all the bones with, so neither rendering
+//    nor bone queries have to walk SKA's bone objects.
+//    Kept free of OpenGL calls so the headless benchmark can link it.
+//-----------------------------------------------------------------------------
+#ifndef BONEPOSES_DOT_H
+#define BONEPOSES_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <vector>
+using namespace std;
+// SKA modules
+#include <Math/Vector3D.h>
+#include <Objects/Object.h>
+
+class BoneHierarchy;
+
+class BonePoses
+{
+public:
+	BonePoses();
+	~BonePoses();
+
+	// addCharacter() reserves room for the bones of _hierarchy (which may
+	// be NULL, for a character without one) and returns the character's
+	// index. The block grows geometrically, so adding a crowd one character
+	// at a time stays linear; when it does grow it moves, so addCharacter()
+	// must not overlap solve().
+	unsigned short addCharacter(BoneHierarchy* _hierarchy, Color _color);
+	void clear();
+
+	// solve() runs forward kinematics for character _c on _pose (laid out
+	// as its hierarchy is bound). Different characters may be solved on
+	// different threads at once.
+	void solve(unsigned short _c, const float* _pose);
+	// solveRoot() moves _c's last solved bones rigidly with the root of
+	// _pose, leaving the joints as they were; far cheaper than solve(),
+	// which it falls back to if _c has not been solved yet
+	void solveRoot(unsigned short _c, const float* _pose);
+	// solveBounds() only moves _c's bounding sphere to the root of _pose,
+	// with a radius that holds any pose, and leaves the transforms marked
+	// unsolved; for characters SKA's skeleton poses and draws
+	void solveBounds(unsigned short _c, const float* _pose);
+	// invalidate() marks _c's transforms as not matching its pose buffer
+	void invalidate(unsigned short _c) { characters[_c].solved = false; }
+	bool isSolved(unsigned short _c) { return characters[_c].solved; }
+
+	// bounding sphere of _c's bones as last solved; false if it has none yet
+	bool getBounds(unsigned short _c, Vector3D& _center, float& _radius)
+	{
+		const CharacterBones& character = characters[_c];
+		_center = Vector3D(character.bounds[0], character.bounds[1], character.bounds[2]);
+		_radius = character.bounds[3];
+		return character.bounds[3] >= 0.0f;
+	}
+
+	unsigned short numCharacters() { return (unsigned short)characters.size(); }
+	BoneHierarchy* getHierarchy(unsigned short _c) { return characters[_c].hierarchy; }
+	// _c's transforms, valid after solve()
+	const float* getTransforms(unsigned short _c) { return transforms + characters[_c].first_float; }
+
+	// Vertex arrays of every character's bones as GL_LINES, one segment
+	// from the start to the end of each bone: numLineVertices() vertices
+	// with 3 position floats and 4 color floats each.
+	unsigned int numLineVertices() { return (unsigned int)line_colors.size() / 4; }
+	const float* linePositions() { return &line_positions[0]; }
+	const float* lineColors() { return &line_colors[0]; }
+	// _c's vertices within those arrays
+	unsigned int firstLineVertex(unsigned short _c) { return (unsigned int)characters[_c].first_vertex; }
+	unsigned int numLineVertices(unsigned short _c) { return characters[_c].num_bones * 2u; }
+
+private:
+	struct CharacterBones {
+		BoneHierarchy* hierarchy;
+		unsigned short num_bones;
+		// start of the character's transforms in the block
+		size_t first_float;
+		// start of its line vertices
+		size_t first_vertex;
+		bool solved;
+		// bounding sphere (center, radius) of the lines; radius -1 until solved
+		float bounds[4];
+		// farthest any bone end can be from the root's start
+		float reach;
+	};
+	vector<CharacterBones> characters;
+	float* transforms;
+	size_t num_floats;
+	// floats allocated for transforms, at least num_floats
+	size_t capacity;
+	vector<float> line_positions;
+	vector<float> line_colors;
+
+	void updateBounds(CharacterBones& _character);
+
+	// no copying; the block is owned
+	BonePoses(const BonePoses&);
+	BonePoses& operator=(const BonePoses&);
+};
+
+#endif // BONEPOSES_DOT_H
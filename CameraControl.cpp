@@ -6,6 +6,9 @@
 //-----------------------------------------------------------------------------
 // SKA configuration
 #include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cmath>
+#include <GL/glut.h>
 // SKA modules
 #include <Math/Vector3D.h>
 // local application
@@ -13,8 +16,15 @@
 
 AppCamera camera;
 
-AppCamera::AppCamera() : MovingCamera()
+AppCamera::AppCamera() : MovingCamera(), preset(0), eye_position(0.0f, 0.0f, 0.0f)
 {
+	for (int i = 0; i < 16; i++) view_projection[i] = (i % 5 == 0) ? 1.0 : 0.0;
+	// nothing is culled before the first captureView()
+	for (int p = 0; p < 6; p++)
+	{
+		for (int i = 0; i < 3; i++) frustum[p][i] = 0.0f;
+		frustum[p][3] = 1.0f;
+	}
 }
 
 AppCamera::~AppCamera()
@@ -37,6 +47,67 @@ void AppCamera::initializeCamera(int window_width, int window_height)
 	setCameraPreset(2);
 }
 
+static double determinant(const double _m[3][3])
+{
+	return _m[0][0] * (_m[1][1] * _m[2][2] - _m[1][2] * _m[2][1])
+		- _m[0][1] * (_m[1][0] * _m[2][2] - _m[1][2] * _m[2][0])
+		+ _m[0][2] * (_m[1][0] * _m[2][1] - _m[1][1] * _m[2][0]);
+}
+
+void AppCamera::captureView()
+{
+	// the view may be in either matrix; take their product
+	double projection[16], modelview[16];
+	glGetDoublev(GL_PROJECTION_MATRIX, projection);
+	glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+	for (int c = 0; c < 4; c++)
+		for (int r = 0; r < 4; r++)
+			view_projection[c * 4 + r] = projection[r] * modelview[c * 4] + projection[4 + r] * modelview[c * 4 + 1]
+				+ projection[8 + r] * modelview[c * 4 + 2] + projection[12 + r] * modelview[c * 4 + 3];
+
+	// frustum planes are sums and differences of the matrix rows
+	// (left, right, bottom, top, near, far)
+	for (int p = 0; p < 6; p++)
+	{
+		int row = p / 2;
+		double sign = (p % 2 == 0) ? 1.0 : -1.0;
+		double plane[4];
+		for (int i = 0; i < 4; i++) plane[i] = view_projection[i * 4 + 3] + sign * view_projection[i * 4 + row];
+		double length = sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		if (length <= 0.0) length = 1.0;
+		for (int i = 0; i < 4; i++) frustum[p][i] = float(plane[i] / length);
+	}
+
+	// The eye is the point a perspective projection sends to clip x = y =
+	// w = 0. Solve those three rows (0, 1 and 3) for it by Cramer's rule.
+	const int rows[3] = { 0, 1, 3 };
+	double a[3][3], b[3];
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++) a[i][j] = view_projection[j * 4 + rows[i]];
+		b[i] = -view_projection[12 + rows[i]];
+	}
+	double det = determinant(a);
+	if (fabs(det) < 1e-12) return;
+	double eye[3];
+	for (int k = 0; k < 3; k++)
+	{
+		double m[3][3];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++) m[i][j] = (j == k) ? b[i] : a[i][j];
+		eye[k] = determinant(m) / det;
+	}
+	eye_position = Vector3D((float)eye[0], (float)eye[1], (float)eye[2]);
+}
+
+bool AppCamera::isSphereVisible(const Vector3D& _center, float _radius)
+{
+	if (_radius < 0.0f) return true;
+	for (int p = 0; p < 6; p++)
+		if (frustum[p][0] * _center.x + frustum[p][1] * _center.y + frustum[p][2] * _center.z + frustum[p][3] < -_radius) return false;
+	return true;
+}
+
 void AppCamera::bumpCamera()
 {
 	// bump the camera to force update (a bit of a hack)
@@ -10,6 +10,7 @@
 #include <Core/SystemConfiguration.h>
 // SKA modules
 #include <Camera/Camera.h>
+#include <Math/Vector3D.h>
 
 class AppCamera : public MovingCamera
 {
@@ -23,8 +24,21 @@ public:
 	short getCameraPreset();
 	// move camera slightly to force it to update position
 	void bumpCamera(); 
+	// captureView() records the view set up by setSceneView(), which
+	// must have been called just before
+	void captureView();
+	// eye position at the last captureView()
+	Vector3D getEyePosition() { return eye_position; }
+	// isSphereVisible() tests a bounding sphere against the view frustum
+	// of the last captureView(); a negative _radius is always visible
+	bool isSphereVisible(const Vector3D& _center, float _radius);
 private:
 	short preset;
+	// projection * view, column major, as OpenGL holds it
+	double view_projection[16];
+	Vector3D eye_position;
+	// frustum planes (a, b, c, d) with unit normals pointing inwards
+	float frustum[6][4];
 };
 
 // global single instance of the camera
@@ -0,0 +1,639 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// ClipLibrary.cpp
+//    Shared store of parsed motion clips. Each unique skeleton/motion file
+//    pair is parsed once; its MotionSequence is then shared read-only by
+//    every character instance that plays it.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+// SKA modules
+#include <Core/Utilities.h>
+#include <Animation/Skeleton.h>
+#include <Animation/MotionSequence.h>
+#include <DataManagement/DataManager.h>
+#include <DataManagement/DataManagementException.h>
+// local application
+#include "AppConfig.h"
+#include "ClipLibrary.h"
+#include "BoneHierarchy.h"
+#include "PoseClip.h"
+#include "MotionCache.h"
+#include "StreamingClip.h"
+#include "Tracing.h"
+
+// global single instance of the clip library
+ClipLibrary clip_library;
+
+static void makeDirectory(const char* _path)
+{
+#ifdef _WIN32
+	_mkdir(_path);
+#else
+	mkdir(_path, 0755);
+#endif
+}
+
+// cache file name for a data file, flattening any subdirectories
+static string cacheFileName(const string& _file, const char* _suffix)
+{
+	string name;
+	for (unsigned int i = 0; i < _file.size(); i++)
+	{
+		char ch = _file[i];
+		if (isalnum((unsigned char)ch) || ch == '.' || ch == '-' || ch == '_') name += ch;
+		else name += '_';
+	}
+	return string(MOTION_CACHE_PATH) + "/" + name + _suffix;
+}
+
+static bool isFrameNumberLine(const string& _line)
+{
+	unsigned int digits = 0;
+	for (unsigned int i = 0; i < _line.size(); i++)
+	{
+		if (isdigit((unsigned char)_line[i])) digits++;
+		else if (!isspace((unsigned char)_line[i])) return false;
+	}
+	return digits > 0;
+}
+
+// writeMotionStub() copies the header and first frame of a motion file.
+// Reading the stub yields the full skeleton at a fraction of the cost
+// of reading the whole clip.
+static bool writeMotionStub(MOCAP_TYPE _type, const string& _source, const string& _stub)
+{
+	ifstream in(_source.c_str());
+	if (!in) return false;
+	ofstream out(_stub.c_str());
+	if (!out) return false;
+
+	string line;
+	if (_type == AMC)
+	{
+		// header lines, then "1", the first frame's bone lines, and stop at "2"
+		short frame_lines_seen = 0;
+		while (getline(in, line))
+		{
+			if (isFrameNumberLine(line) && ++frame_lines_seen == 2) break;
+			out << line << '\n';
+		}
+		if (frame_lines_seen == 0) return false;
+	}
+	else
+	{
+		// hierarchy, then a motion section that holds only the first frame
+		bool in_motion = false;
+		bool has_frame = false;
+		while (getline(in, line))
+		{
+			if (!in_motion)
+			{
+				out << line << '\n';
+				if (line.find("MOTION") != string::npos) in_motion = true;
+			}
+			else if (line.find("Frames:") != string::npos) out << "Frames: 1" << '\n';
+			else if (line.find("Frame Time:") != string::npos) out << line << '\n';
+			else if (line.find_first_not_of(" \t\r") != string::npos)
+			{
+				out << line << '\n';
+				has_frame = true;
+				break;
+			}
+		}
+		if (!has_frame) return false;
+	}
+	return out.good();
+}
+
+// asfAnglesInDegrees() reads the angle units from an ASF file's :units
+// section ("angle deg" or "angle rad"); the format's default is degrees
+static bool asfAnglesInDegrees(const string& _asf)
+{
+	ifstream in(_asf.c_str());
+	string line;
+	bool in_units = false;
+	while (getline(in, line))
+	{
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == string::npos) continue;
+		if (line[start] == ':')
+		{
+			if (in_units) break;
+			in_units = (line.compare(start, 6, ":units") == 0);
+			continue;
+		}
+		if (!in_units || line.compare(start, 5, "angle") != 0) continue;
+		size_t value = line.find_first_not_of(" \t", start + 5);
+		return (value == string::npos) || (line.compare(value, 3, "rad") != 0);
+	}
+	return true;
+}
+
+// findDataFile() resolves _name through data_manager's search paths,
+// unless it already names a file, as the batch tool's full paths do.
+// Returns "" if it cannot be found.
+static string findDataFile(const string& _name)
+{
+	struct stat info;
+	if (stat(_name.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFREG) return _name;
+	char* found = data_manager.findFile(_name.c_str());
+	if (found == NULL) return string("");
+	string path = found;
+	strDelete(found);
+	return path;
+}
+
+// discardLoad() frees what a failed loadClip() had read so far
+static void discardLoad(pair<Skeleton*, MotionSequence*>& _read_result, MotionClip* _clip)
+{
+	if (_read_result.first != NULL) delete _read_result.first;
+	if (_read_result.second != NULL) delete _read_result.second;
+	// the skeleton and motion were deleted above
+	if (_clip != NULL)
+	{
+		if (_clip->pose_clip != NULL) delete _clip->pose_clip;
+		delete _clip;
+	}
+}
+
+float MotionClip::getDuration()
+{
+	if (pose_clip != NULL) return pose_clip->getDuration();
+	if (stream_layout != NULL) return stream_layout->duration;
+	if (compressed_clip != NULL) return compressed_clip->getDuration();
+	if (motion != NULL) return motion->getDuration();
+	return 0.0f;
+}
+
+ClipLibrary::~ClipLibrary()
+{
+	clear();
+}
+
+void ClipLibrary::deleteClip(MotionClip* _clip)
+{
+	if (_clip == NULL) return;
+	if (_clip->first_skeleton != NULL) delete _clip->first_skeleton;
+	if (_clip->pose_clip != NULL) delete _clip->pose_clip;
+	if (_clip->cache_mapping != NULL) delete _clip->cache_mapping;
+	if (_clip->stream_layout != NULL) delete _clip->stream_layout;
+	if (_clip->compressed_clip != NULL) delete _clip->compressed_clip;
+	if (_clip->foot_contacts != NULL) delete _clip->foot_contacts;
+	if (_clip->hierarchy != NULL) delete _clip->hierarchy;
+	if (_clip->pose_features != NULL) delete _clip->pose_features;
+	if (_clip->motion != NULL) delete _clip->motion;
+	delete _clip;
+}
+
+void ClipLibrary::clear()
+{
+	lock_guard<mutex> lock(clips_mutex);
+	map<string, MotionClip*>::iterator iter = clips.begin();
+	while (iter != clips.end())
+	{
+		deleteClip(iter->second);
+		iter++;
+	}
+	clips.clear();
+}
+
+void ClipLibrary::removeClip(MotionClip* _clip)
+{
+	if (_clip == NULL) return;
+	lock_guard<mutex> lock(clips_mutex);
+	map<string, MotionClip*>::iterator iter = clips.begin();
+	while (iter != clips.end())
+	{
+		if (iter->second == _clip)
+		{
+			clips.erase(iter);
+			break;
+		}
+		iter++;
+	}
+	deleteClip(_clip);
+}
+
+double ClipLibrary::getParseSeconds()
+{
+	lock_guard<mutex> io_lock(io_mutex);
+	return parse_seconds;
+}
+
+void ClipLibrary::log(const string& _message)
+{
+	lock_guard<mutex> io_lock(io_mutex);
+	logout << _message << endl;
+}
+
+vector<MotionClip*> ClipLibrary::getClips()
+{
+	lock_guard<mutex> lock(clips_mutex);
+	vector<MotionClip*> result;
+	map<string, MotionClip*>::iterator iter = clips.begin();
+	while (iter != clips.end())
+	{
+		result.push_back(iter->second);
+		iter++;
+	}
+	return result;
+}
+
+unsigned short ClipLibrary::numClips()
+{
+	lock_guard<mutex> lock(clips_mutex);
+	return (unsigned short)clips.size();
+}
+
+MotionClip* ClipLibrary::getClip(const LoadSpec& _spec)
+{
+	string key = _spec.skeleton_file + "|" + _spec.motion_file + "|" + toString(_spec.scale);
+	{
+		lock_guard<mutex> lock(clips_mutex);
+		map<string, MotionClip*>::iterator iter = clips.find(key);
+		if (iter != clips.end()) return iter->second;
+	}
+
+	// loading runs unlocked so other clips can load at the same time
+	MotionClip* clip = loadClip(_spec);
+
+	// failed loads are remembered too, so they are only attempted (and logged) once
+	lock_guard<mutex> lock(clips_mutex);
+	map<string, MotionClip*>::iterator iter = clips.find(key);
+	if (iter != clips.end())
+	{
+		// another thread loaded the same clip meanwhile
+		deleteClip(clip);
+		return iter->second;
+	}
+	clips[key] = clip;
+	return clip;
+}
+
+MotionClip* ClipLibrary::loadClip(const LoadSpec& _spec)
+{
+	string filename1, filename2;
+	pair<Skeleton*, MotionSequence*> read_result((Skeleton*)NULL, (MotionSequence*)NULL);
+	MotionClip* clip = NULL;
+	chrono::steady_clock::time_point parse_start;
+	TraceSpan span("load", "loadClip", "file", _spec.motion_file);
+
+	try
+	{
+		{
+			TraceSpan find_span("load", "find");
+			lock_guard<mutex> io_lock(io_mutex);
+			if (_spec.mocap_type == AMC)
+			{
+				filename1 = findDataFile(_spec.skeleton_file);
+				if (filename1.empty())
+				{
+					logout << "AnimationControl::loadCharacters: Unable to find character ASF file <" << _spec.skeleton_file << ">. Aborting load." << endl;
+					throw BasicException("ABORT 1A");
+				}
+				filename2 = findDataFile(_spec.motion_file);
+				if (filename2.empty())
+				{
+					logout << "AnimationControl::loadCharacters: Unable to find character AMC file <" << _spec.motion_file << ">. Aborting load." << endl;
+					throw BasicException("ABORT 1B");
+				}
+			}
+			else if (_spec.mocap_type == BVH)
+			{
+				filename2 = findDataFile(_spec.motion_file);
+				if (filename2.empty())
+				{
+					logout << "AnimationControl::loadCharacters: Unable to find character BVH file <" << _spec.motion_file << ">. Aborting load." << endl;
+					throw BasicException("ABORT 2A");
+				}
+			}
+		}
+
+		clip = new MotionClip;
+		clip->mocap_type = _spec.mocap_type;
+		clip->scale = _spec.scale;
+		clip->skeleton_path = filename1;
+		clip->motion_path = filename2;
+
+		makeDirectory(MOTION_CACHE_PATH);
+		string stub_path = cacheFileName(_spec.motion_file, (_spec.mocap_type == AMC) ? ".stub.amc" : ".stub.bvh");
+
+		// previously seen clips come straight from the binary cache
+		{
+			TraceSpan cache_span("load", "cache");
+			if (loadCachedClip(clip, stub_path))
+			{
+				if (!streamClip(clip)) compressClip(clip);
+				return clip;
+			}
+		}
+
+		try
+		{
+			TraceSpan parse_span("load", "parse");
+			// SKA's readers share data_manager and the log, and are not known
+			// to be reentrant, so only one file is parsed at a time
+			lock_guard<mutex> io_lock(io_mutex);
+			parse_start = chrono::steady_clock::now();
+			if (_spec.mocap_type == AMC)
+				read_result = data_manager.readASFAMC(filename1.c_str(), filename2.c_str());
+			else
+				read_result = data_manager.readBVH(filename2.c_str());
+			parse_seconds += chrono::duration<double>(chrono::steady_clock::now() - parse_start).count();
+		}
+		catch (const DataManagementException& dme)
+		{
+			lock_guard<mutex> io_lock(io_mutex);
+			parse_seconds += chrono::duration<double>(chrono::steady_clock::now() - parse_start).count();
+			logout << "AnimationControl::loadCharacters: Unable to load character data files. Aborting load." << endl;
+			logout << "   Failure due to " << dme.msg << endl;
+			throw BasicException((_spec.mocap_type == AMC) ? "ABORT 1C" : "ABORT 2C");
+		}
+
+		Skeleton* skel = read_result.first;
+		MotionSequence* ms = read_result.second;
+		if ((skel == NULL) || (ms == NULL)) throw BasicException("ABORT 3");
+
+		{
+			TraceSpan scale_span("load", "scale");
+			skel->scaleBoneLengths(_spec.scale);
+			ms->scaleChannel(CHANNEL_ID(0, CT_TX), _spec.scale);
+			ms->scaleChannel(CHANNEL_ID(0, CT_TY), _spec.scale);
+			ms->scaleChannel(CHANNEL_ID(0, CT_TZ), _spec.scale);
+		}
+
+		// flat clip, motion cache file, then streaming or compression
+		TraceSpan build_span("load", "build");
+		clip->motion = ms;
+		clip->first_skeleton = skel;
+		// BVH rotations are always in degrees; ASF declares its own units
+		clip->rotations_in_degrees = (_spec.mocap_type == BVH) || asfAnglesInDegrees(clip->skeleton_path);
+		clip->pose_clip = new PoseClip;
+		if (!clip->pose_clip->build(ms, clip->rotations_in_degrees))
+		{
+			delete clip->pose_clip;
+			clip->pose_clip = NULL;
+		}
+
+		if (writeMotionStub(_spec.mocap_type, clip->motion_path, stub_path))
+		{
+			clip->stub_path = stub_path;
+			if (clip->pose_clip != NULL && !MotionCache::save(cacheKey(clip), *clip->pose_clip))
+			{
+				lock_guard<mutex> io_lock(io_mutex);
+				logout << "ClipLibrary::loadClip: Unable to write motion cache for <" << clip->motion_path << ">." << endl;
+			}
+			else streamClip(clip);
+		}
+		else
+		{
+			lock_guard<mutex> io_lock(io_mutex);
+			logout << "ClipLibrary::loadClip: Unable to write skeleton stub <" << stub_path << ">. Instances will re-read the full clip." << endl;
+		}
+		if (clip->stream_layout == NULL) compressClip(clip);
+	}
+	catch (BasicException&)
+	{
+		discardLoad(read_result, clip);
+		clip = NULL;
+	}
+	catch (...)
+	{
+		// not a load failure; the caller decides, but nothing is leaked
+		discardLoad(read_result, clip);
+		throw;
+	}
+
+	return clip;
+}
+
+MotionCacheKey ClipLibrary::cacheKey(MotionClip* _clip)
+{
+	MotionCacheKey key;
+	key.motion_path = _clip->motion_path;
+	key.skeleton_path = _clip->skeleton_path;
+	key.scale = _clip->scale;
+	return key;
+}
+
+// streamClip() switches an over-budget clip to streaming from its cache
+// file, dropping the in-memory copies. Returns true if it did.
+bool ClipLibrary::streamClip(MotionClip* _clip)
+{
+	if (streaming_budget == 0 || _clip->pose_clip == NULL) return false;
+	if (_clip->pose_clip->frameBytes() <= streaming_budget) return false;
+
+	MotionCacheLayout* layout = new MotionCacheLayout;
+	if (!MotionCache::inspect(cacheKey(_clip), *layout))
+	{
+		delete layout;
+		return false;
+	}
+	_clip->stream_layout = layout;
+	delete _clip->pose_clip;
+	_clip->pose_clip = NULL;
+	if (_clip->cache_mapping != NULL) delete _clip->cache_mapping;
+	_clip->cache_mapping = NULL;
+	if (_clip->motion != NULL) delete _clip->motion;
+	_clip->motion = NULL;
+	return true;
+}
+
+// compressClip() replaces the clip's in-memory copies with a compressed
+// one, if compression is on. Returns true if it did.
+bool ClipLibrary::compressClip(MotionClip* _clip)
+{
+	if (!compress || _clip->pose_clip == NULL) return false;
+
+	CompressedClip* compressed = new CompressedClip;
+	if (!compressed->build(*_clip->pose_clip, compression))
+	{
+		delete compressed;
+		return false;
+	}
+	_clip->compressed_clip = compressed;
+	delete _clip->pose_clip;
+	_clip->pose_clip = NULL;
+	if (_clip->cache_mapping != NULL) delete _clip->cache_mapping;
+	_clip->cache_mapping = NULL;
+	if (_clip->motion != NULL) delete _clip->motion;
+	_clip->motion = NULL;
+	return true;
+}
+
+bool ClipLibrary::loadCachedClip(MotionClip* _clip, const string& _stub_path)
+{
+	// skeletons are built from the stub, so a cache file is useless without it
+	ifstream stub(_stub_path.c_str());
+	if (!stub) return false;
+	stub.close();
+
+	MappedFile* mapping = new MappedFile;
+	PoseClip* pose_clip = new PoseClip;
+	if (!MotionCache::load(cacheKey(_clip), *mapping, *pose_clip))
+	{
+		delete pose_clip;
+		delete mapping;
+		return false;
+	}
+	_clip->cache_mapping = mapping;
+	_clip->pose_clip = pose_clip;
+	_clip->rotations_in_degrees = pose_clip->rotationsInDegrees();
+	_clip->stub_path = _stub_path;
+	return true;
+}
+
+FootContacts* ClipLibrary::analyzeFootContacts(MotionClip* _clip)
+{
+	if (_clip == NULL) return NULL;
+	lock_guard<mutex> lock(_clip->contacts_mutex);
+	if (_clip->contacts_analyzed) return _clip->foot_contacts;
+	_clip->contacts_analyzed = true;
+
+	FootContacts* contacts = new FootContacts;
+	MotionCacheKey key = cacheKey(_clip);
+	vector<char> data;
+	if (MotionCache::loadSidecar(key, ".contacts", data) && contacts->deserialize(data))
+	{
+		_clip->foot_contacts = contacts;
+		return contacts;
+	}
+
+	BoneHierarchy* hierarchy = getHierarchy(_clip);
+	PoseSource* source = _clip->pose_clip;
+	if (_clip->compressed_clip != NULL) source = _clip->compressed_clip;
+	StreamingClip* stream = NULL;
+	if (hierarchy != NULL && _clip->stream_layout != NULL) source = stream = new StreamingClip(*_clip->stream_layout, streaming_budget);
+
+	bool found = (hierarchy != NULL) && (source != NULL) && contacts->detect(*hierarchy, source);
+	if (stream != NULL) delete stream;
+	if (!found)
+	{
+		delete contacts;
+		lock_guard<mutex> io_lock(io_mutex);
+		logout << "ClipLibrary::analyzeFootContacts: Unable to track the feet in <" << _clip->motion_path << ">." << endl;
+		return NULL;
+	}
+
+	contacts->serialize(data);
+	MotionCache::saveSidecar(key, ".contacts", data);
+	_clip->foot_contacts = contacts;
+	return contacts;
+}
+
+PoseFeatures* ClipLibrary::analyzePoseFeatures(MotionClip* _clip)
+{
+	if (_clip == NULL) return NULL;
+	lock_guard<mutex> lock(_clip->features_mutex);
+	if (_clip->features_analyzed) return _clip->pose_features;
+	_clip->features_analyzed = true;
+
+	PoseFeatures* features = new PoseFeatures;
+	MotionCacheKey key = cacheKey(_clip);
+	vector<char> data;
+	if (MotionCache::loadSidecar(key, ".features", data) && features->deserialize(data))
+	{
+		_clip->pose_features = features;
+		return features;
+	}
+
+	BoneHierarchy* hierarchy = getHierarchy(_clip);
+	PoseSource* source = _clip->pose_clip;
+	if (_clip->compressed_clip != NULL) source = _clip->compressed_clip;
+	StreamingClip* stream = NULL;
+	if (hierarchy != NULL && _clip->stream_layout != NULL) source = stream = new StreamingClip(*_clip->stream_layout, streaming_budget);
+
+	bool found = (hierarchy != NULL) && (source != NULL) && features->extract(*hierarchy, source);
+	if (stream != NULL) delete stream;
+	if (!found)
+	{
+		delete features;
+		lock_guard<mutex> io_lock(io_mutex);
+		logout << "ClipLibrary::analyzePoseFeatures: Unable to track the feet and hands in <" << _clip->motion_path << ">." << endl;
+		return NULL;
+	}
+
+	features->serialize(data);
+	MotionCache::saveSidecar(key, ".features", data);
+	_clip->pose_features = features;
+	return features;
+}
+
+BoneHierarchy* ClipLibrary::getHierarchy(MotionClip* _clip)
+{
+	if (_clip == NULL) return NULL;
+	lock_guard<mutex> lock(_clip->hierarchy_mutex);
+	if (_clip->hierarchy_loaded) return _clip->hierarchy;
+	_clip->hierarchy_loaded = true;
+
+	// the hierarchy comes from the ASF, or from the BVH file itself
+	BoneHierarchy* hierarchy = new BoneHierarchy;
+	bool loaded = (_clip->mocap_type == AMC) ? hierarchy->loadASF(_clip->skeleton_path, _clip->scale)
+		: hierarchy->loadBVH(_clip->motion_path, _clip->scale);
+
+	// every source of the clip has the same channels; bind to whichever it has
+	PoseSource* source = _clip->pose_clip;
+	if (_clip->compressed_clip != NULL) source = _clip->compressed_clip;
+	StreamingClip* stream = NULL;
+	if (loaded && _clip->stream_layout != NULL) source = stream = new StreamingClip(*_clip->stream_layout, streaming_budget);
+
+	bool bound = loaded && (source != NULL) && hierarchy->bindChannels(source);
+	if (stream != NULL) delete stream;
+	if (!bound)
+	{
+		delete hierarchy;
+		lock_guard<mutex> io_lock(io_mutex);
+		logout << "ClipLibrary::getHierarchy: Unable to read the bone hierarchy of <" << _clip->motion_path << ">." << endl;
+		return NULL;
+	}
+	_clip->hierarchy = hierarchy;
+	return hierarchy;
+}
+
+Skeleton* ClipLibrary::createSkeleton(MotionClip* _clip)
+{
+	if (_clip == NULL) return NULL;
+
+	if (_clip->first_skeleton != NULL)
+	{
+		Skeleton* skel = _clip->first_skeleton;
+		_clip->first_skeleton = NULL;
+		return skel;
+	}
+
+	// prefer the one-frame stub; fall back to the original file
+	string motion_path = _clip->stub_path;
+	if (motion_path.empty()) motion_path = _clip->motion_path;
+
+	pair<Skeleton*, MotionSequence*> read_result((Skeleton*)NULL, (MotionSequence*)NULL);
+	try
+	{
+		lock_guard<mutex> io_lock(io_mutex);
+		if (_clip->mocap_type == AMC)
+			read_result = data_manager.readASFAMC(_clip->skeleton_path.c_str(), motion_path.c_str());
+		else
+			read_result = data_manager.readBVH(motion_path.c_str());
+	}
+	catch (const DataManagementException& dme)
+	{
+		lock_guard<mutex> io_lock(io_mutex);
+		logout << "ClipLibrary::createSkeleton: Unable to read skeleton from <" << motion_path << ">." << endl;
+		logout << "   Failure due to " << dme.msg << endl;
+		return NULL;
+	}
+
+	// only the skeleton is wanted; the clip's shared motion is used instead
+	if (read_result.second != NULL) delete read_result.second;
+	if (read_result.first != NULL) read_result.first->scaleBoneLengths(_clip->scale);
+	return read_result.first;
+}
@@ -0,0 +1,189 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// ClipLibrary.h
+//    Shared store of parsed motion clips. Each unique skeleton/motion file
+//    pair is parsed once; its MotionSequence is then shared read-only by
+//    every character instance that plays it.
+//-----------------------------------------------------------------------------
+#ifndef CLIPLIBRARY_DOT_H
+#define CLIPLIBRARY_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+// SKA modules
+#include <Objects/Object.h>
+// local application
+#include "CompressedClip.h"
+#include "FootContacts.h"
+#include "PoseFeatures.h"
+
+class Skeleton;
+class MotionSequence;
+class BoneHierarchy;
+class PoseClip;
+class MappedFile;
+struct MotionCacheKey;
+struct MotionCacheLayout;
+
+enum MOCAP_TYPE { BVH, AMC };
+
+struct LoadSpec {
+	MOCAP_TYPE mocap_type;
+	float scale;
+	Color color;
+	string motion_file;
+	string skeleton_file;
+	LoadSpec(MOCAP_TYPE _mocap_type, float _scale, const Color& _color, const string& _motion_file, const string& _skeleton_file=string(""))
+		: mocap_type(_mocap_type), scale(_scale), color(_color), motion_file(_motion_file), skeleton_file(_skeleton_file) { }
+};
+
+// A parsed clip. The motion is scaled once at load and must not be
+// modified afterwards, since any number of controllers may read it.
+// Clips loaded from the motion cache have only a pose_clip (backed by
+// cache_mapping) and no MotionSequence. Streamed clips have neither; each
+// instance plays them from the cache file through its own StreamingClip.
+// Compressed clips keep only compressed_clip.
+struct MotionClip {
+	MOCAP_TYPE mocap_type;
+	float scale;
+	// units of the rotation channels, as the motion file declares them
+	bool rotations_in_degrees;
+	MotionSequence* motion;
+	// sampling-friendly copy of motion, NULL if it could not be built
+	PoseClip* pose_clip;
+	// memory-mapped cache file holding pose_clip's frames, or NULL
+	MappedFile* cache_mapping;
+	// cache file to stream the clip from, or NULL if it is held in memory
+	MotionCacheLayout* stream_layout;
+	// compressed replacement for pose_clip, or NULL
+	CompressedClip* compressed_clip;
+	// foot contacts, once analyzeFootContacts() has found them
+	FootContacts* foot_contacts;
+	bool contacts_analyzed;
+	// bone hierarchy bound to the clip's channels, once getHierarchy() has read it
+	BoneHierarchy* hierarchy;
+	bool hierarchy_loaded;
+	// pose features of every frame, once analyzePoseFeatures() has found them
+	PoseFeatures* pose_features;
+	bool features_analyzed;
+	// one analysis of each kind at a time per clip; different clips are
+	// analyzed in parallel
+	mutex contacts_mutex;
+	mutex hierarchy_mutex;
+	mutex features_mutex;
+	// full paths of the files the clip was read from
+	string skeleton_path;
+	string motion_path;
+	// one-frame copy of the motion file, used to build further skeletons
+	// without parsing the whole clip again
+	string stub_path;
+	// skeleton parsed along with the motion, handed out to the first instance
+	Skeleton* first_skeleton;
+	MotionClip() : mocap_type(AMC), scale(1.0f), rotations_in_degrees(true), motion(NULL), pose_clip(NULL), cache_mapping(NULL), stream_layout(NULL), compressed_clip(NULL),
+		foot_contacts(NULL), contacts_analyzed(false), hierarchy(NULL), hierarchy_loaded(false),
+		pose_features(NULL), features_analyzed(false), first_skeleton(NULL) { }
+
+	// length of the clip in seconds
+	float getDuration();
+};
+
+class ClipLibrary
+{
+public:
+	ClipLibrary() : streaming_budget(0), compress(false), parse_seconds(0.0) { }
+	~ClipLibrary();
+
+	// getClip() returns the clip for _spec, parsing it on first use.
+	// Returns NULL (after logging the reason) if the files cannot be loaded.
+	// Different clips may be loaded from several threads at once.
+	MotionClip* getClip(const LoadSpec& _spec);
+
+	// createSkeleton() returns a new skeleton, scaled for _clip, to be
+	// owned by the caller. Returns NULL on failure. Calls for the same
+	// clip must not overlap.
+	Skeleton* createSkeleton(MotionClip* _clip);
+
+	unsigned short numClips();
+
+	// Clips whose frame rows take more than _bytes are streamed from the
+	// motion cache instead of being held in memory, with at most _bytes
+	// of rows resident per instance. 0 (the default) never streams.
+	// Applies to clips loaded afterwards.
+	void setStreamingBudget(size_t _bytes) { streaming_budget = _bytes; }
+	size_t getStreamingBudget() { return streaming_budget; }
+
+	// With compression on, clips held in memory are replaced by a
+	// CompressedClip within _settings' error bounds. Streamed clips are
+	// left as they are. Applies to clips loaded afterwards.
+	void setCompression(bool _compress, const CompressionSettings& _settings = CompressionSettings())
+	{
+		compress = _compress;
+		compression = _settings;
+	}
+	bool isCompressing() { return compress; }
+
+	// analyzeFootContacts() returns _clip's foot contacts, finding them on
+	// first use. Results are kept in the motion cache, so a clip is only
+	// ever analyzed once. Returns NULL if the feet cannot be tracked.
+	FootContacts* analyzeFootContacts(MotionClip* _clip);
+
+	// analyzePoseFeatures() returns _clip's pose features (for a
+	// PoseFeatureIndex), finding them on first use and keeping them in the
+	// motion cache like the foot contacts. Returns NULL if the clip's feet
+	// or hands cannot be tracked.
+	PoseFeatures* analyzePoseFeatures(MotionClip* _clip);
+
+	// getHierarchy() returns _clip's bone hierarchy, bound to its channels,
+	// reading it on first use. Returns NULL if it cannot be read.
+	BoneHierarchy* getHierarchy(MotionClip* _clip);
+
+	// removeClip() deletes _clip and forgets it, for going through more
+	// clips than fit in memory at once. Nothing may be using it.
+	void removeClip(MotionClip* _clip);
+
+	// getParseSeconds() returns the time spent in SKA's file readers so
+	// far. Files are parsed one at a time (see io_mutex), so this much of
+	// any load ran on a single core, however many threads were loading.
+	double getParseSeconds();
+
+	// log() writes _message as one line of the log file, under the lock the
+	// loading threads share it with
+	void log(const string& _message);
+
+	// getClips() lists the clips loaded so far, including failed (NULL) ones
+	vector<MotionClip*> getClips();
+
+	void clear();
+
+private:
+	map<string, MotionClip*> clips;
+	mutex clips_mutex;
+	// guards data_manager (its search paths and SKA's file readers) and
+	// the log file, which are shared by all loading threads; building,
+	// caching and analyzing the parsed clips runs unlocked
+	mutex io_mutex;
+	size_t streaming_budget;
+	bool compress;
+	CompressionSettings compression;
+	// guarded by io_mutex
+	double parse_seconds;
+
+	static void deleteClip(MotionClip* _clip);
+
+	MotionClip* loadClip(const LoadSpec& _spec);
+	bool loadCachedClip(MotionClip* _clip, const string& _stub_path);
+	MotionCacheKey cacheKey(MotionClip* _clip);
+	bool streamClip(MotionClip* _clip);
+	bool compressClip(MotionClip* _clip);
+};
+
+// global single instance of the clip library
+extern ClipLibrary clip_library;
+
+#endif // CLIPLIBRARY_DOT_H
@@ -0,0 +1,216 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// CompressedClip.cpp
+//    Lossy compressed copy of a PoseClip, decoded on the fly while sampling.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+#include <cmath>
+// local application
+#include "CompressedClip.h"
+#include "PoseClip.h"
+
+const double QUANTIZED_STEPS = 65535.0;
+const long KEY_BLOCK_FRAMES = 32;
+
+static bool isRotationChannel(const CHANNEL_ID& _channel)
+{
+	return (_channel.channel_type == CT_RX) || (_channel.channel_type == CT_RY) || (_channel.channel_type == CT_RZ);
+}
+
+// reduceKeys() picks the frames of _values to keep so that linear
+// interpolation between them is within _tolerance of every value. Each
+// segment is grown while some line from its start key passes within
+// _tolerance of all the frames it spans.
+static void reduceKeys(const vector<double>& _values, double _tolerance, vector<uint32_t>& _keys)
+{
+	size_t last = _values.size() - 1;
+	size_t start = 0;
+	_keys.push_back(0);
+	while (start < last)
+	{
+		// range of slopes from the start key that fit every frame so far
+		double low = -HUGE_VAL, high = HUGE_VAL;
+		size_t end = start + 1;
+		for (size_t j = start + 1; j <= last; j++)
+		{
+			double span = double(j - start);
+			double slope = (_values[j] - _values[start]) / span;
+			if (slope >= low && slope <= high) end = j;
+			low = max(low, (_values[j] - _tolerance - _values[start]) / span);
+			high = min(high, (_values[j] + _tolerance - _values[start]) / span);
+			if (low > high) break;
+		}
+		_keys.push_back((uint32_t)end);
+		start = end;
+	}
+}
+
+CompressedClip::CompressedClip()
+	: num_frames(0), duration(0.0f), stride(0), degrees(true),
+	num_constant(0), max_angle_error(0.0f), max_position_error(0.0f)
+{ }
+
+bool CompressedClip::build(PoseClip& _clip, const CompressionSettings& _settings)
+{
+	tracks.clear();
+	key_frames.clear();
+	key_blocks.clear();
+	quantized_values.clear();
+	float_values.clear();
+	num_constant = 0;
+	max_angle_error = 0.0f;
+	max_position_error = 0.0f;
+
+	channels = _clip.getChannels();
+	num_frames = _clip.numFrames();
+	duration = _clip.getDuration();
+	stride = _clip.getStride();
+	degrees = _clip.rotationsInDegrees();
+	if (num_frames <= 0 || channels.empty()) return false;
+
+	// the error bounds in the clip's own units
+	double degree = degrees ? 1.0 : 3.14159265358979 / 180.0;
+	double angle_bound = _settings.max_angle_error * degree;
+	double position_bound = _settings.max_position_error;
+
+	size_t num_rows = size_t(num_frames) + 1;
+	vector<double> values(num_rows);
+	vector<uint32_t> keys;
+	for (unsigned short c = 0; c < channels.size(); c++)
+	{
+		for (size_t f = 0; f < num_rows; f++) values[f] = _clip.getFrame(long(f))[c];
+		double low = *min_element(values.begin(), values.end());
+		double high = *max_element(values.begin(), values.end());
+		double bound = isRotationChannel(channels[c]) ? angle_bound : position_bound;
+
+		Track track;
+		track.keyed = false;
+		track.base = float(0.5 * (low + high));
+		track.scale = 0.0f;
+		track.first_value = 0;
+		track.first_key = key_frames.size();
+		track.num_keys = 1;
+		track.first_block = key_blocks.size();
+		if (high == low || 0.5 * (high - low) <= bound)
+		{
+			track.mode = TRACK_CONSTANT;
+			tracks.push_back(track);
+			num_constant++;
+			continue;
+		}
+
+		// quantizing costs half a step of error; the rest of the bound goes
+		// to key reduction, which is left at least half of it
+		double step = (high - low) / QUANTIZED_STEPS;
+		double tolerance = 0.0;
+		if (bound == 0.0 || step <= bound)
+		{
+			track.mode = TRACK_QUANTIZED;
+			track.base = float(low);
+			track.scale = float(step);
+			if (bound > 0.0) tolerance = bound - 0.5 * step;
+		}
+		else
+		{
+			// range too wide for 16 bits within the bound
+			track.mode = TRACK_FLOAT;
+			tolerance = bound;
+		}
+
+		keys.clear();
+		if (tolerance > 0.0) reduceKeys(values, tolerance, keys);
+
+		// keys only pay off if they cost less than storing every frame
+		size_t value_bytes = (track.mode == TRACK_QUANTIZED) ? sizeof(uint16_t) : sizeof(float);
+		size_t num_blocks = size_t(num_frames / KEY_BLOCK_FRAMES) + 1;
+		size_t keyed_bytes = keys.size() * (value_bytes + sizeof(uint32_t)) + num_blocks * sizeof(uint32_t);
+		track.keyed = (tolerance > 0.0) && (keyed_bytes < num_rows * value_bytes);
+		track.num_keys = track.keyed ? keys.size() : num_rows;
+		if (track.keyed)
+		{
+			key_frames.insert(key_frames.end(), keys.begin(), keys.end());
+			size_t key = 0;
+			for (size_t b = 0; b < num_blocks; b++)
+			{
+				while (key + 1 < keys.size() && keys[key + 1] <= b * KEY_BLOCK_FRAMES) key++;
+				key_blocks.push_back((uint32_t)key);
+			}
+		}
+
+		track.first_value = (track.mode == TRACK_QUANTIZED) ? quantized_values.size() : float_values.size();
+		for (size_t k = 0; k < track.num_keys; k++)
+		{
+			double value = values[track.keyed ? keys[k] : k];
+			if (track.mode == TRACK_QUANTIZED)
+			{
+				double q = floor((value - low) / step + 0.5);
+				quantized_values.push_back((uint16_t)min(max(q, 0.0), QUANTIZED_STEPS));
+			}
+			else float_values.push_back(float(value));
+		}
+		tracks.push_back(track);
+	}
+
+	// measure what the decoder actually gives back
+	for (unsigned short c = 0; c < channels.size(); c++)
+	{
+		float error = 0.0f;
+		for (long f = 0; f <= num_frames; f++)
+			error = max(error, fabs(decode(tracks[c], f) - _clip.getFrame(f)[c]));
+		if (isRotationChannel(channels[c])) max_angle_error = max(max_angle_error, float(error / degree));
+		else max_position_error = max(max_position_error, error);
+	}
+	return true;
+}
+
+size_t CompressedClip::compressedBytes()
+{
+	return tracks.size() * sizeof(Track) + channels.size() * sizeof(CHANNEL_ID)
+		+ (key_frames.size() + key_blocks.size()) * sizeof(uint32_t)
+		+ quantized_values.size() * sizeof(uint16_t)
+		+ float_values.size() * sizeof(float);
+}
+
+// decode() gives _track's value at _frame, 0..numFrames() (the loop row)
+float CompressedClip::decode(const Track& _track, long _frame)
+{
+	if (_track.mode == TRACK_CONSTANT) return _track.base;
+	if (!_track.keyed) return keyValue(_track, size_t(_frame));
+
+	// keys always include the first and last rows
+	const uint32_t* keys = &key_frames[_track.first_key];
+	size_t prev = key_blocks[_track.first_block + _frame / KEY_BLOCK_FRAMES];
+	while (prev + 1 < _track.num_keys && keys[prev + 1] <= uint32_t(_frame)) prev++;
+	if (prev + 1 >= _track.num_keys) return keyValue(_track, prev);
+	size_t next = prev + 1;
+	float alpha = float(_frame - long(keys[prev])) / float(keys[next] - keys[prev]);
+	float a = keyValue(_track, prev);
+	return a + alpha * (keyValue(_track, next) - a);
+}
+
+void CompressedClip::sampleFrame(long _frame, float* _pose)
+{
+	if (_frame < 0) _frame = 0;
+	if (_frame >= num_frames) _frame = num_frames - 1;
+	unsigned short num_channels = (unsigned short)tracks.size();
+	for (unsigned short c = 0; c < num_channels; c++) _pose[c] = decode(tracks[c], _frame);
+	for (unsigned int c = num_channels; c < stride; c++) _pose[c] = 0.0f;
+}
+
+void CompressedClip::sampleBlend(long _frame, float _alpha, float* _pose)
+{
+	if (_frame < 0) { _frame = 0; _alpha = 0.0f; }
+	if (_frame >= num_frames) { _frame = num_frames - 1; _alpha = 1.0f; }
+	unsigned short num_channels = (unsigned short)tracks.size();
+	for (unsigned short c = 0; c < num_channels; c++)
+	{
+		float a = decode(tracks[c], _frame);
+		float b = decode(tracks[c], _frame + 1);
+		_pose[c] = a + _alpha * (b - a);
+	}
+	for (unsigned int c = num_channels; c < stride; c++) _pose[c] = 0.0f;
+}
@@ -0,0 +1,109 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// CompressedClip.h
+//    Lossy compressed copy of a PoseClip, decoded on the fly while
+//    sampling. Each channel is stored on its own:
+//    - channels that stay (nearly) constant keep a single value
+//    - the rest are quantized to 16 bits over the channel's range
+//    - with an error bound set, only the frames needed to rebuild the
+//      channel by linear interpolation within that bound are kept
+//    Rotation errors are bounded in degrees and translation errors in
+//    clip units, whatever units the clip itself uses.
+//-----------------------------------------------------------------------------
+#ifndef COMPRESSEDCLIP_DOT_H
+#define COMPRESSEDCLIP_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+using namespace std;
+// SKA modules
+#include <Animation/MotionSequence.h>
+// local application
+#include "PoseSource.h"
+
+class PoseClip;
+
+struct CompressionSettings {
+	// Largest error allowed on rotation channels (degrees) and translation
+	// channels (clip units). 0 keeps every frame and only quantizes, so
+	// the error is whatever 16 bits over the channel's range gives.
+	float max_angle_error;
+	float max_position_error;
+	CompressionSettings() : max_angle_error(0.0f), max_position_error(0.0f) { }
+};
+
+class CompressedClip : public PoseSource
+{
+public:
+	CompressedClip();
+
+	// build() compresses every frame of _clip, including its loop row.
+	// Returns false if _clip is empty.
+	bool build(PoseClip& _clip, const CompressionSettings& _settings);
+
+	long numFrames() { return num_frames; }
+	float getDuration() { return duration; }
+	unsigned short numChannels() { return (unsigned short)channels.size(); }
+	CHANNEL_ID getChannel(unsigned short _index) { return channels[_index]; }
+	unsigned int getStride() { return stride; }
+	bool rotationsInDegrees() { return degrees; }
+
+	void sampleFrame(long _frame, float* _pose);
+	void sampleBlend(long _frame, float _alpha, float* _pose);
+
+	// bytes used by the compressed data, and by the PoseClip rows it replaces
+	size_t compressedBytes();
+	size_t uncompressedBytes() { return size_t(num_frames + 1) * stride * sizeof(float); }
+	unsigned short numConstantChannels() { return num_constant; }
+	// largest decoding error measured over every frame at build() time
+	float maxAngleError() { return max_angle_error; }
+	float maxPositionError() { return max_position_error; }
+
+private:
+	enum TRACK_MODE { TRACK_CONSTANT, TRACK_QUANTIZED, TRACK_FLOAT };
+
+	// One channel. Values are base + scale*q for quantized tracks. Keyed
+	// tracks keep num_keys values at the frames listed in key_frames;
+	// the others keep a value for every frame. For keyed tracks,
+	// key_blocks holds, per KEY_BLOCK_FRAMES frames, the last key at or
+	// before the block start, so decoding only scans a few keys.
+	struct Track {
+		TRACK_MODE mode;
+		bool keyed;
+		float base;
+		float scale;
+		size_t first_value;
+		size_t first_key;
+		size_t num_keys;
+		size_t first_block;
+	};
+
+	vector<CHANNEL_ID> channels;
+	long num_frames;
+	float duration;
+	unsigned int stride;
+	bool degrees;
+
+	vector<Track> tracks;
+	vector<uint32_t> key_frames;
+	vector<uint32_t> key_blocks;
+	vector<uint16_t> quantized_values;
+	vector<float> float_values;
+
+	unsigned short num_constant;
+	float max_angle_error;
+	float max_position_error;
+
+	float keyValue(const Track& _track, size_t _key)
+	{
+		if (_track.mode == TRACK_QUANTIZED) return _track.base + _track.scale * quantized_values[_track.first_value + _key];
+		return float_values[_track.first_value + _key];
+	}
+	float decode(const Track& _track, long _frame);
+};
+
+#endif // COMPRESSEDCLIP_DOT_H
@@ -0,0 +1,261 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// FootContacts.cpp
+//    Foot contacts (sync frames) of a clip, found offline.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+// local application
+#include "FootContacts.h"
+#include "BoneHierarchy.h"
+#include "PoseMath.h"
+#include "PoseSource.h"
+
+// A foot enters contact below CONTACT_ENTER_SPEED and leaves above
+// CONTACT_LEAVE_SPEED, both relative to the foot's 90th percentile speed,
+// and only enters within CONTACT_HEIGHT of its lowest point (relative to
+// its 90th percentile height above that). Shorter contacts are dropped.
+const float CONTACT_ENTER_SPEED = 0.15f;
+const float CONTACT_LEAVE_SPEED = 0.30f;
+const float CONTACT_HEIGHT = 0.30f;
+const float MIN_CONTACT_SECONDS = 0.05f;
+
+// how well _name fits a foot bone on side _side ('l' or 'r'): toes are
+// preferred over feet over ankles; 0 if it does not fit at all
+static int footScore(const string& _name, char _side)
+{
+	string name;
+	for (unsigned int i = 0; i < _name.size(); i++) name += (char)tolower((unsigned char)_name[i]);
+
+	const char* side_word = (_side == 'l') ? "left" : "right";
+	string rest;
+	if (name.compare(0, strlen(side_word), side_word) == 0) rest = name.substr(strlen(side_word));
+	else if (!name.empty() && name[0] == _side) rest = name.substr(1);
+	else return 0;
+	if (!rest.empty() && (rest[0] == '_' || rest[0] == '.' || rest[0] == ' ')) rest = rest.substr(1);
+
+	if (rest.compare(0, 3, "toe") == 0) return 3;
+	if (rest.compare(0, 4, "foot") == 0) return 2;
+	if (rest.compare(0, 5, "ankle") == 0) return 1;
+	return 0;
+}
+
+static short findFootBone(BoneHierarchy& _hierarchy, char _side)
+{
+	short best = -1;
+	int best_score = 0;
+	for (unsigned short b = 0; b < _hierarchy.numBones(); b++)
+	{
+		int score = footScore(_hierarchy.getBone(b).name, _side);
+		if (score > best_score) { best = (short)b; best_score = score; }
+	}
+	return best;
+}
+
+// centralSpeeds() sets _speed[i] = |p[i+1] - p[i-1]| * _scale for the
+// interior of a track stored as separate x, y and z arrays of _n floats.
+// The ends use one-sided differences (with _scale doubled).
+static void centralSpeeds(const float* _x, const float* _y, const float* _z, long _n, float _scale, float* _speed)
+{
+	if (_n < 2)
+	{
+		if (_n == 1) _speed[0] = 0.0f;
+		return;
+	}
+	long i = 1;
+#if defined(POSE_SIMD_AVX)
+	__m256 scale8 = _mm256_set1_ps(_scale);
+	for (; i + 8 <= _n - 1; i += 8)
+	{
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(_x + i + 1), _mm256_loadu_ps(_x + i - 1));
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(_y + i + 1), _mm256_loadu_ps(_y + i - 1));
+		__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(_z + i + 1), _mm256_loadu_ps(_z + i - 1));
+		__m256 squared = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(dz, dz)));
+		_mm256_storeu_ps(_speed + i, _mm256_mul_ps(_mm256_sqrt_ps(squared), scale8));
+	}
+#elif defined(POSE_SIMD_SSE)
+	__m128 scale4 = _mm_set1_ps(_scale);
+	for (; i + 4 <= _n - 1; i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(_x + i + 1), _mm_loadu_ps(_x + i - 1));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(_y + i + 1), _mm_loadu_ps(_y + i - 1));
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(_z + i + 1), _mm_loadu_ps(_z + i - 1));
+		__m128 squared = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_add_ps(_mm_mul_ps(dy, dy), _mm_mul_ps(dz, dz)));
+		_mm_storeu_ps(_speed + i, _mm_mul_ps(_mm_sqrt_ps(squared), scale4));
+	}
+#endif
+	for (; i < _n - 1; i++)
+	{
+		float dx = _x[i + 1] - _x[i - 1], dy = _y[i + 1] - _y[i - 1], dz = _z[i + 1] - _z[i - 1];
+		_speed[i] = sqrt(dx * dx + dy * dy + dz * dz) * _scale;
+	}
+
+	float dx = _x[1] - _x[0], dy = _y[1] - _y[0], dz = _z[1] - _z[0];
+	_speed[0] = sqrt(dx * dx + dy * dy + dz * dz) * 2.0f * _scale;
+	dx = _x[_n - 1] - _x[_n - 2]; dy = _y[_n - 1] - _y[_n - 2]; dz = _z[_n - 1] - _z[_n - 2];
+	_speed[_n - 1] = sqrt(dx * dx + dy * dy + dz * dz) * 2.0f * _scale;
+}
+
+// value at fraction _p of _values (reordered in the process)
+static float percentileOf(vector<float>& _values, float _p)
+{
+	size_t index = size_t(_p * (_values.size() - 1));
+	nth_element(_values.begin(), _values.begin() + index, _values.end());
+	return _values[index];
+}
+
+bool FootContacts::detect(BoneHierarchy& _hierarchy, PoseSource* _source)
+{
+	for (int foot = 0; foot < NUM_FEET; foot++) { contacts[foot].clear(); foot_bones[foot].clear(); }
+
+	short foot_bone[NUM_FEET] = { findFootBone(_hierarchy, 'l'), findFootBone(_hierarchy, 'r') };
+	if (foot_bone[LEFT_FOOT] < 0 || foot_bone[RIGHT_FOOT] < 0) return false;
+	long num_frames = _source->numFrames();
+	if (num_frames <= 0) return false;
+
+	// one forward kinematics sweep over the clip, keeping only the feet
+	vector<float> track(size_t(num_frames) * 3 * NUM_FEET);
+	float* pose = allocatePoseBuffer(_source->getStride());
+	vector<float> transforms(_hierarchy.numBones() * BoneHierarchy::TRANSFORM_FLOATS);
+	for (long f = 0; f < num_frames; f++)
+	{
+		_source->sampleFrame(f, pose);
+		_hierarchy.solve(pose, &transforms[0]);
+		for (int foot = 0; foot < NUM_FEET; foot++)
+		{
+			float end[3];
+			_hierarchy.boneEnd(&transforms[0], (unsigned short)foot_bone[foot], end);
+			for (int axis = 0; axis < 3; axis++) track[(foot * 3 + axis) * num_frames + f] = end[axis];
+		}
+	}
+	freePoseBuffer(pose);
+
+	float frame_time = _source->getDuration() / num_frames;
+	long min_contact_frames = max(2L, long(MIN_CONTACT_SECONDS / frame_time + 0.5f));
+	vector<float> speed(num_frames), sorted;
+	for (int foot = 0; foot < NUM_FEET; foot++)
+	{
+		foot_bones[foot] = _hierarchy.getBone((unsigned short)foot_bone[foot]).name;
+		const float* x = &track[(foot * 3) * num_frames];
+		const float* y = &track[(foot * 3 + 1) * num_frames];
+		const float* z = &track[(foot * 3 + 2) * num_frames];
+		centralSpeeds(x, y, z, num_frames, 0.5f / frame_time, &speed[0]);
+
+		// thresholds relative to this foot's own motion, so clip units do not matter
+		sorted.assign(speed.begin(), speed.end());
+		float typical_speed = percentileOf(sorted, 0.9f);
+		sorted.assign(y, y + num_frames);
+		float lowest = *min_element(sorted.begin(), sorted.end());
+		float contact_height = lowest + CONTACT_HEIGHT * (percentileOf(sorted, 0.9f) - lowest);
+		float enter_speed = CONTACT_ENTER_SPEED * typical_speed;
+		float leave_speed = CONTACT_LEAVE_SPEED * typical_speed;
+
+		bool planted = false;
+		FootContact contact;
+		contact.start = 0;
+		for (long f = 0; f <= num_frames; f++)
+		{
+			bool end_of_clip = (f == num_frames);
+			if (!planted)
+			{
+				if (!end_of_clip && speed[f] < enter_speed && y[f] <= contact_height)
+				{
+					planted = true;
+					contact.start = f;
+				}
+			}
+			else if (end_of_clip || speed[f] > leave_speed)
+			{
+				planted = false;
+				contact.end = f - 1;
+				if (contact.end - contact.start + 1 >= min_contact_frames) contacts[foot].push_back(contact);
+			}
+		}
+	}
+	return true;
+}
+
+bool FootContacts::inContact(FOOT _foot, long _frame)
+{
+	const vector<FootContact>& list = contacts[_foot];
+	// first contact starting after _frame; the one before it may hold _frame
+	size_t lo = 0, hi = list.size();
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (list[mid].start <= _frame) lo = mid + 1;
+		else hi = mid;
+	}
+	return (lo > 0) && (list[lo - 1].end >= _frame);
+}
+
+void FootContacts::stepFrames(FOOT _foot, vector<long>& _steps)
+{
+	_steps.clear();
+	for (unsigned int i = 0; i < contacts[_foot].size(); i++) _steps.push_back(contacts[_foot][i].start);
+}
+
+static void appendInt32(vector<char>& _data, int32_t _value)
+{
+	size_t start = _data.size();
+	_data.resize(start + sizeof(_value));
+	memcpy(&_data[start], &_value, sizeof(_value));
+}
+
+// Flat form: per foot, the bone name length and name, the number of
+// contacts, then each contact's start and end, as 32 bit integers.
+void FootContacts::serialize(vector<char>& _data)
+{
+	_data.clear();
+	for (int foot = 0; foot < NUM_FEET; foot++)
+	{
+		appendInt32(_data, (int32_t)foot_bones[foot].size());
+		_data.insert(_data.end(), foot_bones[foot].begin(), foot_bones[foot].end());
+		appendInt32(_data, (int32_t)contacts[foot].size());
+		for (unsigned int i = 0; i < contacts[foot].size(); i++)
+		{
+			appendInt32(_data, (int32_t)contacts[foot][i].start);
+			appendInt32(_data, (int32_t)contacts[foot][i].end);
+		}
+	}
+}
+
+bool FootContacts::deserialize(const vector<char>& _data)
+{
+	size_t position = 0;
+	for (int foot = 0; foot < NUM_FEET; foot++)
+	{
+		contacts[foot].clear();
+		int32_t length;
+		if (position + sizeof(length) > _data.size()) return false;
+		memcpy(&length, &_data[position], sizeof(length));
+		position += sizeof(length);
+		if (length < 0 || position + size_t(length) > _data.size()) return false;
+		foot_bones[foot].assign(_data.begin() + position, _data.begin() + position + length);
+		position += length;
+
+		int32_t count;
+		if (position + sizeof(count) > _data.size()) return false;
+		memcpy(&count, &_data[position], sizeof(count));
+		position += sizeof(count);
+		if (count < 0 || position + size_t(count) * 2 * sizeof(int32_t) > _data.size()) return false;
+		for (int32_t i = 0; i < count; i++)
+		{
+			int32_t range[2];
+			memcpy(range, &_data[position], sizeof(range));
+			position += sizeof(range);
+			FootContact contact;
+			contact.start = range[0];
+			contact.end = range[1];
+			contacts[foot].push_back(contact);
+		}
+	}
+	return position == _data.size();
+}
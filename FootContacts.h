@@ -0,0 +1,50 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// FootContacts.h
+//    Foot contacts (sync frames) of a clip, found offline: the feet are
+//    tracked through every frame with BoneHierarchy's forward kinematics,
+//    their speeds come from central differences over the whole track, and
+//    a foot is in contact while it is slow and near its lowest height.
+//    Hysteresis on the speed keeps noise from splitting a contact in two.
+//-----------------------------------------------------------------------------
+#ifndef FOOTCONTACTS_DOT_H
+#define FOOTCONTACTS_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <string>
+#include <vector>
+using namespace std;
+
+class BoneHierarchy;
+class PoseSource;
+
+enum FOOT { LEFT_FOOT = 0, RIGHT_FOOT = 1, NUM_FEET = 2 };
+
+// first and last frame of one contact; its start is a step
+struct FootContact {
+	long start;
+	long end;
+};
+
+struct FootContacts {
+	vector<FootContact> contacts[NUM_FEET];
+	// bones tracked for each foot
+	string foot_bones[NUM_FEET];
+
+	// detect() finds the contacts of every frame of _source, which must
+	// already be bound to _hierarchy. Returns false if no feet are found.
+	bool detect(BoneHierarchy& _hierarchy, PoseSource* _source);
+
+	// true if _foot is planted at _frame
+	bool inContact(FOOT _foot, long _frame);
+	// frames at which _foot touches down
+	void stepFrames(FOOT _foot, vector<long>& _steps);
+
+	// flat form, for keeping the contacts in the motion cache
+	void serialize(vector<char>& _data);
+	bool deserialize(const vector<char>& _data);
+};
+
+#endif // FOOTCONTACTS_DOT_H
@@ -0,0 +1,104 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// FrameTimers.cpp
+//    Per-phase timing of the render loop.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+// local application
+#include "FrameTimers.h"
+
+FrameTimers frame_timers;
+
+// (string literals, so they can name trace spans)
+static const char* PHASE_NAMES[NUM_FRAME_PHASES] = {
+	"input", "loading", "background", "markers", "update", "bones", "hud", "swap", "frame"
+};
+
+const char* phaseName(FRAME_PHASE _phase)
+{
+	return PHASE_NAMES[_phase];
+}
+
+FrameTimers::FrameTimers() : num_frames(0)
+{
+	memset(frames, 0, sizeof(frames));
+	memset(current, 0, sizeof(current));
+	frame_start = Clock::now();
+}
+
+void FrameTimers::beginFrame()
+{
+	memset(current, 0, sizeof(current));
+	frame_start = Clock::now();
+}
+
+void FrameTimers::endFrame()
+{
+	chrono::duration<float, milli> elapsed = Clock::now() - frame_start;
+	current[PHASE_FRAME] = elapsed.count();
+
+	unsigned long frame = num_frames.load(memory_order_relaxed);
+	memcpy(frames[frame % HISTORY], current, sizeof(current));
+	num_frames.store(frame + 1, memory_order_release);
+}
+
+unsigned int FrameTimers::snapshot(float _frames[][NUM_FRAME_PHASES], unsigned long& _first_frame)
+{
+	unsigned long end = num_frames.load(memory_order_acquire);
+	// the slot after the newest may already be in the middle of being overwritten
+	unsigned long count = min(end, (unsigned long)(HISTORY - 1));
+	_first_frame = end - count;
+	for (unsigned long f = _first_frame; f < end; f++)
+		memcpy(_frames[f - _first_frame], frames[f % HISTORY], sizeof(frames[0]));
+	return (unsigned int)count;
+}
+
+unsigned int FrameTimers::getStats(PhaseStats _stats[NUM_FRAME_PHASES])
+{
+	float recent[HISTORY][NUM_FRAME_PHASES];
+	unsigned long first_frame;
+	unsigned int count = snapshot(recent, first_frame);
+
+	float values[HISTORY];
+	for (int p = 0; p < NUM_FRAME_PHASES; p++)
+	{
+		PhaseStats& stats = _stats[p];
+		stats.min_ms = stats.avg_ms = stats.p99_ms = 0.0f;
+		if (count == 0) continue;
+
+		float sum = 0.0f;
+		for (unsigned int f = 0; f < count; f++) { values[f] = recent[f][p]; sum += values[f]; }
+		stats.avg_ms = sum / count;
+		stats.min_ms = *min_element(values, values + count);
+		unsigned int index = (unsigned int)(0.99f * (count - 1) + 0.5f);
+		nth_element(values, values + index, values + count);
+		stats.p99_ms = values[index];
+	}
+	return count;
+}
+
+bool FrameTimers::writeCSV(const string& _path)
+{
+	float recent[HISTORY][NUM_FRAME_PHASES];
+	unsigned long first_frame;
+	unsigned int count = snapshot(recent, first_frame);
+
+	FILE* file = fopen(_path.c_str(), "w");
+	if (file == NULL) return false;
+	fprintf(file, "frame");
+	for (int p = 0; p < NUM_FRAME_PHASES; p++) fprintf(file, ",%s_ms", PHASE_NAMES[p]);
+	fprintf(file, "\n");
+	for (unsigned int f = 0; f < count; f++)
+	{
+		fprintf(file, "%lu", first_frame + f);
+		for (int p = 0; p < NUM_FRAME_PHASES; p++) fprintf(file, ",%.4f", recent[f][p]);
+		fprintf(file, "\n");
+	}
+	return fclose(file) == 0;
+}
@@ -0,0 +1,99 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// FrameTimers.h
+//    Per-phase timing of the render loop. display() wraps each phase in a
+//    PhaseTimer; the times of a frame are gathered privately and published
+//    to a ring buffer of recent frames at endFrame(). The render thread is
+//    the only writer and publishes with a single atomic store, so readers
+//    (the HUD, the CSV dump) never take a lock.
+//-----------------------------------------------------------------------------
+#ifndef FRAMETIMERS_DOT_H
+#define FRAMETIMERS_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <atomic>
+#include <chrono>
+#include <string>
+using namespace std;
+// local application
+#include "Tracing.h"
+
+enum FRAME_PHASE {
+	PHASE_INPUT = 0,
+	PHASE_LOADING,
+	PHASE_BACKGROUND,
+	PHASE_MARKERS,
+	PHASE_UPDATE,
+	PHASE_BONES,
+	PHASE_HUD,
+	PHASE_SWAP,
+	// the whole frame, from beginFrame() to endFrame()
+	PHASE_FRAME,
+	NUM_FRAME_PHASES
+};
+
+const char* phaseName(FRAME_PHASE _phase);
+
+struct PhaseStats {
+	float min_ms;
+	float avg_ms;
+	float p99_ms;
+};
+
+class FrameTimers
+{
+public:
+	typedef chrono::steady_clock Clock;
+	// recent frames kept; one slot is left for the frame being written
+	static const unsigned int HISTORY = 256;
+
+	FrameTimers();
+
+	// beginFrame() and endFrame() bracket one frame on the render thread
+	void beginFrame();
+	void endFrame();
+	void addTime(FRAME_PHASE _phase, float _ms) { current[_phase] += _ms; }
+
+	// statistics over the recent frames, one entry per phase;
+	// returns the number of frames they cover
+	unsigned int getStats(PhaseStats _stats[NUM_FRAME_PHASES]);
+
+	// writeCSV() writes the recent frames, oldest first, one column per
+	// phase in milliseconds. Returns false if _path cannot be written.
+	bool writeCSV(const string& _path);
+
+private:
+	float frames[HISTORY][NUM_FRAME_PHASES];
+	// frames published so far; frame f is in slot f % HISTORY
+	atomic<unsigned long> num_frames;
+	float current[NUM_FRAME_PHASES];
+	Clock::time_point frame_start;
+
+	// copies the published frames still intact, oldest first
+	unsigned int snapshot(float _frames[][NUM_FRAME_PHASES], unsigned long& _first_frame);
+};
+
+// PhaseTimer adds the time from its construction to its destruction to
+// one phase of the current frame, and marks it on the trace timeline.
+class PhaseTimer
+{
+public:
+	PhaseTimer(FrameTimers& _timers, FRAME_PHASE _phase)
+		: timers(_timers), phase(_phase), span("render", phaseName(_phase)), start(FrameTimers::Clock::now()) { }
+	~PhaseTimer()
+	{
+		chrono::duration<float, milli> elapsed = FrameTimers::Clock::now() - start;
+		timers.addTime(phase, elapsed.count());
+	}
+private:
+	FrameTimers& timers;
+	FRAME_PHASE phase;
+	TraceSpan span;
+	FrameTimers::Clock::time_point start;
+};
+
+extern FrameTimers frame_timers;
+
+#endif // FRAMETIMERS_DOT_H
@@ -0,0 +1,93 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// HUDText.cpp
+//    Cached heads-up display text.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <GL/glut.h>
+// SKA modules
+#include <Core/Utilities.h>
+#include <Graphics/Graphics2D.h>
+// local application
+#include "HUDText.h"
+
+HUDText::Slot& HUDText::takeSlot(float _x, float _y, Color _color, VALUE_TYPE _type, bool& _stale)
+{
+	if (next_slot == slots.size())
+	{
+		Slot slot;
+		slot.list = 0;
+		slots.push_back(slot);
+		_stale = true;
+	}
+	else
+	{
+		const Slot& slot = slots[next_slot];
+		_stale = (slot.list == 0) || (slot.type != _type) || (slot.x != _x) || (slot.y != _y)
+			|| (slot.color.r != _color.r) || (slot.color.g != _color.g)
+			|| (slot.color.b != _color.b) || (slot.color.a != _color.a);
+	}
+	Slot& slot = slots[next_slot++];
+	slot.x = _x;
+	slot.y = _y;
+	slot.color = _color;
+	slot.type = _type;
+	return slot;
+}
+
+void HUDText::record(Slot& _slot)
+{
+	if (_slot.list == 0) _slot.list = glGenLists(1);
+	glNewList(_slot.list, GL_COMPILE_AND_EXECUTE);
+	renderString(_slot.x, _slot.y, 0.0f, _slot.color, _slot.text.c_str());
+	glEndList();
+}
+
+void HUDText::draw(float _x, float _y, Color _color, const char* _text)
+{
+	bool stale;
+	Slot& slot = takeSlot(_x, _y, _color, TEXT_VALUE, stale);
+	if (stale || slot.text != _text)
+	{
+		slot.text = _text;
+		record(slot);
+	}
+	else glCallList(slot.list);
+}
+
+void HUDText::draw(float _x, float _y, Color _color, float _value)
+{
+	bool stale;
+	Slot& slot = takeSlot(_x, _y, _color, FLOAT_VALUE, stale);
+	if (stale || slot.float_value != _value)
+	{
+		slot.float_value = _value;
+		slot.text = toString(_value);
+		record(slot);
+	}
+	else glCallList(slot.list);
+}
+
+void HUDText::draw(float _x, float _y, Color _color, long _value)
+{
+	bool stale;
+	Slot& slot = takeSlot(_x, _y, _color, LONG_VALUE, stale);
+	if (stale || slot.long_value != _value)
+	{
+		slot.long_value = _value;
+		slot.text = toString(_value);
+		record(slot);
+	}
+	else glCallList(slot.list);
+}
+
+void HUDText::release()
+{
+	for (unsigned int s = 0; s < slots.size(); s++)
+		if (slots[s].list != 0) glDeleteLists(slots[s].list, 1);
+	slots.clear();
+	next_slot = 0;
+}
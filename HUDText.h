@@ -0,0 +1,57 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// HUDText.h
+//    Cached heads-up display text. Each string drawn in a frame takes the
+//    next slot; a slot keeps an OpenGL display list of what it drew last
+//    frame and replays it while the text, place and color stay the same.
+//    Numbers are compared before they are formatted, so unchanged values
+//    cost neither a string conversion nor a renderString() call.
+//-----------------------------------------------------------------------------
+#ifndef HUDTEXT_DOT_H
+#define HUDTEXT_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <string>
+#include <vector>
+using namespace std;
+// SKA modules
+#include <Objects/Object.h>
+
+class HUDText
+{
+public:
+	HUDText() : next_slot(0) { }
+
+	// beginFrame() starts handing out slots from the first again
+	void beginFrame() { next_slot = 0; }
+
+	void draw(float _x, float _y, Color _color, const char* _text);
+	void draw(float _x, float _y, Color _color, float _value);
+	void draw(float _x, float _y, Color _color, long _value);
+
+	// release() frees the display lists; it needs the GL context
+	void release();
+
+private:
+	enum VALUE_TYPE { TEXT_VALUE, FLOAT_VALUE, LONG_VALUE };
+	struct Slot {
+		// display list, 0 until first drawn
+		unsigned int list;
+		float x, y;
+		Color color;
+		VALUE_TYPE type;
+		string text;
+		float float_value;
+		long long_value;
+	};
+	vector<Slot> slots;
+	unsigned int next_slot;
+
+	// the next slot, and whether it must be recorded again for this place and type
+	Slot& takeSlot(float _x, float _y, Color _color, VALUE_TYPE _type, bool& _stale);
+	void record(Slot& _slot);
+};
+
+#endif // HUDTEXT_DOT_H
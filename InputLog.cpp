@@ -0,0 +1,113 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// InputLog.cpp
+//    Record and replay of the app's inputs.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+// local application
+#include "InputLog.h"
+
+InputLog input_log;
+
+static const char INPUT_LOG_MAGIC[8] = { 'H', 'W', '2', 'I', 'N', 'P', 'T', '\0' };
+static const uint32_t INPUT_LOG_VERSION = 1;
+const int NUM_MOUSE_BUTTONS = 3;
+
+InputLog::InputLog()
+	: mode(IDLE), fast(false), finished(false), file(NULL), frames(0), frame_elapsed(0.0)
+{
+	memset(&replay_actions, 0, sizeof(replay_actions));
+}
+
+bool InputLog::record(const string& _path)
+{
+	close();
+	file = fopen(_path.c_str(), "wb");
+	if (file == NULL) return false;
+	fwrite(INPUT_LOG_MAGIC, sizeof(INPUT_LOG_MAGIC), 1, file);
+	fwrite(&INPUT_LOG_VERSION, sizeof(INPUT_LOG_VERSION), 1, file);
+	mode = RECORDING;
+	frames = 0;
+	return true;
+}
+
+bool InputLog::replay(const string& _path, bool _fast)
+{
+	close();
+	file = fopen(_path.c_str(), "rb");
+	if (file == NULL) return false;
+	char magic[sizeof(INPUT_LOG_MAGIC)];
+	uint32_t version;
+	if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, INPUT_LOG_MAGIC, sizeof(magic)) != 0
+		|| fread(&version, sizeof(version), 1, file) != 1 || version != INPUT_LOG_VERSION)
+	{
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+	mode = REPLAYING;
+	fast = _fast;
+	finished = false;
+	frames = 0;
+	return true;
+}
+
+void InputLog::close()
+{
+	if (file != NULL) fclose(file);
+	file = NULL;
+	mode = IDLE;
+}
+
+bool InputLog::readFrame()
+{
+	uint8_t buttons, num_keys;
+	if (fread(&frame_elapsed, sizeof(frame_elapsed), 1, file) != 1
+		|| fread(&buttons, 1, 1, file) != 1 || fread(&num_keys, 1, 1, file) != 1) return false;
+	if (num_keys > sizeof(replay_actions.keys_pressed)) return false;
+	if (num_keys > 0 && fread(replay_actions.keys_pressed, 1, num_keys, file) != num_keys) return false;
+	for (int b = 0; b < NUM_MOUSE_BUTTONS; b++) replay_actions.mouse_button_state[b] = ((buttons >> b) & 1) != 0;
+	replay_actions.num_keys_pressed = num_keys;
+	return true;
+}
+
+double InputLog::elapsedTime(double _live)
+{
+	if (mode == RECORDING) frame_elapsed = _live;
+	else if (mode == REPLAYING)
+	{
+		if (readFrame()) return frame_elapsed;
+		finished = true;
+		close();
+	}
+	return _live;
+}
+
+InputActions* InputLog::actions(InputActions* _live)
+{
+	if (mode == RECORDING)
+	{
+		uint8_t buttons = 0;
+		for (int b = 0; b < NUM_MOUSE_BUTTONS; b++) if (_live->mouse_button_state[b]) buttons |= uint8_t(1 << b);
+		// (more keys than this in one frame are not expected)
+		uint8_t num_keys = (uint8_t)min((int)_live->num_keys_pressed, 255);
+		fwrite(&frame_elapsed, sizeof(frame_elapsed), 1, file);
+		fwrite(&buttons, 1, 1, file);
+		fwrite(&num_keys, 1, 1, file);
+		if (num_keys > 0) fwrite(_live->keys_pressed, 1, num_keys, file);
+		frames++;
+		return _live;
+	}
+	if (mode == REPLAYING)
+	{
+		frames++;
+		return &replay_actions;
+	}
+	return _live;
+}
@@ -0,0 +1,67 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// InputLog.h
+//    Record and replay of the app's inputs, for repeatable runs. Each
+//    frame's elapsed time and input actions (mouse buttons and keys) are
+//    written to a small binary file; replaying the file feeds them back in
+//    place of the live clock and input, so the same camera moves, restarts
+//    and time warp changes happen at the same animation times.
+//    File layout: the 8 byte magic "HW2INPT", a uint32 version, then per
+//    frame a double elapsed time, a uint8 mouse button mask, a uint8 key
+//    count and that many key codes.
+//-----------------------------------------------------------------------------
+#ifndef INPUTLOG_DOT_H
+#define INPUTLOG_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cstdio>
+#include <string>
+using namespace std;
+// SKA modules
+#include <Input/InputManager.h>
+
+class InputLog
+{
+public:
+	InputLog();
+	~InputLog() { close(); }
+
+	// record() and replay() return false if _path cannot be opened (or is
+	// not an input log). A _fast replay runs frames back to back instead of
+	// at the recorded pace.
+	bool record(const string& _path);
+	bool replay(const string& _path, bool _fast);
+	void close();
+
+	bool isRecording() { return mode == RECORDING; }
+	bool isReplaying() { return mode == REPLAYING; }
+	bool isFastReplay() { return (mode == REPLAYING) && fast; }
+	// true once a replay has run out of frames
+	bool replayFinished() { return finished; }
+	unsigned long numFrames() { return frames; }
+
+	// Called once per frame, in this order. elapsedTime() passes _live
+	// through (recording it) or returns the recorded time instead.
+	// actions() does the same for the frame's input; during a replay the
+	// live input is ignored.
+	double elapsedTime(double _live);
+	InputActions* actions(InputActions* _live);
+
+private:
+	enum MODE { IDLE, RECORDING, REPLAYING };
+	MODE mode;
+	bool fast;
+	bool finished;
+	FILE* file;
+	unsigned long frames;
+	double frame_elapsed;
+	InputActions replay_actions;
+
+	bool readFrame();
+};
+
+extern InputLog input_log;
+
+#endif // INPUTLOG_DOT_H
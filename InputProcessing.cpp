@@ -13,14 +13,22 @@
 #include "InputProcessing.h"
 #include "CameraControl.h" 
 #include "AnimationControl.h"
+#include "InputLog.h"
 
 InputProcessor input_processor;
 
 // extern references from AppMain.cpp
 extern void shutDown(int _exit_code);
+extern void dumpFrameTimes();
+extern void nextHUDPage();
+extern void toggleFixedStep();
+extern void toggleCulling();
 
 #define ESC 27 // ASCII code for the escape key.
 
+// seconds 't' takes to crossfade the characters to their next clips
+const float CROSSFADE_DURATION = 1.0f;
+
 // Control Scheme:
 // left mouse button: move camera forward
 // right mouse button: move camera backward
@@ -40,6 +48,16 @@ InputProcessor::InputProcessor()
 	filter->addFilter('9', 0.2f, KEYBOARD);
 	filter->addFilter(',', 0.2f, KEYBOARD);
 	filter->addFilter('.', 0.2f, KEYBOARD);
+	filter->addFilter('b', 0.2f, KEYBOARD);
+	filter->addFilter('y', 0.2f, KEYBOARD);
+	filter->addFilter('p', 0.2f, KEYBOARD);
+	filter->addFilter('n', 0.2f, KEYBOARD);
+	filter->addFilter('f', 0.2f, KEYBOARD);
+	filter->addFilter('g', 0.2f, KEYBOARD);
+	filter->addFilter('h', 0.2f, KEYBOARD);
+	filter->addFilter('v', 0.2f, KEYBOARD);
+	filter->addFilter('c', 0.2f, KEYBOARD);
+	filter->addFilter('t', 0.2f, KEYBOARD);
 }
 
 InputProcessor::~InputProcessor()
@@ -53,6 +71,14 @@ void InputProcessor::processInputs(float elapsed_time)
 	// get all input activity since last call
 	InputActions* actions = input_manager.getInput();
 
+	// A replay substitutes the recorded input; ESC still stops it.
+	if (input_log.isReplaying())
+	{
+		for (short i=0; i<actions->num_keys_pressed; i++)
+			if (actions->keys_pressed[i] == ESC) shutDown(0);
+	}
+	actions = input_log.actions(actions);
+
 	// initialize camera controls
 	float fwd_thrust=0.0f;
 	float hrz_thrust=0.0f;
@@ -114,6 +140,36 @@ void InputProcessor::processInputs(float elapsed_time)
 		case '.':
 			anim_ctrl.increaseGlobalTimeWarp();
 			break;
+		case 'b':
+			anim_ctrl.toggleInterpolation();
+			break;
+		case 'y':
+			anim_ctrl.toggleStepSync();
+			break;
+		case 'p':
+			dumpFrameTimes();
+			break;
+		case 'n':
+			nextHUDPage();
+			break;
+		case 'f':
+			toggleFixedStep();
+			break;
+		case 'g':
+			anim_ctrl.togglePipelining();
+			break;
+		case 'h':
+			anim_ctrl.toggleBatchedBones();
+			break;
+		case 'v':
+			anim_ctrl.toggleLOD();
+			break;
+		case 'c':
+			toggleCulling();
+			break;
+		case 't':
+			anim_ctrl.crossfadeCharacters(CROSSFADE_DURATION);
+			break;
 		}
 	}
 	if (move_camera)
@@ -0,0 +1,63 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// MarkerTrail.cpp
+//    Fixed-capacity trail of marker boxes.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cstring>
+// local application
+#include "MarkerTrail.h"
+
+// corners of a unit box (-1..1) and, per face, its normal and four
+// corners in counter-clockwise order seen from outside
+static const float BOX_CORNERS[8][3] = {
+	{ -1, -1, -1 }, { 1, -1, -1 }, { 1, 1, -1 }, { -1, 1, -1 },
+	{ -1, -1,  1 }, { 1, -1,  1 }, { 1, 1,  1 }, { -1, 1,  1 }
+};
+static const float BOX_NORMALS[6][3] = {
+	{ 0, 0, -1 }, { 0, 0, 1 }, { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }
+};
+static const int BOX_FACES[6][4] = {
+	{ 0, 3, 2, 1 }, { 4, 5, 6, 7 }, { 0, 4, 7, 3 }, { 1, 2, 6, 5 }, { 0, 1, 5, 4 }, { 3, 7, 6, 2 }
+};
+
+MarkerTrail::MarkerTrail(unsigned int _capacity, float _size)
+	: max_markers(_capacity), num_markers(0), next_slot(0), half_size(0.5f * _size),
+	vertex_positions(size_t(_capacity) * VERTICES_PER_MARKER * 3, 0.0f),
+	vertex_normals(size_t(_capacity) * VERTICES_PER_MARKER * 3),
+	vertex_colors(size_t(_capacity) * VERTICES_PER_MARKER * 4, 1.0f)
+{
+	// normals are the same for every slot, so they are filled in once
+	for (unsigned int m = 0; m < max_markers; m++)
+		for (int face = 0; face < 6; face++)
+			for (int corner = 0; corner < 4; corner++)
+				memcpy(&vertex_normals[((m * 6 + face) * 4 + corner) * 3], BOX_NORMALS[face], 3 * sizeof(float));
+}
+
+void MarkerTrail::record(const Vector3D& _position, Color _color)
+{
+	if (max_markers == 0) return;
+
+	float* position = &vertex_positions[size_t(next_slot) * VERTICES_PER_MARKER * 3];
+	float* color = &vertex_colors[size_t(next_slot) * VERTICES_PER_MARKER * 4];
+	for (int face = 0; face < 6; face++)
+	{
+		for (int corner = 0; corner < 4; corner++)
+		{
+			const float* unit = BOX_CORNERS[BOX_FACES[face][corner]];
+			*position++ = _position.x + half_size * unit[0];
+			*position++ = _position.y + half_size * unit[1];
+			*position++ = _position.z + half_size * unit[2];
+			*color++ = _color.r;
+			*color++ = _color.g;
+			*color++ = _color.b;
+			*color++ = _color.a;
+		}
+	}
+
+	next_slot = (next_slot + 1) % max_markers;
+	if (num_markers < max_markers) num_markers++;
+}
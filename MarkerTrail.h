@@ -0,0 +1,66 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// MarkerTrail.h
+//    Fixed-capacity trail of marker boxes. All slots are allocated up
+//    front as one block of vertex arrays (24 vertices, 6 quads, per box);
+//    recording a marker overwrites the oldest slot in place, so a trail of
+//    any length costs no allocations while running. The renderer draws
+//    every marker with a single glDrawArrays() call over those arrays.
+//    Kept free of OpenGL calls so the headless benchmark can link it.
+//-----------------------------------------------------------------------------
+#ifndef MARKERTRAIL_DOT_H
+#define MARKERTRAIL_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <vector>
+using namespace std;
+// SKA modules
+#include <Math/Vector3D.h>
+#include <Objects/Object.h>
+
+class MarkerTrail
+{
+public:
+	static const unsigned int VERTICES_PER_MARKER = 24;
+
+	// _capacity markers are kept; older ones are overwritten
+	MarkerTrail(unsigned int _capacity = 512, float _size = 0.5f);
+
+	// record() places a box of the trail's size centered at _position
+	void record(const Vector3D& _position, Color _color);
+	void clear() { num_markers = 0; next_slot = 0; }
+
+	unsigned int numMarkers() { return num_markers; }
+	unsigned int capacity() { return max_markers; }
+
+	// bounding sphere of the marker in slot _slot (< numMarkers())
+	Vector3D markerPosition(unsigned int _slot)
+	{
+		// the first vertex of a slot is its box's (-1, -1, -1) corner
+		const float* corner = &vertex_positions[size_t(_slot) * VERTICES_PER_MARKER * 3];
+		return Vector3D(corner[0] + half_size, corner[1] + half_size, corner[2] + half_size);
+	}
+	float markerRadius() { return half_size * 1.7320508f; }
+
+	// Vertex arrays for the recorded markers, in no particular order:
+	// numVertices() vertices as GL_QUADS, with 3 position floats,
+	// 3 normal floats and 4 color floats each. Slot _slot's vertices
+	// start at _slot * VERTICES_PER_MARKER.
+	unsigned int numVertices() { return num_markers * VERTICES_PER_MARKER; }
+	const float* positions() { return &vertex_positions[0]; }
+	const float* normals() { return &vertex_normals[0]; }
+	const float* colors() { return &vertex_colors[0]; }
+
+private:
+	unsigned int max_markers;
+	unsigned int num_markers;
+	unsigned int next_slot;
+	float half_size;
+	vector<float> vertex_positions;
+	vector<float> vertex_normals;
+	vector<float> vertex_colors;
+};
+
+#endif // MARKERTRAIL_DOT_H
@@ -0,0 +1,400 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// MotionCache.cpp
+//    Binary cache of parsed clips, memory mapped on later runs.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+// SKA modules
+#include <Core/Utilities.h>
+// local application
+#include "AppConfig.h"
+#include "MotionCache.h"
+#include "PoseClip.h"
+#include "PoseMath.h"
+
+const char CACHE_MAGIC[8] = { 'H', 'W', '2', 'C', 'L', 'I', 'P', 0 };
+// 3: the degrees flag comes from the file format, no longer guessed from the data
+const uint32_t CACHE_VERSION = 3;
+// header flags
+const uint32_t CACHE_FLAG_DEGREES = 1;
+
+// Layout: header, the two source paths, the channel list, padding to
+// POSE_ALIGNMENT, then numFrames()+1 frame rows of stride floats.
+struct CacheFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_channels;
+	uint32_t stride;
+	int32_t num_frames;
+	float duration;
+	float scale;
+	int64_t motion_size;
+	int64_t motion_mtime;
+	int64_t skeleton_size;
+	int64_t skeleton_mtime;
+	uint32_t motion_path_length;
+	uint32_t skeleton_path_length;
+	uint32_t channels_offset;
+	uint32_t frames_offset;
+	uint32_t flags;
+};
+
+// Sidecar files hold results derived from a clip, such as its foot
+// contacts. Layout: header, the two source paths, then the data.
+const char SIDECAR_MAGIC[8] = { 'H', 'W', '2', 'S', 'I', 'D', 'E', 0 };
+const uint32_t SIDECAR_VERSION = 1;
+
+struct SidecarFileHeader {
+	char magic[8];
+	uint32_t version;
+	float scale;
+	int64_t motion_size;
+	int64_t motion_mtime;
+	int64_t skeleton_size;
+	int64_t skeleton_mtime;
+	uint32_t motion_path_length;
+	uint32_t skeleton_path_length;
+	uint64_t data_size;
+};
+
+// one channel as stored in the file
+struct CacheFileChannel {
+	int16_t bone_id;
+	int16_t channel_type;
+};
+
+static bool fileStamp(const string& _path, int64_t& _size, int64_t& _mtime)
+{
+	_size = 0; _mtime = 0;
+	if (_path.empty()) return true;
+	struct stat info;
+	if (stat(_path.c_str(), &info) != 0) return false;
+	_size = (int64_t)info.st_size;
+	_mtime = (int64_t)info.st_mtime;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// MappedFile
+
+MappedFile::MappedFile()
+	: bytes(NULL), num_bytes(0)
+#ifdef _WIN32
+	, file_handle(NULL), mapping_handle(NULL)
+#endif
+{ }
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const string& _path)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) { CloseHandle(file); return false; }
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) { CloseHandle(file); return false; }
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) { CloseHandle(mapping); CloseHandle(file); return false; }
+	file_handle = file;
+	mapping_handle = mapping;
+	bytes = (const char*)view;
+	num_bytes = (size_t)file_size.QuadPart;
+#else
+	int fd = ::open(_path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) { ::close(fd); return false; }
+	void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+	if (view == MAP_FAILED) return false;
+	bytes = (const char*)view;
+	num_bytes = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (bytes == NULL) return;
+#ifdef _WIN32
+	UnmapViewOfFile(bytes);
+	CloseHandle((HANDLE)mapping_handle);
+	CloseHandle((HANDLE)file_handle);
+	mapping_handle = NULL;
+	file_handle = NULL;
+#else
+	munmap((void*)bytes, num_bytes);
+#endif
+	bytes = NULL;
+	num_bytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+// MotionCache
+
+string MotionCache::cachePath(const MotionCacheKey& _key)
+{
+	// readable name from the motion file, plus a hash of the full key
+	// so files with the same name in different directories do not collide
+	string base = _key.motion_path;
+	size_t slash = base.find_last_of("/\\");
+	if (slash != string::npos) base = base.substr(slash + 1);
+
+	string name;
+	for (unsigned int i = 0; i < base.size(); i++)
+	{
+		char ch = base[i];
+		if (isalnum((unsigned char)ch) || ch == '.' || ch == '-' || ch == '_') name += ch;
+		else name += '_';
+	}
+
+	string full_key = _key.motion_path + "|" + _key.skeleton_path + "|" + toString(_key.scale);
+	uint32_t hash = 2166136261u;
+	for (unsigned int i = 0; i < full_key.size(); i++)
+	{
+		hash ^= (unsigned char)full_key[i];
+		hash *= 16777619u;
+	}
+	char hash_text[16];
+	sprintf(hash_text, "%08x", hash);
+
+	return string(MOTION_CACHE_PATH) + "/" + name + "." + hash_text + ".clip";
+}
+
+// parseCacheFile() checks a cache file against _key and fills _layout.
+// _data holds the start of the file, at least up to the frame rows
+// (_available bytes); _file_size is the size of the whole file.
+static bool parseCacheFile(const MotionCacheKey& _key, const char* _data, size_t _available, size_t _file_size,
+	MotionCacheLayout& _layout)
+{
+	int64_t motion_size, motion_mtime, skeleton_size, skeleton_mtime;
+	if (!fileStamp(_key.motion_path, motion_size, motion_mtime)) return false;
+	if (!fileStamp(_key.skeleton_path, skeleton_size, skeleton_mtime)) return false;
+
+	if (_available < sizeof(CacheFileHeader)) return false;
+	CacheFileHeader header;
+	memcpy(&header, _data, sizeof(header));
+	bool valid = (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0)
+		&& (header.version == CACHE_VERSION)
+		&& (header.scale == _key.scale)
+		&& (header.motion_size == motion_size) && (header.motion_mtime == motion_mtime)
+		&& (header.skeleton_size == skeleton_size) && (header.skeleton_mtime == skeleton_mtime)
+		&& (header.num_frames > 0) && (header.num_channels > 0)
+		&& (header.stride == paddedPoseSize(header.num_channels))
+		&& (header.frames_offset % POSE_ALIGNMENT == 0)
+		&& (header.frames_offset <= _available);
+	if (valid)
+	{
+		size_t paths_end = sizeof(header) + header.motion_path_length + header.skeleton_path_length;
+		size_t channels_end = size_t(header.channels_offset) + header.num_channels * sizeof(CacheFileChannel);
+		size_t frames_end = size_t(header.frames_offset) + size_t(header.num_frames + 1) * header.stride * sizeof(float);
+		valid = (paths_end <= header.channels_offset) && (channels_end <= header.frames_offset) && (frames_end <= _file_size);
+	}
+	if (valid)
+	{
+		const char* paths = _data + sizeof(header);
+		valid = (string(paths, header.motion_path_length) == _key.motion_path)
+			&& (string(paths + header.motion_path_length, header.skeleton_path_length) == _key.skeleton_path);
+	}
+	if (!valid) return false;
+
+	_layout.channels.resize(header.num_channels);
+	const char* channel_data = _data + header.channels_offset;
+	for (unsigned int c = 0; c < header.num_channels; c++)
+	{
+		CacheFileChannel stored;
+		memcpy(&stored, channel_data + c * sizeof(stored), sizeof(stored));
+		_layout.channels[c] = CHANNEL_ID(stored.bone_id, (CHANNEL_TYPE)stored.channel_type);
+	}
+	_layout.num_frames = header.num_frames;
+	_layout.duration = header.duration;
+	_layout.stride = header.stride;
+	_layout.degrees = (header.flags & CACHE_FLAG_DEGREES) != 0;
+	_layout.frames_offset = header.frames_offset;
+	return true;
+}
+
+bool MotionCache::load(const MotionCacheKey& _key, MappedFile& _mapping, PoseClip& _clip)
+{
+	if (!_mapping.open(cachePath(_key))) return false;
+
+	MotionCacheLayout layout;
+	if (!parseCacheFile(_key, _mapping.data(), _mapping.size(), _mapping.size(), layout))
+	{
+		_mapping.close();
+		return false;
+	}
+
+	_clip.attach(layout.channels, layout.num_frames, layout.duration, layout.stride, layout.degrees,
+		(const float*)(_mapping.data() + layout.frames_offset));
+	return true;
+}
+
+bool MotionCache::inspect(const MotionCacheKey& _key, MotionCacheLayout& _layout)
+{
+	string path = cachePath(_key);
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0) return false;
+	FILE* in = fopen(path.c_str(), "rb");
+	if (in == NULL) return false;
+
+	// read the header to find where the frame rows start, then everything before them
+	CacheFileHeader header;
+	bool ok = (fread(&header, 1, sizeof(header), in) == sizeof(header))
+		&& (header.frames_offset >= sizeof(header)) && (header.frames_offset <= (uint64_t)info.st_size);
+	vector<char> prefix;
+	if (ok)
+	{
+		prefix.resize(header.frames_offset);
+		memcpy(&prefix[0], &header, sizeof(header));
+		size_t rest = prefix.size() - sizeof(header);
+		ok = (rest == 0) || (fread(&prefix[sizeof(header)], 1, rest, in) == rest);
+	}
+	fclose(in);
+	if (!ok) return false;
+
+	if (!parseCacheFile(_key, &prefix[0], prefix.size(), (size_t)info.st_size, _layout)) return false;
+	_layout.path = path;
+	return true;
+}
+
+bool MotionCache::save(const MotionCacheKey& _key, PoseClip& _clip)
+{
+	if (_clip.numFrames() <= 0 || _clip.numChannels() == 0) return false;
+
+	CacheFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.num_channels = _clip.numChannels();
+	header.stride = _clip.getStride();
+	header.num_frames = (int32_t)_clip.numFrames();
+	header.duration = _clip.getDuration();
+	header.scale = _key.scale;
+	if (_clip.rotationsInDegrees()) header.flags |= CACHE_FLAG_DEGREES;
+	if (!fileStamp(_key.motion_path, header.motion_size, header.motion_mtime)) return false;
+	if (!fileStamp(_key.skeleton_path, header.skeleton_size, header.skeleton_mtime)) return false;
+	header.motion_path_length = (uint32_t)_key.motion_path.size();
+	header.skeleton_path_length = (uint32_t)_key.skeleton_path.size();
+	header.channels_offset = (uint32_t)(sizeof(header) + header.motion_path_length + header.skeleton_path_length);
+	uint32_t channels_end = header.channels_offset + header.num_channels * (uint32_t)sizeof(CacheFileChannel);
+	header.frames_offset = (channels_end + POSE_ALIGNMENT - 1) / POSE_ALIGNMENT * POSE_ALIGNMENT;
+
+	vector<char> prefix(header.frames_offset, 0);
+	memcpy(&prefix[0], &header, sizeof(header));
+	memcpy(&prefix[sizeof(header)], _key.motion_path.data(), header.motion_path_length);
+	memcpy(&prefix[sizeof(header) + header.motion_path_length], _key.skeleton_path.data(), header.skeleton_path_length);
+	for (unsigned short c = 0; c < header.num_channels; c++)
+	{
+		CacheFileChannel stored;
+		stored.bone_id = _clip.getChannel(c).bone_id;
+		stored.channel_type = (int16_t)_clip.getChannel(c).channel_type;
+		memcpy(&prefix[header.channels_offset + c * sizeof(stored)], &stored, sizeof(stored));
+	}
+
+	// write to a temporary name, then rename, so a reader never sees a partial file
+	string path = cachePath(_key);
+	string temp_path = path + ".tmp";
+	FILE* out = fopen(temp_path.c_str(), "wb");
+	if (out == NULL) return false;
+	size_t row_bytes = header.stride * sizeof(float);
+	bool ok = (fwrite(&prefix[0], 1, prefix.size(), out) == prefix.size());
+	for (long f = 0; ok && f <= _clip.numFrames(); f++)
+		ok = (fwrite(_clip.getFrame(f), 1, row_bytes, out) == row_bytes);
+	if (fclose(out) != 0) ok = false;
+	if (ok)
+	{
+		remove(path.c_str());
+		ok = (rename(temp_path.c_str(), path.c_str()) == 0);
+	}
+	if (!ok) remove(temp_path.c_str());
+	return ok;
+}
+
+bool MotionCache::loadSidecar(const MotionCacheKey& _key, const string& _suffix, vector<char>& _data)
+{
+	int64_t motion_size, motion_mtime, skeleton_size, skeleton_mtime;
+	if (!fileStamp(_key.motion_path, motion_size, motion_mtime)) return false;
+	if (!fileStamp(_key.skeleton_path, skeleton_size, skeleton_mtime)) return false;
+
+	FILE* in = fopen((cachePath(_key) + _suffix).c_str(), "rb");
+	if (in == NULL) return false;
+
+	SidecarFileHeader header;
+	bool ok = (fread(&header, 1, sizeof(header), in) == sizeof(header))
+		&& (memcmp(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) == 0)
+		&& (header.version == SIDECAR_VERSION)
+		&& (header.scale == _key.scale)
+		&& (header.motion_size == motion_size) && (header.motion_mtime == motion_mtime)
+		&& (header.skeleton_size == skeleton_size) && (header.skeleton_mtime == skeleton_mtime)
+		&& (header.motion_path_length == _key.motion_path.size())
+		&& (header.skeleton_path_length == _key.skeleton_path.size());
+	if (ok)
+	{
+		string paths(header.motion_path_length + header.skeleton_path_length, '\0');
+		ok = paths.empty() || (fread(&paths[0], 1, paths.size(), in) == paths.size());
+		ok = ok && (paths == _key.motion_path + _key.skeleton_path);
+	}
+	if (ok)
+	{
+		_data.resize((size_t)header.data_size);
+		ok = _data.empty() || (fread(&_data[0], 1, _data.size(), in) == _data.size());
+	}
+	fclose(in);
+	return ok;
+}
+
+bool MotionCache::saveSidecar(const MotionCacheKey& _key, const string& _suffix, const vector<char>& _data)
+{
+	SidecarFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+	header.version = SIDECAR_VERSION;
+	header.scale = _key.scale;
+	if (!fileStamp(_key.motion_path, header.motion_size, header.motion_mtime)) return false;
+	if (!fileStamp(_key.skeleton_path, header.skeleton_size, header.skeleton_mtime)) return false;
+	header.motion_path_length = (uint32_t)_key.motion_path.size();
+	header.skeleton_path_length = (uint32_t)_key.skeleton_path.size();
+	header.data_size = _data.size();
+
+	string path = cachePath(_key) + _suffix;
+	string temp_path = path + ".tmp";
+	FILE* out = fopen(temp_path.c_str(), "wb");
+	if (out == NULL) return false;
+	string paths = _key.motion_path + _key.skeleton_path;
+	bool ok = (fwrite(&header, 1, sizeof(header), out) == sizeof(header));
+	ok = ok && (paths.empty() || fwrite(paths.data(), 1, paths.size(), out) == paths.size());
+	ok = ok && (_data.empty() || fwrite(&_data[0], 1, _data.size(), out) == _data.size());
+	if (fclose(out) != 0) ok = false;
+	if (ok)
+	{
+		remove(path.c_str());
+		ok = (rename(temp_path.c_str(), path.c_str()) == 0);
+	}
+	if (!ok) remove(temp_path.c_str());
+	return ok;
+}
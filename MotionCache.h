@@ -0,0 +1,102 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// MotionCache.h
+//    Binary cache of parsed clips, so text ASF/AMC and BVH files are only
+//    parsed the first time they are seen. A cache file holds the channel
+//    list and the PoseClip frame rows, and is memory mapped on later runs
+//    so the rows are used in place without being read or copied.
+//    Cache files are keyed by source path, size, modification time and
+//    load scale, and are rebuilt when any of these change.
+//    They use the native byte order and are not meant to be shared
+//    between machines.
+//-----------------------------------------------------------------------------
+#ifndef MOTIONCACHE_DOT_H
+#define MOTIONCACHE_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cstddef>
+#include <string>
+#include <vector>
+using namespace std;
+// SKA modules
+#include <Animation/MotionSequence.h>
+
+class PoseClip;
+
+// read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(const string& _path);
+	void close();
+
+	const char* data() { return bytes; }
+	size_t size() { return num_bytes; }
+
+private:
+	const char* bytes;
+	size_t num_bytes;
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#endif
+
+	// no copying
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
+// identifies the source data of a cached clip
+struct MotionCacheKey {
+	string motion_path;
+	string skeleton_path;
+	float scale;
+	MotionCacheKey() : scale(1.0f) { }
+};
+
+// where a cache file keeps its frame rows, for reading them in pieces
+struct MotionCacheLayout {
+	string path;
+	vector<CHANNEL_ID> channels;
+	long num_frames;
+	float duration;
+	unsigned int stride;
+	// rotation channels in degrees rather than radians
+	bool degrees;
+	// byte offset of frame row 0; rows are stride floats each and there
+	// are num_frames+1 of them, the last being the loop row
+	size_t frames_offset;
+	MotionCacheLayout() : num_frames(0), duration(0.0f), stride(0), degrees(true), frames_offset(0) { }
+};
+
+class MotionCache
+{
+public:
+	// cachePath() gives the cache file used for _key
+	static string cachePath(const MotionCacheKey& _key);
+
+	// load() maps the cache file for _key into _mapping and attaches
+	// _clip to its frame rows. Returns false if there is no cache file
+	// or it is stale or damaged; _clip is left untouched in that case.
+	static bool load(const MotionCacheKey& _key, MappedFile& _mapping, PoseClip& _clip);
+
+	// inspect() checks the cache file for _key without mapping it, and
+	// reports where its frame rows are. Returns false if it is unusable.
+	static bool inspect(const MotionCacheKey& _key, MotionCacheLayout& _layout);
+
+	// save() writes _clip to the cache file for _key.
+	static bool save(const MotionCacheKey& _key, PoseClip& _clip);
+
+	// Sidecar files keep data derived from the clip for _key next to its
+	// cache file, one per _suffix, and go stale along with it.
+	// loadSidecar() returns false if the file is missing or stale.
+	static bool loadSidecar(const MotionCacheKey& _key, const string& _suffix, vector<char>& _data);
+	static bool saveSidecar(const MotionCacheKey& _key, const string& _suffix, const vector<char>& _data);
+};
+
+#endif // MOTIONCACHE_DOT_H
@@ -12,48 +12,471 @@
 //    Primary function is to convert clock time into a sequence frame.
 //-----------------------------------------------------------------------------
 
+// SKA configuration
 #include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+// SKA modules
 #include <Core/Utilities.h>
 #include <Animation/AnimationException.h>
+// local application
 #include "OpenMotionSequenceController.h"
+#include "PoseSource.h"
+#include "PoseMath.h"
 
-OpenMotionSequenceController::OpenMotionSequenceController(MotionSequence* _ms) 
-	: MotionController(), motion_sequence(_ms), sequence_time(0.0f), sequence_frame(0)
+OpenMotionSequenceController::OpenMotionSequenceController(MotionSequence* _ms, PoseSource* _source, bool _owns_source) 
+	: MotionController(), motion_sequence(_ms), pose_source(_source), owns_source(_owns_source), interpolate(false),
+	sequence_time(0.0f), sequence_frame(0),
+	time_offset(0.0f), root_offset(0.0f, 0.0f, 0.0f),
+	channel_stride(0), pose(NULL), pose_size(0), pose_valid(false), pose_time(0.0f),
+	back_pose(NULL), back_valid(false), back_time(0.0f), back_sequence_time(0.0f), back_sequence_frame(0),
+	max_layers(0), layer_pose(NULL), back_layer_pose(NULL), layer_references(NULL), angle_periods(NULL), angle_inverse_periods(NULL),
+	span_start(NULL), span_end(NULL), span_valid(false), span_start_time(0.0f), span_end_time(0.0f),
+	back_span_start(NULL), back_span_end(NULL), back_span_valid(false), back_span_end_time(0.0f)
 { 
+	buildChannelTable();
+}
+
+OpenMotionSequenceController::~OpenMotionSequenceController()
+{
+	releaseLayers();
+	freePoseBuffer(pose);
+	freePoseBuffer(back_pose);
+	freePoseBuffer(span_start);
+	freePoseBuffer(span_end);
+	freePoseBuffer(back_span_start);
+	freePoseBuffer(back_span_end);
+	if (owns_source && pose_source != NULL) delete pose_source;
+}
+
+// buildChannelTable() does the per-channel validity work once, when the
+// motion sequence is attached, instead of on every getValue() call.
+void OpenMotionSequenceController::buildChannelTable()
+{
+	channels.clear();
+	channel_lookup.clear();
+	channel_stride = 0;
+	root_slot[0] = root_slot[1] = root_slot[2] = -1;
+	freePoseBuffer(pose);
+	pose = NULL;
+	freePoseBuffer(back_pose);
+	back_pose = NULL;
+	freePoseBuffer(span_start);
+	freePoseBuffer(span_end);
+	freePoseBuffer(back_span_start);
+	freePoseBuffer(back_span_end);
+	span_start = span_end = back_span_start = back_span_end = NULL;
+	pose_size = 0;
+	invalidatePoses();
+	if (motion_sequence == NULL && pose_source == NULL) return;
+
+	// the clip fixes the channel order when present, since it is sampled directly
+	short max_bone = -1;
+	int num_channels = (pose_source != NULL) ? pose_source->numChannels() : motion_sequence->numChannels();
+	for (int i = 0; i < num_channels; i++)
+	{
+		CHANNEL_ID channel = (pose_source != NULL) ? pose_source->getChannel((unsigned short)i) : motion_sequence->getChannelID(i);
+		if (channel.bone_id < 0 || channel.channel_type < 0) continue;
+		channels.push_back(channel);
+		if (channel.bone_id > max_bone) max_bone = channel.bone_id;
+		if (channel.channel_type >= channel_stride) channel_stride = short(channel.channel_type + 1);
+	}
+
+	channel_lookup.assign((max_bone + 1) * channel_stride, -1);
+	for (unsigned short i = 0; i < channels.size(); i++)
+	{
+		channel_lookup[channels[i].bone_id * channel_stride + channels[i].channel_type] = i;
+		if (channels[i].bone_id == 0)
+		{
+			if (channels[i].channel_type == CT_TX) root_slot[0] = i;
+			else if (channels[i].channel_type == CT_TY) root_slot[1] = i;
+			else if (channels[i].channel_type == CT_TZ) root_slot[2] = i;
+		}
+	}
+	pose_size = (pose_source != NULL) ? pose_source->getStride() : paddedPoseSize((unsigned int)channels.size());
+	pose = allocatePoseBuffer(pose_size);
+	for (unsigned int i = 0; i < pose_size; i++) pose[i] = 0.0f;
 }
 
 bool OpenMotionSequenceController::isValidChannel(CHANNEL_ID _channel, float _time)
 {	
-	if (motion_sequence == NULL) 
+	if (motion_sequence == NULL && pose_source == NULL) 
 	{
 		throw AnimationException("OpenMotionSequenceController has no attached MotionSequence");
 		return false;
 	}
-	return motion_sequence->isValidChannel(_channel);
+	return channelIndex(_channel) >= 0;
 }
 
-float OpenMotionSequenceController::getValue(CHANNEL_ID _channel, float _time)
+void OpenMotionSequenceController::samplePose(float _time)
+{
+	if (motion_sequence == NULL && pose_source == NULL) 
+		throw AnimationException("OpenMotionSequenceController has no attached MotionSequence");
+
+	pose_time = _time;
+	pose_valid = true;
+	sampleInto(_time, pose, layer_pose, sequence_time, sequence_frame);
+}
+
+void OpenMotionSequenceController::preparePose(float _time)
 {
-	if (motion_sequence == NULL) 
+	if (motion_sequence == NULL && pose_source == NULL) 
 		throw AnimationException("OpenMotionSequenceController has no attached MotionSequence");
 
-	if (!isValidChannel(_channel, _time)) 
+	if (back_pose == NULL)
 	{
-		string s = string("OpenMotionSequenceController received request for invalid channel ") 
-			+ " bone: " + toString(_channel.bone_id) + " dof: " + toString(_channel.channel_type);
-		throw AnimationException(s.c_str());
+		back_pose = allocatePoseBuffer(pose_size);
+		for (unsigned int i = 0; i < pose_size; i++) back_pose[i] = 0.0f;
+	}
+	back_time = _time;
+	sampleInto(_time, back_pose, back_layer_pose, back_sequence_time, back_sequence_frame);
+	back_valid = true;
+}
+
+bool OpenMotionSequenceController::swapPose()
+{
+	if (!back_valid) return false;
+	swap(pose, back_pose);
+	pose_time = back_time;
+	sequence_time = back_sequence_time;
+	sequence_frame = back_sequence_frame;
+	pose_valid = true;
+	back_valid = false;
+	swap(span_start, back_span_start);
+	swap(span_end, back_span_end);
+	span_valid = back_span_valid;
+	span_start_time = back_time;
+	span_end_time = back_span_end_time;
+	back_span_valid = false;
+	return true;
+}
+
+bool OpenMotionSequenceController::sampleSpanEnd(float _end_time, float _start_sequence_time, float* _end, float* _layer_pose)
+{
+	float end_sequence_time;
+	long end_sequence_frame;
+	sampleInto(_end_time, _end, _layer_pose, end_sequence_time, end_sequence_frame);
+	// blending across the loop point would slide the root back over the clip
+	return end_sequence_time >= _start_sequence_time;
+}
+
+void OpenMotionSequenceController::sampleSpan(float _time, float _end_time)
+{
+	samplePose(_time);
+	span_valid = false;
+	if (pose_source == NULL || _end_time <= _time) return;
+
+	buildAnglePeriods();
+	if (span_start == NULL)
+	{
+		span_start = allocatePoseBuffer(pose_size);
+		span_end = allocatePoseBuffer(pose_size);
 	}
+	if (layer_pose == NULL) layer_pose = allocatePoseBuffer(pose_size);
+	copyPose(pose, span_start, pose_size);
+	span_valid = sampleSpanEnd(_end_time, sequence_time, span_end, layer_pose);
+	span_start_time = _time;
+	span_end_time = _end_time;
+}
 
-	float duration = motion_sequence->getDuration();
-	long cycles = long(_time / duration);
+void OpenMotionSequenceController::prepareSpan(float _time, float _end_time)
+{
+	preparePose(_time);
+	back_span_valid = false;
+	if (pose_source == NULL || _end_time <= _time) return;
+
+	buildAnglePeriods();
+	if (back_span_start == NULL)
+	{
+		back_span_start = allocatePoseBuffer(pose_size);
+		back_span_end = allocatePoseBuffer(pose_size);
+	}
+	if (back_layer_pose == NULL) back_layer_pose = allocatePoseBuffer(pose_size);
+	copyPose(back_pose, back_span_start, pose_size);
+	back_span_valid = sampleSpanEnd(_end_time, back_sequence_time, back_span_end, back_layer_pose);
+	back_span_end_time = _end_time;
+}
+
+bool OpenMotionSequenceController::blendSpan(float _time)
+{
+	if (!span_valid || _time < span_start_time || _time > span_end_time) return false;
+	float t = (_time - span_start_time) / (span_end_time - span_start_time);
+	blendPose(span_start, span_end, angle_periods, angle_inverse_periods, t, pose, pose_size);
+	pose_time = _time;
+	pose_valid = true;
+	return true;
+}
+
+// locateFrame() loops _time over a clip of _duration seconds and
+// _num_frames frames, and returns the frame it falls in
+static long locateFrame(float _time, float _duration, long _num_frames, float& _sequence_time, float& _frame_position)
+{
+	long cycles = long(_time / _duration);
 	
-	sequence_time = _time - duration*cycles;
-	if (sequence_time > duration) sequence_time = 0.0f;
+	_sequence_time = _time - _duration*cycles;
+	if (_sequence_time > _duration) _sequence_time = 0.0f;
+
+	_frame_position = _num_frames*_sequence_time/_duration;
+	long frame = long(_frame_position);
+	if (frame >= _num_frames) frame = _num_frames - 1;
+	return frame;
+}
+
+void OpenMotionSequenceController::sampleSource(PoseSource* _source, float _time, float* _pose, float& _sequence_time, long& _sequence_frame)
+{
+	float frame_position;
+	_sequence_frame = locateFrame(_time, _source->getDuration(), _source->numFrames(), _sequence_time, frame_position);
+	if (interpolate)
+		_source->sampleBlend(_sequence_frame, frame_position - _sequence_frame, _pose);
+	else
+		_source->sampleFrame(_sequence_frame, _pose);
+}
+
+void OpenMotionSequenceController::sampleInto(float _time, float* _pose, float* _layer_pose, float& _sequence_time, long& _sequence_frame)
+{
+	// the topmost override layer at full weight hides everything beneath it
+	short first_layer = -1;
+	for (unsigned short l = 0; l < layers.size(); l++)
+		if (layers[l].mode == BLEND_OVERRIDE && layers[l].weightAt(_time) >= 1.0f) first_layer = (short)l;
+
+	if (pose_source == NULL)
+	{
+		float frame_position;
+		_sequence_frame = locateFrame(_time + time_offset, motion_sequence->getDuration(), motion_sequence->numFrames(), _sequence_time, frame_position);
+		for (unsigned short i = 0; i < channels.size(); i++)
+			_pose[i] = motion_sequence->getValue(channels[i], _sequence_frame);
+	}
+	else if (first_layer < 0)
+		sampleSource(pose_source, _time + time_offset, _pose, _sequence_time, _sequence_frame);
+	else
+	{
+		// the clip's own time and frame are still reported
+		float frame_position;
+		_sequence_frame = locateFrame(_time + time_offset, pose_source->getDuration(), pose_source->numFrames(), _sequence_time, frame_position);
+	}
+
+	for (unsigned short l = (unsigned short)max(first_layer, (short)0); l < layers.size(); l++)
+	{
+		BlendLayer& layer = layers[l];
+		float weight = layer.weightAt(_time);
+		if (weight <= 0.0f) continue;
+		float layer_time;
+		long layer_frame;
+		if ((short)l == first_layer)
+		{
+			sampleSource(layer.source, _time + layer.time_offset, _pose, layer_time, layer_frame);
+			continue;
+		}
+		sampleSource(layer.source, _time + layer.time_offset, _layer_pose, layer_time, layer_frame);
+		if (layer.mode == BLEND_OVERRIDE)
+			blendPose(_pose, _layer_pose, angle_periods, angle_inverse_periods, weight, _pose, pose_size);
+		else
+			addPose(_pose, _layer_pose, layer_references + layer.reference * pose_size, weight, _pose, pose_size);
+	}
+
+	if (root_slot[0] >= 0) _pose[root_slot[0]] += root_offset.x;
+	if (root_slot[1] >= 0) _pose[root_slot[1]] += root_offset.y;
+	if (root_slot[2] >= 0) _pose[root_slot[2]] += root_offset.z;
+}
+
+void OpenMotionSequenceController::reserveLayers(unsigned short _max_layers)
+{
+	if (pose_source == NULL || _max_layers <= max_layers) return;
+
+	if (layer_pose == NULL) layer_pose = allocatePoseBuffer(pose_size);
+	if (back_layer_pose == NULL) back_layer_pose = allocatePoseBuffer(pose_size);
+	buildAnglePeriods();
+
+	// moved to a larger buffer; the reference poses in use are copied
+	// over at the same slots, so their layers still find them
+	float* references = allocatePoseBuffer(size_t(_max_layers) * pose_size);
+	if (layer_references != NULL) copyPose(layer_references, references, max_layers * pose_size);
+	freePoseBuffer(layer_references);
+	layer_references = references;
+	free_references.reserve(_max_layers);
+	for (unsigned short r = max_layers; r < _max_layers; r++) free_references.push_back((short)r);
+	layers.reserve(_max_layers);
+	max_layers = _max_layers;
+}
+
+void OpenMotionSequenceController::buildAnglePeriods()
+{
+	if (angle_periods != NULL || pose_source == NULL) return;
+	angle_periods = allocatePoseBuffer(pose_size);
+	angle_inverse_periods = allocatePoseBuffer(pose_size);
+	float turn = pose_source->rotationsInDegrees() ? 360.0f : 2.0f * 3.14159265f;
+	for (unsigned int i = 0; i < pose_size; i++)
+	{
+		bool rotation = (i < channels.size()) && (channels[i].channel_type == CT_RX
+			|| channels[i].channel_type == CT_RY || channels[i].channel_type == CT_RZ);
+		angle_periods[i] = rotation ? turn : 0.0f;
+		angle_inverse_periods[i] = rotation ? 1.0f / turn : 0.0f;
+	}
+}
+
+void OpenMotionSequenceController::releaseLayers()
+{
+	while (!layers.empty()) removeLayer((unsigned short)(layers.size() - 1));
+	freePoseBuffer(layer_pose);
+	freePoseBuffer(back_layer_pose);
+	freePoseBuffer(layer_references);
+	freePoseBuffer(angle_periods);
+	freePoseBuffer(angle_inverse_periods);
+	layer_pose = back_layer_pose = layer_references = angle_periods = angle_inverse_periods = NULL;
+	free_references.clear();
+	max_layers = 0;
+}
+
+// a layer's clip is mixed slot by slot into the pose buffer, so it must
+// lay its channels out exactly as the controller's clip does
+bool OpenMotionSequenceController::matchesChannels(PoseSource* _source)
+{
+	if (_source == NULL || pose_source == NULL) return false;
+	if (_source->numChannels() != pose_source->numChannels() || _source->getStride() != pose_size
+		|| _source->rotationsInDegrees() != pose_source->rotationsInDegrees()) return false;
+	for (unsigned short i = 0; i < _source->numChannels(); i++)
+	{
+		CHANNEL_ID a = _source->getChannel(i), b = pose_source->getChannel(i);
+		if (a.bone_id != b.bone_id || a.channel_type != b.channel_type) return false;
+	}
+	return true;
+}
+
+short OpenMotionSequenceController::addLayer(PoseSource* _source, BLEND_MODE _mode, float _weight, float _time_offset, bool _owns_source)
+{
+	if (layers.size() >= max_layers || !matchesChannels(_source)) return -1;
+
+	BlendLayer layer;
+	layer.source = _source;
+	layer.owns_source = _owns_source;
+	layer.mode = _mode;
+	layer.time_offset = _time_offset;
+	layer.from_weight = layer.to_weight = _weight;
+	layer.fade_start = layer.fade_end = 0.0f;
+	layer.crossfade = false;
+	layer.reference = -1;
+	if (_mode == BLEND_ADDITIVE)
+	{
+		layer.reference = free_references.back();
+		free_references.pop_back();
+		_source->sampleFrame(0, layer_references + layer.reference * pose_size);
+	}
+	layers.push_back(layer);
+	invalidatePoses();
+	return (short)(layers.size() - 1);
+}
+
+void OpenMotionSequenceController::fadeLayer(unsigned short _layer, float _weight, float _start_time, float _duration)
+{
+	if (_layer >= layers.size()) return;
+	BlendLayer& layer = layers[_layer];
+	layer.from_weight = layer.weightAt(_start_time);
+	layer.to_weight = _weight;
+	layer.fade_start = _start_time;
+	layer.fade_end = _start_time + max(_duration, 0.0f);
+	invalidatePoses();
+}
+
+bool OpenMotionSequenceController::crossfadeTo(PoseSource* _source, float _start_time, float _duration, float _time_offset, bool _owns_source)
+{
+	if (layers.size() >= max_layers || !matchesChannels(_source)) return false;
 
-	int frame = int(motion_sequence->numFrames()*sequence_time/duration);
-	sequence_frame = frame;
+	// above the override layers, beneath the additive ones
+	unsigned short position = 0;
+	for (unsigned short l = 0; l < layers.size(); l++)
+		if (layers[l].mode == BLEND_OVERRIDE) position = (unsigned short)(l + 1);
 
-	float value = motion_sequence->getValue(_channel, frame);
+	BlendLayer layer;
+	layer.source = _source;
+	layer.owns_source = _owns_source;
+	layer.mode = BLEND_OVERRIDE;
+	layer.time_offset = _time_offset;
+	layer.from_weight = 0.0f;
+	layer.to_weight = 1.0f;
+	layer.fade_start = _start_time;
+	layer.fade_end = _start_time + max(_duration, 0.0f);
+	layer.crossfade = true;
+	layer.reference = -1;
+	// within the reserved capacity, so nothing is allocated
+	layers.insert(layers.begin() + position, layer);
+	invalidatePoses();
+	return true;
+}
+
+bool OpenMotionSequenceController::isCrossfading()
+{
+	for (unsigned short l = 0; l < layers.size(); l++)
+		if (layers[l].crossfade) return true;
+	return false;
+}
+
+PoseSource* OpenMotionSequenceController::dominantSource(long& _frame)
+{
+	_frame = sequence_frame;
+	// each override layer takes its weight's share of what lies beneath it
+	float share = 0.0f, beneath = 1.0f;
+	short dominant = -1;
+	for (unsigned short l = (unsigned short)layers.size(); l-- > 0; )
+	{
+		if (layers[l].mode != BLEND_OVERRIDE) continue;
+		float weight = layers[l].weightAt(pose_time);
+		if (beneath * weight > share) { share = beneath * weight; dominant = (short)l; }
+		beneath *= 1.0f - weight;
+	}
+	if (dominant < 0 || beneath >= share) return pose_source;
+
+	BlendLayer& layer = layers[dominant];
+	float layer_time, frame_position;
+	_frame = locateFrame(pose_time + layer.time_offset, layer.source->getDuration(), layer.source->numFrames(), layer_time, frame_position);
+	return layer.source;
+}
+
+void OpenMotionSequenceController::removeLayer(unsigned short _layer)
+{
+	BlendLayer& layer = layers[_layer];
+	if (layer.owns_source && layer.source != NULL) delete layer.source;
+	if (layer.reference >= 0) free_references.push_back(layer.reference);
+	layers.erase(layers.begin() + _layer);
+}
+
+bool OpenMotionSequenceController::settleLayers(float _time)
+{
+	if (layers.empty()) return false;
+	unsigned int num_layers = (unsigned int)layers.size();
+
+	// the topmost finished crossfade covers every layer beneath it
+	short finished = -1;
+	for (unsigned short l = 0; l < layers.size(); l++)
+		if (layers[l].crossfade && _time >= layers[l].fade_end && layers[l].to_weight >= 1.0f) finished = (short)l;
+	if (finished >= 0)
+	{
+		BlendLayer& layer = layers[finished];
+		if (owns_source && pose_source != NULL) delete pose_source;
+		pose_source = layer.source;
+		owns_source = layer.owns_source;
+		time_offset = layer.time_offset;
+		layer.owns_source = false;
+		for (short l = finished; l >= 0; l--) removeLayer((unsigned short)l);
+	}
+
+	for (unsigned short l = (unsigned short)layers.size(); l-- > 0; )
+		if (_time >= layers[l].fade_end && layers[l].to_weight <= 0.0f) removeLayer(l);
+
+	if (layers.size() != num_layers) invalidatePoses();
+	return finished >= 0;
+}
+
+float OpenMotionSequenceController::getValue(CHANNEL_ID _channel, float _time)
+{
+	if (!pose_valid || _time != pose_time) samplePose(_time);
+
+	short slot = channelIndex(_channel);
+	if (slot < 0) 
+	{
+		string s = string("OpenMotionSequenceController received request for invalid channel ") 
+			+ " bone: " + toString(_channel.bone_id) + " dof: " + toString(_channel.channel_type);
+		throw AnimationException(s.c_str());
+	}
 
-	return value;
+	return pose[slot];
 }
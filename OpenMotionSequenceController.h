@@ -15,30 +15,154 @@
 #ifndef OPENMOTIONSEQUENCECONTROLLER_DOT_H
 #define OPENMOTIONSEQUENCECONTROLLER_DOT_H
 #include <Core/SystemConfiguration.h>
+#include <vector>
+using namespace std;
 #include <Core/Array2D.h>
 #include <Math/Matrix4x4.h>
+#include <Math/Vector3D.h>
 #include <Animation/MotionController.h>
 #include <Animation/MotionSequence.h>
 
+class PoseSource;
+
+// How a blend layer combines with the pose beneath it: an override layer
+// blends toward its clip's pose by its weight, an additive layer adds its
+// clip's change from the clip's first frame, scaled by its weight.
+enum BLEND_MODE { BLEND_OVERRIDE, BLEND_ADDITIVE };
+
 class OpenMotionSequenceController : public MotionController
 {
 public:
 	OpenMotionSequenceController() 
-		: MotionController(), motion_sequence(NULL), sequence_time(0.0f), sequence_frame(0)
-	{ }
+		: MotionController(), motion_sequence(NULL), pose_source(NULL), owns_source(false), interpolate(false),
+		sequence_time(0.0f), sequence_frame(0),
+		time_offset(0.0f), root_offset(0.0f, 0.0f, 0.0f),
+		channel_stride(0), pose(NULL), pose_size(0), pose_valid(false), pose_time(0.0f),
+		back_pose(NULL), back_valid(false), back_time(0.0f), back_sequence_time(0.0f), back_sequence_frame(0),
+		max_layers(0), layer_pose(NULL), back_layer_pose(NULL), layer_references(NULL), angle_periods(NULL), angle_inverse_periods(NULL),
+		span_start(NULL), span_end(NULL), span_valid(false), span_start_time(0.0f), span_end_time(0.0f),
+		back_span_start(NULL), back_span_end(NULL), back_span_valid(false), back_span_end_time(0.0f)
+	{ buildChannelTable(); }
 
-	OpenMotionSequenceController(MotionSequence* _ms);
+	// _source, if given, must hold the same motion as _ms (which may then
+	// be NULL); it is sampled instead of _ms, which enables interpolated
+	// playback. With _owns_source the controller deletes it.
+	OpenMotionSequenceController(MotionSequence* _ms, PoseSource* _source = NULL, bool _owns_source = false);
 	
-	virtual ~OpenMotionSequenceController() { }
+	virtual ~OpenMotionSequenceController();
 
 	virtual bool isValidChannel(CHANNEL_ID _channel, float _time);
 
+	// getValue() answers from the sampled pose. A call with a new _time
+	// samples the whole pose for that time first.
 	virtual float getValue(CHANNEL_ID _channel, float _time);
 
+	// samplePose() resolves _time to a sequence frame once and fills the
+	// pose buffer with every channel's value for that frame. With
+	// interpolation on, the two neighbouring frames are blended instead.
+	void samplePose(float _time);
+
+	// Double buffering, for sampling the next pose on another thread while
+	// this one is still in use: preparePose() samples _time into a back
+	// buffer, touching nothing getValue() reads, and swapPose() makes it
+	// the current pose. swapPose() returns false if nothing was prepared.
+	void preparePose(float _time);
+	bool swapPose();
+	// (unwarped) time of the current pose
+	float getPoseTime() { return pose_time; }
+	// true if the pose buffer already holds _time's pose
+	bool hasPose(float _time) { return pose_valid && pose_time == _time; }
+
+	// Spans, for characters posed at a reduced rate: sampleSpan() samples
+	// _time as samplePose() does, and _end_time as the span's end, and
+	// blendSpan() then fills the pose buffer for a time in between by
+	// blending from the pose sampled at _time toward the end, with no
+	// sampling. prepareSpan() is sampleSpan() into the back buffers, which
+	// swapPose() installs along with the pose. A span needs a PoseSource,
+	// and is dropped if the clip loops within it; blendSpan() returns false
+	// when no span holds _time.
+	void sampleSpan(float _time, float _end_time);
+	void prepareSpan(float _time, float _end_time);
+	bool blendSpan(float _time);
+
+	// Interpolation blends adjacent frames, for smooth playback under slow
+	// time warps. It needs a PoseSource; without one, frames are snapped.
+	void setInterpolation(bool _interpolate) { interpolate = _interpolate; invalidatePoses(); }
+	bool isInterpolating() { return interpolate && (pose_source != NULL); }
+
+	// The pose buffer holds one value per channel, in the order of the
+	// motion sequence's channels, padded and aligned for SIMD use.
+	// It is valid after samplePose().
+	const float* getPose() { return pose; }
+	unsigned short numChannels() { return (unsigned short)channels.size(); }
+	CHANNEL_ID getChannel(unsigned short _index) { return channels[_index]; }
+	// position of _channel in the pose buffer, or -1 if it has no data
+	short channelIndex(CHANNEL_ID _channel)
+	{
+		if (_channel.bone_id < 0 || _channel.channel_type < 0 || _channel.channel_type >= channel_stride) return -1;
+		unsigned int slot = _channel.bone_id * channel_stride + _channel.channel_type;
+		if (slot >= channel_lookup.size()) return -1;
+		return channel_lookup[slot];
+	}
+
+	// root translation of the current pose (with the root offset), or the
+	// root offset alone if the clip has no root translation
+	Vector3D getRootPosition()
+	{
+		Vector3D position = root_offset;
+		if (root_slot[0] >= 0) position.x = pose[root_slot[0]];
+		if (root_slot[1] >= 0) position.y = pose[root_slot[1]];
+		if (root_slot[2] >= 0) position.z = pose[root_slot[2]];
+		return position;
+	}
+
 	MotionSequence* getMotionSequence() { return motion_sequence; }
+	PoseSource* getPoseSource() { return pose_source; }
+
+	// Per-instance placement, so many controllers can share one read-only
+	// MotionSequence. The time offset shifts where in the clip this
+	// instance plays; the root offset is added to the root translation.
+	void setTimeOffset(float _offset) { time_offset = _offset; invalidatePoses(); }
+	float getTimeOffset() { return time_offset; }
+	void setRootOffset(const Vector3D& _offset) { root_offset = _offset; invalidatePoses(); }
+	Vector3D getRootOffset() { return root_offset; }
+
+	// Blend layers are further clips, sampled along with the controller's
+	// own and mixed into its pose in order, each by a weight that can fade
+	// over controller time. Their clips must have the same channels as the
+	// controller's PoseSource. reserveLayers() allocates everything up to
+	// _max_layers layers need, so that adding, fading, sampling and
+	// retiring layers afterwards do no heap allocation.
+	void reserveLayers(unsigned short _max_layers);
+	// addLayer() returns the new layer's index, or -1 if the layers are
+	// full or _source does not match. _time_offset places the layer's clip
+	// as setTimeOffset() does the controller's; with _owns_source the
+	// controller deletes _source.
+	short addLayer(PoseSource* _source, BLEND_MODE _mode, float _weight, float _time_offset = 0.0f, bool _owns_source = false);
+	// fadeLayer() ramps _layer's weight from its value at _start_time to
+	// _weight, over _duration seconds
+	void fadeLayer(unsigned short _layer, float _weight, float _start_time, float _duration);
+	unsigned short numLayers() { return (unsigned short)layers.size(); }
+	// crossfadeTo() fades from the current motion (an earlier crossfade
+	// included) to _source over _duration seconds from _start_time.
+	// Additive layers stay on top of it. Once settleLayers() sees the fade
+	// finished, _source replaces the controller's PoseSource. Returns false
+	// if _source could not be added as a layer.
+	bool crossfadeTo(PoseSource* _source, float _start_time, float _duration, float _time_offset = 0.0f, bool _owns_source = false);
+	bool isCrossfading();
+	// dominantSource() returns the clip the current pose takes most from
+	// (the controller's own or an override layer's, by their weights at the
+	// pose's time) and sets _frame to the frame of it the pose is from
+	PoseSource* dominantSource(long& _frame);
+	// settleLayers() retires the layers whose fades are over at _time: a
+	// finished crossfade becomes the controller's clip, dropping the layers
+	// it covers, and layers faded out are removed. Sampling never changes
+	// the layers, so preparePose() may run on another thread; call this in
+	// between. Returns true if the controller's clip changed.
+	bool settleLayers(float _time);
 	
 	// Functions to access the controller's internal perception of time.
-	// This values are both based on state after the last call to getValue().
+	// This values are both based on state after the last call to samplePose().
 	// Sequence time is the time within a loop over the motion sequence that
 	//   the controller is using.
 	// Sequence frame is the actual frame in the motion sequence that was
@@ -48,11 +172,104 @@ public:
 
 private:
 	MotionSequence* motion_sequence;
+	PoseSource* pose_source;
+	bool owns_source;
+	bool interpolate;
 
-	// these two attributes record state at the last call to getValue()
+	// these two attributes record state at the last call to samplePose()
 	float sequence_time;	// current (local) time
 	long sequence_frame;		// frame accessed for current time
 
+	// per-instance placement
+	float time_offset;
+	Vector3D root_offset;
+
+	// Channel table, built once when the motion sequence is attached.
+	// channel_lookup maps bone_id*channel_stride+channel_type to a pose slot.
+	vector<CHANNEL_ID> channels;
+	vector<short> channel_lookup;
+	short channel_stride;
+	// pose slots of the root translation channels (-1 if absent)
+	short root_slot[3];
+
+	// sampled pose and the (unwarped) time it was sampled at
+	float* pose;
+	unsigned int pose_size;
+	bool pose_valid;
+	float pose_time;
+
+	// pose prepared by preparePose(), with the state that goes with it
+	float* back_pose;
+	bool back_valid;
+	float back_time;
+	float back_sequence_time;
+	long back_sequence_frame;
+
+	// blend layers, in the order they apply; capacity max_layers
+	struct BlendLayer {
+		PoseSource* source;
+		bool owns_source;
+		BLEND_MODE mode;
+		float time_offset;
+		// weight ramp: from_weight until fade_start, to_weight after fade_end
+		float from_weight;
+		float to_weight;
+		float fade_start;
+		float fade_end;
+		// set on a crossfade's layer, which replaces the clip when it ends
+		bool crossfade;
+		// slot in layer_references of an additive layer's first frame
+		short reference;
+		float weightAt(float _time)
+		{
+			if (_time >= fade_end) return to_weight;
+			if (_time <= fade_start) return from_weight;
+			return from_weight + (to_weight - from_weight) * (_time - fade_start) / (fade_end - fade_start);
+		}
+	};
+	vector<BlendLayer> layers;
+	unsigned short max_layers;
+	// scratch for sampling a layer, one per pose buffer so that sampling
+	// the current and back poses can overlap
+	float* layer_pose;
+	float* back_layer_pose;
+	// max_layers reference poses, and which of them are free
+	float* layer_references;
+	vector<short> free_references;
+	// per pose slot: a full turn for rotation channels, 0 for the others
+	float* angle_periods;
+	float* angle_inverse_periods;
+
+	// span poses (see sampleSpan()): the current span's start and end, and
+	// the back buffers' span, whose start is back_pose's time
+	float* span_start;
+	float* span_end;
+	bool span_valid;
+	float span_start_time;
+	float span_end_time;
+	float* back_span_start;
+	float* back_span_end;
+	bool back_span_valid;
+	float back_span_end_time;
+
+	void buildChannelTable();
+	// every sampled, prepared and span pose is stale
+	void invalidatePoses() { pose_valid = back_valid = span_valid = back_span_valid = false; }
+	// fills angle_periods and angle_inverse_periods, once
+	void buildAnglePeriods();
+	void releaseLayers();
+	bool matchesChannels(PoseSource* _source);
+	void removeLayer(unsigned short _layer);
+	// sampleSource() loops _time over _source and samples it into _pose
+	void sampleSource(PoseSource* _source, float _time, float* _pose, float& _sequence_time, long& _sequence_frame);
+	void sampleInto(float _time, float* _pose, float* _layer_pose, float& _sequence_time, long& _sequence_frame);
+	// samples a span's end at _end_time into _end; false if the clip loops
+	// between _start_sequence_time (the start's) and there
+	bool sampleSpanEnd(float _end_time, float _start_sequence_time, float* _end, float* _layer_pose);
+
+	// no copying; the pose buffer is owned
+	OpenMotionSequenceController(const OpenMotionSequenceController&);
+	OpenMotionSequenceController& operator=(const OpenMotionSequenceController&);
 };
 
 #endif // OPENMOTIONSEQUENCECONTROLLER_DOT_H
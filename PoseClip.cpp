@@ -0,0 +1,117 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// PoseClip.cpp
+//    Flat, read-only copy of a MotionSequence laid out for fast sampling.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cmath>
+// local application
+#include "PoseClip.h"
+#include "PoseMath.h"
+
+static bool isRotationChannel(const CHANNEL_ID& _channel)
+{
+	return (_channel.channel_type == CT_RX) || (_channel.channel_type == CT_RY) || (_channel.channel_type == CT_RZ);
+}
+
+static bool isRootTranslationChannel(const CHANNEL_ID& _channel)
+{
+	return (_channel.bone_id == 0) &&
+		((_channel.channel_type == CT_TX) || (_channel.channel_type == CT_TY) || (_channel.channel_type == CT_TZ));
+}
+
+// shift _value by whole turns so it lies within half a turn of _reference
+static float unwrapAngle(float _value, float _reference, float _period)
+{
+	return _value - _period * floor((_value - _reference) / _period + 0.5f);
+}
+
+PoseClip::PoseClip()
+	: num_frames(0), duration(0.0f), stride(0), degrees(true), frames(NULL), owned_frames(NULL)
+{ }
+
+PoseClip::~PoseClip()
+{
+	release();
+}
+
+void PoseClip::release()
+{
+	freePoseBuffer(owned_frames);
+	owned_frames = NULL;
+	frames = NULL;
+	channels.clear();
+	num_frames = 0;
+}
+
+void PoseClip::attach(const vector<CHANNEL_ID>& _channels, long _num_frames, float _duration,
+	unsigned int _stride, bool _degrees, const float* _frames)
+{
+	release();
+	channels = _channels;
+	num_frames = _num_frames;
+	duration = _duration;
+	stride = _stride;
+	degrees = _degrees;
+	frames = _frames;
+}
+
+bool PoseClip::build(MotionSequence* _ms, bool _degrees)
+{
+	release();
+	if (_ms == NULL) return false;
+
+	int num_channels = _ms->numChannels();
+	for (int i = 0; i < num_channels; i++)
+	{
+		CHANNEL_ID channel = _ms->getChannelID(i);
+		if (channel.bone_id >= 0 && channel.channel_type >= 0) channels.push_back(channel);
+	}
+	num_frames = _ms->numFrames();
+	duration = _ms->getDuration();
+	if (channels.empty() || num_frames <= 0) { num_frames = 0; return false; }
+
+	stride = paddedPoseSize((unsigned int)channels.size());
+	owned_frames = allocatePoseBuffer(size_t(num_frames + 1) * stride);
+	frames = owned_frames;
+	for (long i = 0; i < (num_frames + 1) * long(stride); i++) owned_frames[i] = 0.0f;
+
+	for (unsigned short c = 0; c < channels.size(); c++)
+		for (long f = 0; f < num_frames; f++) owned_frames[f * stride + c] = _ms->getValue(channels[c], f);
+	degrees = _degrees;
+	float period = degrees ? 360.0f : 2.0f * 3.14159265f;
+
+	float* loop_row = owned_frames + num_frames * stride;
+	float* last_row = owned_frames + (num_frames - 1) * stride;
+	for (unsigned short c = 0; c < channels.size(); c++)
+	{
+		if (isRotationChannel(channels[c]))
+		{
+			for (long f = 1; f < num_frames; f++)
+				owned_frames[f * stride + c] = unwrapAngle(owned_frames[f * stride + c], owned_frames[(f - 1) * stride + c], period);
+			loop_row[c] = unwrapAngle(owned_frames[c], last_row[c], period);
+		}
+		else if (isRootTranslationChannel(channels[c]))
+			loop_row[c] = last_row[c];
+		else
+			loop_row[c] = owned_frames[c];
+	}
+	return true;
+}
+
+void PoseClip::sampleFrame(long _frame, float* _pose)
+{
+	if (_frame < 0) _frame = 0;
+	if (_frame >= num_frames) _frame = num_frames - 1;
+	copyPose(getFrame(_frame), _pose, stride);
+}
+
+void PoseClip::sampleBlend(long _frame, float _alpha, float* _pose)
+{
+	if (_frame < 0) { _frame = 0; _alpha = 0.0f; }
+	if (_frame >= num_frames) { _frame = num_frames - 1; _alpha = 1.0f; }
+	lerpPose(getFrame(_frame), getFrame(_frame + 1), _alpha, _pose, stride);
+}
@@ -0,0 +1,83 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// PoseClip.h
+//    Flat, read-only copy of a MotionSequence laid out for fast sampling.
+//    Every frame is one padded, aligned row holding all channel values,
+//    so a whole pose is read, or blended between two frames, with a few
+//    SIMD loads instead of one lookup per channel.
+//-----------------------------------------------------------------------------
+#ifndef POSECLIP_DOT_H
+#define POSECLIP_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <vector>
+using namespace std;
+// SKA modules
+#include <Animation/MotionSequence.h>
+// local application
+#include "PoseSource.h"
+
+class PoseClip : public PoseSource
+{
+public:
+	PoseClip();
+	~PoseClip();
+
+	// build() copies all channels of _ms. Rotation channels are unwrapped
+	// so consecutive frames never differ by more than half a turn, which
+	// makes a plain lerp between neighbouring frames take the short way.
+	// _degrees gives the units of the rotation channels, which come from
+	// the file format rather than the data. Returns false if _ms has no
+	// frames or channels.
+	bool build(MotionSequence* _ms, bool _degrees);
+
+	// attach() makes the clip read frame rows stored elsewhere, such as a
+	// memory-mapped cache file, in place of its own copy. _frames holds
+	// _num_frames+1 rows of _stride floats (the last being the loop row),
+	// is POSE_ALIGNMENT aligned, and must outlive the clip.
+	void attach(const vector<CHANNEL_ID>& _channels, long _num_frames, float _duration,
+		unsigned int _stride, bool _degrees, const float* _frames);
+
+	long numFrames() { return num_frames; }
+	float getDuration() { return duration; }
+	unsigned short numChannels() { return (unsigned short)channels.size(); }
+	CHANNEL_ID getChannel(unsigned short _index) { return channels[_index]; }
+	// floats per frame row, a multiple of POSE_LANES
+	unsigned int getStride() { return stride; }
+	// bytes of frame data, including the loop row
+	size_t frameBytes() { return size_t(num_frames + 1) * stride * sizeof(float); }
+	const vector<CHANNEL_ID>& getChannels() { return channels; }
+	// true if rotation channels are in degrees rather than radians
+	bool rotationsInDegrees() { return degrees; }
+	// true if the frame rows live outside the clip (see attach())
+	bool isAttached() { return (frames != NULL) && (owned_frames == NULL); }
+
+	// Frame rows 0..numFrames()-1 hold the clip. Row numFrames() is the
+	// loop row: frame 0 unwrapped against the last frame, with the root
+	// translation held, so blending across the loop point does not sweep
+	// the root back to its start.
+	const float* getFrame(long _frame) { return frames + _frame * stride; }
+
+	void sampleFrame(long _frame, float* _pose);
+	void sampleBlend(long _frame, float _alpha, float* _pose);
+
+private:
+	vector<CHANNEL_ID> channels;
+	long num_frames;
+	float duration;
+	unsigned int stride;
+	bool degrees;
+	const float* frames;
+	// frame rows allocated by build(); NULL for attached clips
+	float* owned_frames;
+
+	void release();
+
+	// no copying; the frame buffer is owned
+	PoseClip(const PoseClip&);
+	PoseClip& operator=(const PoseClip&);
+};
+
+#endif // POSECLIP_DOT_H
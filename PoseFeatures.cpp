@@ -0,0 +1,303 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// PoseFeatures.cpp
+//    Pose feature vectors of clips, and the nearest-frame index over them.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+// local application
+#include "PoseFeatures.h"
+#include "BoneHierarchy.h"
+#include "PoseMath.h"
+#include "PoseSource.h"
+
+// the group each feature belongs to, in PoseFeatures' frame layout
+static const FEATURE_GROUP FEATURE_GROUPS[PoseFeatures::NUM_FEATURES] = {
+	FEATURE_FOOT_POSITIONS, FEATURE_FOOT_POSITIONS, FEATURE_FOOT_POSITIONS,
+	FEATURE_FOOT_POSITIONS, FEATURE_FOOT_POSITIONS, FEATURE_FOOT_POSITIONS,
+	FEATURE_FOOT_VELOCITIES, FEATURE_FOOT_VELOCITIES, FEATURE_FOOT_VELOCITIES,
+	FEATURE_FOOT_VELOCITIES, FEATURE_FOOT_VELOCITIES, FEATURE_FOOT_VELOCITIES,
+	FEATURE_ROOT_VELOCITY, FEATURE_ROOT_VELOCITY, FEATURE_ROOT_VELOCITY,
+	FEATURE_HAND_POSITIONS, FEATURE_HAND_POSITIONS, FEATURE_HAND_POSITIONS,
+	FEATURE_HAND_POSITIONS, FEATURE_HAND_POSITIONS, FEATURE_HAND_POSITIONS
+};
+
+// weight of each group after normalization; the hands say less about
+// where a step can be picked up than the feet and root do
+static const float FEATURE_WEIGHTS[NUM_FEATURE_GROUPS] = { 1.0f, 1.0f, 1.0f, 0.5f };
+
+// tracked bones: feet (toes if the skeleton has them), then hands
+enum TRACKED_BONE { LEFT_FOOT_BONE, RIGHT_FOOT_BONE, LEFT_HAND_BONE, RIGHT_HAND_BONE, NUM_TRACKED_BONES };
+
+static short findTrackedBone(BoneHierarchy& _hierarchy, const char* _name, const char* _fallback)
+{
+	short bone = _hierarchy.resolveBone(_name);
+	if (bone < 0 && _fallback != NULL) bone = _hierarchy.resolveBone(_fallback);
+	return bone;
+}
+
+// _v turned about the vertical by the heading with sine _s and cosine _c
+// taken off, so that the heading's direction becomes +z
+static void intoHeading(const float* _v, float _s, float _c, float* _out)
+{
+	_out[0] = _c * _v[0] - _s * _v[2];
+	_out[1] = _v[1];
+	_out[2] = _s * _v[0] + _c * _v[2];
+}
+
+bool PoseFeatures::extract(BoneHierarchy& _hierarchy, PoseSource* _source)
+{
+	values.clear();
+	num_frames = 0;
+
+	short tracked[NUM_TRACKED_BONES] = {
+		findTrackedBone(_hierarchy, "ltoes", "lfoot"), findTrackedBone(_hierarchy, "rtoes", "rfoot"),
+		findTrackedBone(_hierarchy, "lhand", NULL), findTrackedBone(_hierarchy, "rhand", NULL)
+	};
+	for (int t = 0; t < NUM_TRACKED_BONES; t++) if (tracked[t] < 0) return false;
+	long n = _source->numFrames();
+	if (n <= 0) return false;
+
+	// one forward kinematics sweep: per frame the root, then the tracked
+	// bones' ends, in world space, and the root's heading
+	const int POINTS = 1 + NUM_TRACKED_BONES;
+	vector<float> track(size_t(n) * POINTS * 3);
+	vector<float> heading(size_t(n) * 2);
+	float* pose = allocatePoseBuffer(_source->getStride());
+	vector<float> transforms(_hierarchy.numBones() * BoneHierarchy::TRANSFORM_FLOATS);
+	for (long f = 0; f < n; f++)
+	{
+		_source->sampleFrame(f, pose);
+		_hierarchy.solve(pose, &transforms[0]);
+		float* point = &track[size_t(f) * POINTS * 3];
+		for (int i = 0; i < 3; i++) point[i] = transforms[9 + i];
+		for (int t = 0; t < NUM_TRACKED_BONES; t++)
+			_hierarchy.boneEnd(&transforms[0], (unsigned short)tracked[t], point + 3 * (1 + t));
+
+		// the root's z axis, flattened onto the ground, is where it faces
+		float forward_x = transforms[2], forward_z = transforms[8];
+		float angle = (fabs(forward_x) + fabs(forward_z) > 1.0e-6f) ? atan2(forward_x, forward_z) : 0.0f;
+		heading[f * 2] = sin(angle);
+		heading[f * 2 + 1] = cos(angle);
+	}
+	freePoseBuffer(pose);
+
+	num_frames = n;
+	frame_time = _source->getDuration() / n;
+	values.assign(size_t(n) * FEATURE_STRIDE, 0.0f);
+	for (long f = 0; f < n; f++)
+	{
+		// central differences, one-sided at the ends
+		long previous = max(f - 1, 0L), next = min(f + 1, n - 1);
+		float rate = (next > previous) ? 1.0f / ((next - previous) * frame_time) : 0.0f;
+		float s = heading[f * 2], c = heading[f * 2 + 1];
+		const float* point = &track[size_t(f) * POINTS * 3];
+		const float* before = &track[size_t(previous) * POINTS * 3];
+		const float* after = &track[size_t(next) * POINTS * 3];
+		float* features = &values[size_t(f) * FEATURE_STRIDE];
+
+		float v[3];
+		for (int foot = 0; foot < 2; foot++)
+		{
+			const int p = 3 * (1 + LEFT_FOOT_BONE + foot);
+			for (int i = 0; i < 3; i++) v[i] = point[p + i] - point[i];
+			intoHeading(v, s, c, features + 3 * foot);
+			for (int i = 0; i < 3; i++) v[i] = (after[p + i] - before[p + i]) * rate;
+			intoHeading(v, s, c, features + 6 + 3 * foot);
+		}
+		for (int i = 0; i < 3; i++) v[i] = (after[i] - before[i]) * rate;
+		intoHeading(v, s, c, features + 12);
+		for (int hand = 0; hand < 2; hand++)
+		{
+			const int p = 3 * (1 + LEFT_HAND_BONE + hand);
+			for (int i = 0; i < 3; i++) v[i] = point[p + i] - point[i];
+			intoHeading(v, s, c, features + 15 + 3 * hand);
+		}
+	}
+	return true;
+}
+
+static void appendBytes(vector<char>& _data, const void* _bytes, size_t _size)
+{
+	size_t start = _data.size();
+	_data.resize(start + _size);
+	if (_size > 0) memcpy(&_data[start], _bytes, _size);
+}
+
+// Flat form: the frame count and feature stride as 32 bit integers, the
+// frame time, then the features of each frame.
+void PoseFeatures::serialize(vector<char>& _data)
+{
+	_data.clear();
+	int32_t count = (int32_t)num_frames, stride = (int32_t)FEATURE_STRIDE;
+	appendBytes(_data, &count, sizeof(count));
+	appendBytes(_data, &stride, sizeof(stride));
+	appendBytes(_data, &frame_time, sizeof(frame_time));
+	appendBytes(_data, values.empty() ? NULL : &values[0], values.size() * sizeof(float));
+}
+
+bool PoseFeatures::deserialize(const vector<char>& _data)
+{
+	values.clear();
+	num_frames = 0;
+	int32_t count, stride;
+	const size_t header = sizeof(count) + sizeof(stride) + sizeof(frame_time);
+	if (_data.size() < header) return false;
+	memcpy(&count, &_data[0], sizeof(count));
+	memcpy(&stride, &_data[sizeof(count)], sizeof(stride));
+	memcpy(&frame_time, &_data[sizeof(count) + sizeof(stride)], sizeof(frame_time));
+	if (count <= 0 || stride != (int32_t)FEATURE_STRIDE) return false;
+	if (_data.size() != header + size_t(count) * FEATURE_STRIDE * sizeof(float)) return false;
+	values.resize(size_t(count) * FEATURE_STRIDE);
+	memcpy(&values[0], &_data[header], values.size() * sizeof(float));
+	num_frames = count;
+	return true;
+}
+
+PoseFeatureIndex::PoseFeatureIndex()
+	: rows(NULL), num_rows(0), row_capacity(0), normalized(true)
+{
+	for (unsigned int i = 0; i < PoseFeatures::FEATURE_STRIDE; i++) { means[i] = 0.0f; scales[i] = 0.0f; }
+}
+
+PoseFeatureIndex::~PoseFeatureIndex()
+{
+	freePoseBuffer(rows);
+}
+
+short PoseFeatureIndex::addClip(const PoseFeatures& _features)
+{
+	IndexedClip clip;
+	clip.first_row = num_rows;
+	clip.num_frames = _features.num_frames;
+	clips.push_back(clip);
+	raw.insert(raw.end(), _features.values.begin(), _features.values.end());
+	num_rows += (unsigned long)_features.num_frames;
+	normalized = false;
+	return (short)(clips.size() - 1);
+}
+
+void PoseFeatureIndex::clear()
+{
+	clips.clear();
+	raw.clear();
+	freePoseBuffer(rows);
+	rows = NULL;
+	num_rows = 0;
+	row_capacity = 0;
+	normalized = true;
+}
+
+void PoseFeatureIndex::normalize()
+{
+	if (normalized) return;
+	const unsigned int STRIDE = PoseFeatures::FEATURE_STRIDE;
+	// per feature mean, and per group the spread around those means
+	double sums[STRIDE] = { 0.0 }, squares[STRIDE] = { 0.0 };
+	for (unsigned long r = 0; r < num_rows; r++)
+	{
+		const float* row = &raw[size_t(r) * STRIDE];
+		for (unsigned int i = 0; i < PoseFeatures::NUM_FEATURES; i++)
+		{
+			sums[i] += row[i];
+			squares[i] += double(row[i]) * row[i];
+		}
+	}
+	double group_variance[NUM_FEATURE_GROUPS] = { 0.0 };
+	unsigned int group_size[NUM_FEATURE_GROUPS] = { 0 };
+	for (unsigned int i = 0; i < PoseFeatures::NUM_FEATURES; i++)
+	{
+		double mean = (num_rows > 0) ? sums[i] / num_rows : 0.0;
+		means[i] = (float)mean;
+		if (num_rows > 0) group_variance[FEATURE_GROUPS[i]] += max(0.0, squares[i] / num_rows - mean * mean);
+		group_size[FEATURE_GROUPS[i]]++;
+	}
+	for (unsigned int i = 0; i < STRIDE; i++)
+	{
+		scales[i] = 0.0f;
+		if (i >= PoseFeatures::NUM_FEATURES) continue;
+		FEATURE_GROUP group = FEATURE_GROUPS[i];
+		double deviation = sqrt(group_variance[group] / group_size[group]);
+		// a group that never changes cannot tell frames apart
+		if (deviation > 1.0e-6) scales[i] = float(FEATURE_WEIGHTS[group] / deviation);
+	}
+
+	if (num_rows > row_capacity)
+	{
+		row_capacity = max(num_rows, 2 * row_capacity);
+		freePoseBuffer(rows);
+		rows = allocatePoseBuffer(size_t(row_capacity) * STRIDE);
+	}
+	for (unsigned long r = 0; r < num_rows; r++)
+		for (unsigned int i = 0; i < STRIDE; i++)
+			rows[size_t(r) * STRIDE + i] = (raw[size_t(r) * STRIDE + i] - means[i]) * scales[i];
+	normalized = true;
+}
+
+// squared distance between two aligned rows of FEATURE_STRIDE floats
+static float rowDistance(const float* _a, const float* _b)
+{
+	const unsigned int STRIDE = PoseFeatures::FEATURE_STRIDE;
+#if defined(POSE_SIMD_AVX)
+	__m256 sum = _mm256_setzero_ps();
+	for (unsigned int i = 0; i < STRIDE; i += 8)
+	{
+		__m256 d = _mm256_sub_ps(_mm256_load_ps(_a + i), _mm256_load_ps(_b + i));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(d, d));
+	}
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+	return _mm_cvtss_f32(half);
+#elif defined(POSE_SIMD_SSE)
+	__m128 sum = _mm_setzero_ps();
+	for (unsigned int i = 0; i < STRIDE; i += 4)
+	{
+		__m128 d = _mm_sub_ps(_mm_load_ps(_a + i), _mm_load_ps(_b + i));
+		sum = _mm_add_ps(sum, _mm_mul_ps(d, d));
+	}
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+#else
+	float sum = 0.0f;
+	for (unsigned int i = 0; i < STRIDE; i++) sum += (_a[i] - _b[i]) * (_a[i] - _b[i]);
+	return sum;
+#endif
+}
+
+unsigned int PoseFeatureIndex::findNearest(const float* _features, unsigned int _k, FeatureMatch* _matches, short _clip)
+{
+	const unsigned int STRIDE = PoseFeatures::FEATURE_STRIDE;
+	if (_k == 0 || num_rows == 0 || _clip >= (short)clips.size()) return 0;
+	normalize();
+
+	alignas(POSE_ALIGNMENT) float query[STRIDE];
+	for (unsigned int i = 0; i < STRIDE; i++) query[i] = (_features[i] - means[i]) * scales[i];
+
+	// the best _k so far, kept sorted by insertion
+	unsigned int found = 0;
+	unsigned short first_clip = (_clip < 0) ? 0 : (unsigned short)_clip;
+	unsigned short end_clip = (_clip < 0) ? (unsigned short)clips.size() : (unsigned short)(_clip + 1);
+	for (unsigned short c = first_clip; c < end_clip; c++)
+	{
+		const float* row = rows + size_t(clips[c].first_row) * STRIDE;
+		for (long f = 0; f < clips[c].num_frames; f++, row += STRIDE)
+		{
+			float distance = rowDistance(query, row);
+			if (found == _k && distance >= _matches[found - 1].distance) continue;
+			unsigned int i = (found < _k) ? found++ : found - 1;
+			for (; i > 0 && _matches[i - 1].distance > distance; i--) _matches[i] = _matches[i - 1];
+			_matches[i].clip = (short)c;
+			_matches[i].frame = f;
+			_matches[i].distance = distance;
+		}
+	}
+	return found;
+}
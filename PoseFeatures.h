@@ -0,0 +1,121 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// PoseFeatures.h
+//    Pose feature vectors of every frame of a clip, and an index over the
+//    frames of many clips for finding the frames that best match a pose.
+//    A frame's features are the positions and velocities of the feet, the
+//    velocity of the root and the positions of the hands, all relative to
+//    the root and turned into its heading, so they do not depend on where
+//    in the world, or which way, the clip walks. They are found offline
+//    with BoneHierarchy's forward kinematics (see FootContacts).
+//    The index keeps every frame's features normalized in one flat,
+//    aligned matrix and answers nearest-frame queries with a SIMD scan;
+//    at the size of a mocap library that beats a tree, and it stays exact.
+//-----------------------------------------------------------------------------
+#ifndef POSEFEATURES_DOT_H
+#define POSEFEATURES_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <vector>
+using namespace std;
+
+class BoneHierarchy;
+class PoseSource;
+
+// groups of features that are normalized (and weighted) together
+enum FEATURE_GROUP { FEATURE_FOOT_POSITIONS, FEATURE_FOOT_VELOCITIES, FEATURE_ROOT_VELOCITY, FEATURE_HAND_POSITIONS, NUM_FEATURE_GROUPS };
+
+struct PoseFeatures {
+	// floats per frame: 3 per foot position, foot velocity and hand
+	// position and 3 for the root velocity, padded to POSE_LANES
+	static const unsigned int NUM_FEATURES = 21;
+	static const unsigned int FEATURE_STRIDE = 24;
+
+	long num_frames;
+	float frame_time;
+	// FEATURE_STRIDE floats per frame
+	vector<float> values;
+
+	PoseFeatures() : num_frames(0), frame_time(0.0f) { }
+
+	// extract() finds the features of every frame of _source, which must
+	// already be bound to _hierarchy. Returns false if the feet or hands
+	// cannot be found.
+	bool extract(BoneHierarchy& _hierarchy, PoseSource* _source);
+
+	const float* frame(long _frame) const { return &values[size_t(_frame) * FEATURE_STRIDE]; }
+
+	// flat form, for keeping the features in the motion cache
+	void serialize(vector<char>& _data);
+	bool deserialize(const vector<char>& _data);
+};
+
+// one frame found by PoseFeatureIndex::findNearest()
+struct FeatureMatch {
+	short clip;
+	long frame;
+	// squared distance in normalized feature space
+	float distance;
+};
+
+class PoseFeatureIndex
+{
+public:
+	PoseFeatureIndex();
+	~PoseFeatureIndex();
+
+	// addClip() indexes every frame of _features and returns the clip's
+	// number in the index. The frames are only appended; they are
+	// normalized by the next normalize() or findNearest().
+	short addClip(const PoseFeatures& _features);
+	void clear();
+	// normalize() redoes the normalization over all the frames indexed,
+	// so each group of features weighs about the same whatever units the
+	// clips use. It does nothing unless clips were added since the last
+	// time; call it once the clips are in, before any concurrent queries.
+	void normalize();
+
+	unsigned short numClips() { return (unsigned short)clips.size(); }
+	unsigned long numFrames() { return num_rows; }
+	long numFrames(short _clip) { return clips[_clip].num_frames; }
+	// features of frame _frame of indexed clip _clip, as added; NULL if
+	// there is no such frame
+	const float* frameFeatures(short _clip, long _frame)
+	{
+		if (_clip < 0 || _clip >= (short)clips.size() || _frame < 0 || _frame >= clips[_clip].num_frames) return NULL;
+		return &raw[size_t(clips[_clip].first_row + _frame) * PoseFeatures::FEATURE_STRIDE];
+	}
+
+	// findNearest() writes the (up to) _k frames whose features are
+	// closest to _features (one frame's worth, as PoseFeatures::frame()
+	// gives them) into _matches, nearest first, and returns how many it
+	// found. _clip limits the search to one clip; -1 searches them all.
+	unsigned int findNearest(const float* _features, unsigned int _k, FeatureMatch* _matches, short _clip = -1);
+
+private:
+	struct IndexedClip {
+		unsigned long first_row;
+		long num_frames;
+	};
+	vector<IndexedClip> clips;
+	// raw features of every indexed frame, kept for renormalizing
+	vector<float> raw;
+	// normalized features, FEATURE_STRIDE floats per row, aligned; room
+	// for row_capacity rows, grown by doubling
+	float* rows;
+	unsigned long num_rows;
+	unsigned long row_capacity;
+	// false while rows and the statistics lag behind raw
+	bool normalized;
+	// normalized = (raw - means) * scales, per feature
+	float means[PoseFeatures::FEATURE_STRIDE];
+	float scales[PoseFeatures::FEATURE_STRIDE];
+
+	// no copying; the rows are owned
+	PoseFeatureIndex(const PoseFeatureIndex&);
+	PoseFeatureIndex& operator=(const PoseFeatureIndex&);
+};
+
+#endif // POSEFEATURES_DOT_H
@@ -0,0 +1,160 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// PoseMath.h
+//    Vectorized helpers for pose buffers (one float per channel).
+//    Pose buffers are padded to a multiple of POSE_LANES floats and
+//    aligned to POSE_ALIGNMENT bytes, so loops can run a full SIMD
+//    register at a time without remainder handling.
+//-----------------------------------------------------------------------------
+#ifndef POSEMATH_DOT_H
+#define POSEMATH_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cmath>
+#include <cstdlib>
+#if defined(__AVX__)
+#include <immintrin.h>
+#define POSE_SIMD_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define POSE_SIMD_SSE
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+const unsigned int POSE_LANES = 8;
+const unsigned int POSE_ALIGNMENT = 32;
+
+// number of floats to reserve for a pose of _num_channels
+inline unsigned int paddedPoseSize(unsigned int _num_channels)
+{
+	return (_num_channels + POSE_LANES - 1) & ~(POSE_LANES - 1);
+}
+
+// _alignment (a power of two, at least POSE_ALIGNMENT) can be raised,
+// e.g. to start the buffer on a cache line
+inline float* allocatePoseBuffer(size_t _num_floats, size_t _alignment = POSE_ALIGNMENT)
+{
+	size_t bytes = _num_floats * sizeof(float);
+	if (bytes == 0) bytes = _alignment;
+#ifdef _WIN32
+	return (float*)_aligned_malloc(bytes, _alignment);
+#else
+	void* p = NULL;
+	if (posix_memalign(&p, _alignment, bytes) != 0) return NULL;
+	return (float*)p;
+#endif
+}
+
+inline void freePoseBuffer(float* _buffer)
+{
+	if (_buffer == NULL) return;
+#ifdef _WIN32
+	_aligned_free(_buffer);
+#else
+	free(_buffer);
+#endif
+}
+
+// _out = _a + _t*(_b - _a) over _n floats (_n a multiple of POSE_LANES,
+// all buffers POSE_ALIGNMENT aligned)
+inline void lerpPose(const float* _a, const float* _b, float _t, float* _out, unsigned int _n)
+{
+#if defined(POSE_SIMD_AVX)
+	__m256 t = _mm256_set1_ps(_t);
+	for (unsigned int i = 0; i < _n; i += 8)
+	{
+		__m256 a = _mm256_load_ps(_a + i);
+		__m256 b = _mm256_load_ps(_b + i);
+		_mm256_store_ps(_out + i, _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a))));
+	}
+#elif defined(POSE_SIMD_SSE)
+	__m128 t = _mm_set1_ps(_t);
+	for (unsigned int i = 0; i < _n; i += 4)
+	{
+		__m128 a = _mm_load_ps(_a + i);
+		__m128 b = _mm_load_ps(_b + i);
+		_mm_store_ps(_out + i, _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a))));
+	}
+#else
+	for (unsigned int i = 0; i < _n; i++) _out[i] = _a[i] + _t*(_b[i] - _a[i]);
+#endif
+}
+
+// _out = _a + _t*wrap(_b - _a), where wrap() takes whole multiples of
+// _period off each difference (per float; 0 for channels that do not
+// wrap, with _inverse_period 0 too), so angles blend the short way round.
+// Rounding to the nearest turn adds and subtracts 1.5*2^23, which leaves
+// the nearest integer in SSE registers without SSE4's round.
+inline void blendPose(const float* _a, const float* _b, const float* _period, const float* _inverse_period, float _t, float* _out, unsigned int _n)
+{
+#if defined(POSE_SIMD_AVX)
+	__m256 t = _mm256_set1_ps(_t);
+	for (unsigned int i = 0; i < _n; i += 8)
+	{
+		__m256 a = _mm256_load_ps(_a + i);
+		__m256 d = _mm256_sub_ps(_mm256_load_ps(_b + i), a);
+		__m256 turns = _mm256_round_ps(_mm256_mul_ps(d, _mm256_load_ps(_inverse_period + i)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		d = _mm256_sub_ps(d, _mm256_mul_ps(turns, _mm256_load_ps(_period + i)));
+		_mm256_store_ps(_out + i, _mm256_add_ps(a, _mm256_mul_ps(t, d)));
+	}
+#elif defined(POSE_SIMD_SSE)
+	__m128 t = _mm_set1_ps(_t);
+	__m128 round = _mm_set1_ps(12582912.0f);
+	for (unsigned int i = 0; i < _n; i += 4)
+	{
+		__m128 a = _mm_load_ps(_a + i);
+		__m128 d = _mm_sub_ps(_mm_load_ps(_b + i), a);
+		__m128 turns = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(d, _mm_load_ps(_inverse_period + i)), round), round);
+		d = _mm_sub_ps(d, _mm_mul_ps(turns, _mm_load_ps(_period + i)));
+		_mm_store_ps(_out + i, _mm_add_ps(a, _mm_mul_ps(t, d)));
+	}
+#else
+	for (unsigned int i = 0; i < _n; i++)
+	{
+		float d = _b[i] - _a[i];
+		d -= _period[i] * floor(d * _inverse_period[i] + 0.5f);
+		_out[i] = _a[i] + _t*d;
+	}
+#endif
+}
+
+// _out = _a + _t*(_b - _reference): _b's change from _reference, scaled,
+// added on top of _a
+inline void addPose(const float* _a, const float* _b, const float* _reference, float _t, float* _out, unsigned int _n)
+{
+#if defined(POSE_SIMD_AVX)
+	__m256 t = _mm256_set1_ps(_t);
+	for (unsigned int i = 0; i < _n; i += 8)
+	{
+		__m256 d = _mm256_sub_ps(_mm256_load_ps(_b + i), _mm256_load_ps(_reference + i));
+		_mm256_store_ps(_out + i, _mm256_add_ps(_mm256_load_ps(_a + i), _mm256_mul_ps(t, d)));
+	}
+#elif defined(POSE_SIMD_SSE)
+	__m128 t = _mm_set1_ps(_t);
+	for (unsigned int i = 0; i < _n; i += 4)
+	{
+		__m128 d = _mm_sub_ps(_mm_load_ps(_b + i), _mm_load_ps(_reference + i));
+		_mm_store_ps(_out + i, _mm_add_ps(_mm_load_ps(_a + i), _mm_mul_ps(t, d)));
+	}
+#else
+	for (unsigned int i = 0; i < _n; i++) _out[i] = _a[i] + _t*(_b[i] - _reference[i]);
+#endif
+}
+
+// copies _n floats (_n a multiple of POSE_LANES, aligned buffers)
+inline void copyPose(const float* _src, float* _out, unsigned int _n)
+{
+#if defined(POSE_SIMD_AVX)
+	for (unsigned int i = 0; i < _n; i += 8) _mm256_store_ps(_out + i, _mm256_load_ps(_src + i));
+#elif defined(POSE_SIMD_SSE)
+	for (unsigned int i = 0; i < _n; i += 4) _mm_store_ps(_out + i, _mm_load_ps(_src + i));
+#else
+	for (unsigned int i = 0; i < _n; i++) _out[i] = _src[i];
+#endif
+}
+
+#endif // POSEMATH_DOT_H
@@ -0,0 +1,38 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// PoseSource.h
+//    Interface for clip storage that OpenMotionSequenceController can
+//    sample whole poses from. A source has numFrames() frames plus a loop
+//    row (frame numFrames()) that blends smoothly back into frame 0.
+//    Poses are written as one float per channel into a buffer of
+//    getStride() floats, aligned for SIMD use (see PoseMath.h).
+//-----------------------------------------------------------------------------
+#ifndef POSESOURCE_DOT_H
+#define POSESOURCE_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// SKA modules
+#include <Animation/MotionSequence.h>
+
+class PoseSource
+{
+public:
+	virtual ~PoseSource() { }
+
+	virtual long numFrames() = 0;
+	virtual float getDuration() = 0;
+	virtual unsigned short numChannels() = 0;
+	virtual CHANNEL_ID getChannel(unsigned short _index) = 0;
+	// floats per pose, a multiple of POSE_LANES
+	virtual unsigned int getStride() = 0;
+	// true if rotation channels are in degrees rather than radians
+	virtual bool rotationsInDegrees() = 0;
+
+	// sampleFrame() writes frame _frame into _pose
+	virtual void sampleFrame(long _frame, float* _pose) = 0;
+	// sampleBlend() writes the blend of _frame and _frame+1 at _alpha (0..1)
+	virtual void sampleBlend(long _frame, float _alpha, float* _pose) = 0;
+};
+
+#endif // POSESOURCE_DOT_H
@@ -16,15 +16,31 @@
 using namespace std;
 // SKA modules
 #include <Objects/Object.h>
+// local application
+#include "MarkerTrail.h"
+
+// sphere around an object, for view culling; a negative radius marks an
+// object that is never culled
+struct BoundingSphere {
+	Vector3D center;
+	float radius;
+	BoundingSphere(const Vector3D& _center = Vector3D(0.0f, 0.0f, 0.0f), float _radius = -1.0f)
+		: center(_center), radius(_radius) { }
+};
 
 struct RenderLists {
 	vector<Object*> bones;
 	vector<Object*> background;
+	// one per background object
+	vector<BoundingSphere> background_bounds;
 	vector<Object*> erasables;
+	// marker boxes, drawn in one batch; erased along with the erasables
+	MarkerTrail marker_trail;
 
 	void eraseErasables() {
 		for (unsigned short i = 0; i < erasables.size(); i++) delete erasables[i];
 		erasables.clear();
+		marker_trail.clear();
 	}
 
 	void eraseAll() {
@@ -32,11 +48,13 @@ struct RenderLists {
 		bones.clear();
 		for (unsigned short i = 0; i < background.size(); i++) delete background[i];
 		background.clear();
+		background_bounds.clear();
 		for (unsigned short i = 0; i < erasables.size(); i++) delete erasables[i];
 		erasables.clear();
+		marker_trail.clear();
 	}
 
-	RenderLists() { bones.clear(); background.clear(); erasables.clear(); }
+	RenderLists() { bones.clear(); background.clear(); background_bounds.clear(); erasables.clear(); }
 	~RenderLists() { eraseAll(); }
 };
 
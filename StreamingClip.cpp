@@ -0,0 +1,295 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// StreamingClip.cpp
+//    PoseSource that plays a clip straight from its motion cache file.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cstdio>
+#include <deque>
+#include <thread>
+#include <utility>
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+// local application
+#include "StreamingClip.h"
+#include "PoseMath.h"
+
+// One background thread reads ahead for every streaming clip, so a crowd
+// of long clips does not start a thread each. It exists while any
+// streaming clip does.
+class ChunkReader
+{
+public:
+	ChunkReader() : busy(NULL), stop(false)
+	{
+		worker = thread([this]() { run(); });
+	}
+
+	~ChunkReader()
+	{
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			stop = true;
+		}
+		work_ready.notify_all();
+		worker.join();
+	}
+
+	void request(StreamingClip* _clip, long _chunk)
+	{
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			queue.push_back(make_pair(_clip, _chunk));
+		}
+		work_ready.notify_one();
+	}
+
+	// cancel() drops _clip's queued reads and waits out one in progress
+	void cancel(StreamingClip* _clip)
+	{
+		unique_lock<mutex> lock(queue_mutex);
+		deque<pair<StreamingClip*, long> >::iterator iter = queue.begin();
+		while (iter != queue.end())
+		{
+			if (iter->first == _clip) iter = queue.erase(iter);
+			else iter++;
+		}
+		work_done.wait(lock, [this, _clip]() { return busy != _clip; });
+	}
+
+private:
+	deque<pair<StreamingClip*, long> > queue;
+	StreamingClip* busy;
+	bool stop;
+	mutex queue_mutex;
+	condition_variable work_ready;
+	condition_variable work_done;
+	thread worker;
+
+	void run()
+	{
+		unique_lock<mutex> lock(queue_mutex);
+		while (true)
+		{
+			work_ready.wait(lock, [this]() { return stop || !queue.empty(); });
+			if (stop) return;
+			pair<StreamingClip*, long> job = queue.front();
+			queue.pop_front();
+			busy = job.first;
+			lock.unlock();
+			job.first->prefetchChunk(job.second);
+			lock.lock();
+			busy = NULL;
+			work_done.notify_all();
+		}
+	}
+};
+
+static mutex reader_mutex;
+static ChunkReader* chunk_reader = NULL;
+static unsigned int num_reader_users = 0;
+
+static ChunkReader* acquireReader()
+{
+	lock_guard<mutex> lock(reader_mutex);
+	if (num_reader_users++ == 0) chunk_reader = new ChunkReader;
+	return chunk_reader;
+}
+
+static void releaseReader()
+{
+	lock_guard<mutex> lock(reader_mutex);
+	if (--num_reader_users == 0)
+	{
+		delete chunk_reader;
+		chunk_reader = NULL;
+	}
+}
+
+StreamingClip::StreamingClip(const MotionCacheLayout& _layout, size_t _budget_bytes)
+	: layout(_layout), file(NULL), chunk_frames(1), num_chunks(0), chunk_bytes(0),
+	use_clock(0), prefetch_queued(-1), blocking_reads(0), prefetch_reads(0)
+{
+	acquireReader();
+
+	// each chunk holds chunk_frames+1 rows, and NUM_SLOTS chunks fit the budget
+	size_t row_bytes = size_t(layout.stride) * sizeof(float);
+	size_t rows_per_slot = _budget_bytes / (NUM_SLOTS * row_bytes);
+	if (rows_per_slot > 2) chunk_frames = long(rows_per_slot - 1);
+	if (chunk_frames > layout.num_frames) chunk_frames = layout.num_frames;
+	num_chunks = (layout.num_frames + chunk_frames - 1) / chunk_frames;
+	chunk_bytes = size_t(chunk_frames + 1) * row_bytes;
+
+	file = fopen(layout.path.c_str(), "rb");
+
+	unsigned int num_slots = (num_chunks < long(NUM_SLOTS)) ? (unsigned int)num_chunks : NUM_SLOTS;
+	slots.resize(num_slots);
+	for (unsigned int s = 0; s < num_slots; s++)
+	{
+		slots[s].rows = allocatePoseBuffer(size_t(chunk_frames + 1) * layout.stride);
+		slots[s].chunk = -1;
+		slots[s].loading = false;
+		slots[s].pinned = false;
+		slots[s].last_use = 0;
+	}
+}
+
+StreamingClip::~StreamingClip()
+{
+	// the reader stays alive while this clip counts as a user
+	chunk_reader->cancel(this);
+	releaseReader();
+	for (unsigned int s = 0; s < slots.size(); s++) freePoseBuffer(slots[s].rows);
+	if (file != NULL) fclose(file);
+}
+
+// seekFile() seeks to a 64-bit offset; fseek() takes a long, which is
+// 32 bits on Windows, and streamed cache files can pass 2 GB
+static bool seekFile(FILE* _file, unsigned long long _offset)
+{
+#ifdef _WIN32
+	return _fseeki64(_file, (__int64)_offset, SEEK_SET) == 0;
+#else
+	return fseeko(_file, (off_t)_offset, SEEK_SET) == 0;
+#endif
+}
+
+// readChunk() reads chunk _chunk's rows from the cache file into _rows.
+// Rows that cannot be read are left as zeros.
+void StreamingClip::readChunk(long _chunk, float* _rows)
+{
+	long first_row = _chunk * chunk_frames;
+	long num_rows = chunk_frames + 1;
+	// the last chunk may be short; the file holds num_frames+1 rows
+	if (first_row + num_rows > layout.num_frames + 1) num_rows = layout.num_frames + 1 - first_row;
+
+	size_t row_floats = layout.stride;
+	size_t num_read = 0;
+	if (file != NULL)
+	{
+		lock_guard<mutex> lock(file_mutex);
+		unsigned long long offset = layout.frames_offset + (unsigned long long)first_row * row_floats * sizeof(float);
+		if (seekFile(file, offset))
+			num_read = fread(_rows, sizeof(float) * row_floats, size_t(num_rows), file);
+	}
+	for (size_t i = num_read * row_floats; i < size_t(chunk_frames + 1) * row_floats; i++) _rows[i] = 0.0f;
+}
+
+int StreamingClip::findSlot(long _chunk)
+{
+	for (unsigned int s = 0; s < slots.size(); s++)
+		if (slots[s].chunk == _chunk) return int(s);
+	return -1;
+}
+
+// evictableSlot() picks an empty slot, else the least recently used one
+// that is not being read or sampled, or -1 if there is none
+int StreamingClip::evictableSlot()
+{
+	int best = -1;
+	for (unsigned int s = 0; s < slots.size(); s++)
+	{
+		if (slots[s].loading || slots[s].pinned) continue;
+		if (best < 0 || slots[s].chunk < 0 || slots[s].last_use < slots[best].last_use)
+		{
+			best = int(s);
+			if (slots[s].chunk < 0) break;
+		}
+	}
+	return best;
+}
+
+const float* StreamingClip::acquireRow(long _frame, unsigned int& _slot)
+{
+	long chunk = _frame / chunk_frames;
+	if (chunk >= num_chunks) chunk = num_chunks - 1;
+
+	unique_lock<mutex> lock(slots_mutex);
+	int s;
+	while (true)
+	{
+		s = findSlot(chunk);
+		if (s >= 0)
+		{
+			// a read-ahead of this chunk may still be in flight
+			if (slots[s].loading) { slot_ready.wait(lock); continue; }
+			break;
+		}
+		s = evictableSlot();
+		if (s < 0) { slot_ready.wait(lock); continue; }
+
+		// not read ahead in time; read it now
+		slots[s].chunk = chunk;
+		slots[s].loading = true;
+		lock.unlock();
+		readChunk(chunk, slots[s].rows);
+		lock.lock();
+		slots[s].loading = false;
+		blocking_reads++;
+		slot_ready.notify_all();
+		break;
+	}
+	slots[s].pinned = true;
+	slots[s].last_use = ++use_clock;
+	_slot = (unsigned int)s;
+
+	// read the next chunk ahead; after the last chunk, playback loops to the first
+	long next = (chunk + 1) % num_chunks;
+	bool queue_next = (next != chunk) && (next != prefetch_queued) && (findSlot(next) < 0);
+	if (queue_next) prefetch_queued = next;
+	lock.unlock();
+	if (queue_next) chunk_reader->request(this, next);
+
+	return slots[s].rows + size_t(_frame - chunk * chunk_frames) * layout.stride;
+}
+
+void StreamingClip::releaseSlot(unsigned int _slot)
+{
+	lock_guard<mutex> lock(slots_mutex);
+	slots[_slot].pinned = false;
+}
+
+void StreamingClip::prefetchChunk(long _chunk)
+{
+	unique_lock<mutex> lock(slots_mutex);
+	if (prefetch_queued == _chunk) prefetch_queued = -1;
+	if (findSlot(_chunk) >= 0) return;
+	// the most recently played chunk is never the least recently used
+	int s = evictableSlot();
+	if (s < 0) return;
+
+	slots[s].chunk = _chunk;
+	slots[s].loading = true;
+	slots[s].last_use = ++use_clock;
+	lock.unlock();
+	readChunk(_chunk, slots[s].rows);
+	lock.lock();
+	slots[s].loading = false;
+	prefetch_reads++;
+	slot_ready.notify_all();
+}
+
+void StreamingClip::sampleFrame(long _frame, float* _pose)
+{
+	if (_frame < 0) _frame = 0;
+	if (_frame >= layout.num_frames) _frame = layout.num_frames - 1;
+	unsigned int slot;
+	const float* row = acquireRow(_frame, slot);
+	copyPose(row, _pose, layout.stride);
+	releaseSlot(slot);
+}
+
+void StreamingClip::sampleBlend(long _frame, float _alpha, float* _pose)
+{
+	if (_frame < 0) { _frame = 0; _alpha = 0.0f; }
+	if (_frame >= layout.num_frames) { _frame = layout.num_frames - 1; _alpha = 1.0f; }
+	unsigned int slot;
+	// the following row, up to the loop row, is always in the same chunk
+	const float* row = acquireRow(_frame, slot);
+	lerpPose(row, row + layout.stride, _alpha, _pose, layout.stride);
+	releaseSlot(slot);
+}
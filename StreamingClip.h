@@ -0,0 +1,104 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// StreamingClip.h
+//    PoseSource that plays a clip straight from its motion cache file,
+//    keeping only a few chunks of frame rows in memory. Meant for clips
+//    too long to hold resident, such as multi-hour capture sessions.
+//    The chunk after the one being played is read ahead on a background
+//    thread, so playback normally never waits for the disk.
+//-----------------------------------------------------------------------------
+#ifndef STREAMINGCLIP_DOT_H
+#define STREAMINGCLIP_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+using namespace std;
+// local application
+#include "MotionCache.h"
+#include "PoseSource.h"
+
+class StreamingClip : public PoseSource
+{
+public:
+	// _layout describes a cache file from MotionCache::inspect().
+	// Frame rows held in memory are kept within _budget_bytes, except that
+	// at least NUM_SLOTS chunks of two rows each are always kept.
+	StreamingClip(const MotionCacheLayout& _layout, size_t _budget_bytes);
+	~StreamingClip();
+
+	// false if the cache file could not be opened
+	bool isOpen() { return file != NULL; }
+
+	long numFrames() { return layout.num_frames; }
+	float getDuration() { return layout.duration; }
+	unsigned short numChannels() { return (unsigned short)layout.channels.size(); }
+	CHANNEL_ID getChannel(unsigned short _index) { return layout.channels[_index]; }
+	unsigned int getStride() { return layout.stride; }
+	bool rotationsInDegrees() { return layout.degrees; }
+
+	// Sampling may block on a chunk that is not yet in memory. Calls must
+	// not overlap; the background reads run alongside them.
+	void sampleFrame(long _frame, float* _pose);
+	void sampleBlend(long _frame, float _alpha, float* _pose);
+
+	// bytes of frame rows held in memory, whatever the clip length
+	size_t residentBytes() { return slots.size() * chunk_bytes; }
+	long framesPerChunk() { return chunk_frames; }
+	// chunks read while playback waited, and chunks read ahead of it
+	unsigned long numBlockingReads() { return blocking_reads.load(); }
+	unsigned long numPrefetchReads() { return prefetch_reads.load(); }
+
+	// the background reader calls this for queued chunks
+	void prefetchChunk(long _chunk);
+
+	static const unsigned int NUM_SLOTS = 3;
+
+private:
+	struct Slot {
+		float* rows;
+		long chunk;			// -1 when empty
+		bool loading;
+		bool pinned;		// being sampled from; not to be evicted
+		unsigned long last_use;
+	};
+
+	MotionCacheLayout layout;
+	FILE* file;
+	mutex file_mutex;
+
+	// Chunk k holds rows k*chunk_frames .. (k+1)*chunk_frames, the last row
+	// overlapping the next chunk, so any frame and its successor (up to the
+	// loop row) are always in the same chunk.
+	long chunk_frames;
+	long num_chunks;
+	size_t chunk_bytes;
+
+	vector<Slot> slots;
+	mutex slots_mutex;
+	condition_variable slot_ready;
+	unsigned long use_clock;
+	// last chunk queued for reading ahead, so it is only queued once
+	long prefetch_queued;
+
+	atomic<unsigned long> blocking_reads;
+	atomic<unsigned long> prefetch_reads;
+
+	// acquireRow() pins the chunk holding _frame and returns its row
+	const float* acquireRow(long _frame, unsigned int& _slot);
+	void releaseSlot(unsigned int _slot);
+	int findSlot(long _chunk);
+	int evictableSlot();
+	void readChunk(long _chunk, float* _rows);
+
+	// no copying; the slot buffers and file are owned
+	StreamingClip(const StreamingClip&);
+	StreamingClip& operator=(const StreamingClip&);
+};
+
+#endif // STREAMINGCLIP_DOT_H
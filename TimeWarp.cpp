@@ -0,0 +1,92 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// TimeWarp.cpp
+//    Step-synchronizing time warps.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <algorithm>
+#include <cmath>
+// local application
+#include "TimeWarp.h"
+#include "FootContacts.h"
+
+// touchdowns closer than this many frames count as one step
+const long MIN_STEP_FRAMES = 3;
+
+void WarpCurve::setKnots(const vector<float>& _x, const vector<float>& _y, float _x_period, float _y_period)
+{
+	x = _x;
+	y = _y;
+	x_period = _x_period;
+	y_period = _y_period;
+	if (x.empty()) return;
+	x.push_back(x[0] + x_period);
+	y.push_back(y[0] + y_period);
+}
+
+float WarpCurve::evaluate(float _x, size_t& _cursor, bool _use_cursor)
+{
+	if (x.empty()) return _x;
+
+	// fold _x into the stored period
+	float cycles = floor((_x - x[0]) / x_period);
+	float folded = _x - cycles * x_period;
+
+	size_t last = x.size() - 2;
+	size_t segment;
+	if (_use_cursor && _cursor <= last && x[_cursor] <= folded && folded < x[_cursor + 1])
+		segment = _cursor;
+	else if (_use_cursor && _cursor < last && x[_cursor + 1] <= folded && folded < x[_cursor + 2])
+		segment = _cursor + 1;
+	else
+	{
+		// last knot at or before folded
+		segment = size_t(upper_bound(x.begin(), x.end() - 1, folded) - x.begin());
+		segment = (segment > 0) ? segment - 1 : 0;
+		if (segment > last) segment = last;
+	}
+	_cursor = segment;
+
+	float alpha = (folded - x[segment]) / (x[segment + 1] - x[segment]);
+	return y[segment] + alpha * (y[segment + 1] - y[segment]) + cycles * y_period;
+}
+
+void stepTimes(FootContacts& _contacts, long _num_frames, float _duration, vector<float>& _times)
+{
+	vector<long> frames, foot_frames;
+	for (int foot = 0; foot < NUM_FEET; foot++)
+	{
+		_contacts.stepFrames((FOOT)foot, foot_frames);
+		frames.insert(frames.end(), foot_frames.begin(), foot_frames.end());
+	}
+	sort(frames.begin(), frames.end());
+
+	_times.clear();
+	long previous = -MIN_STEP_FRAMES;
+	for (unsigned int i = 0; i < frames.size(); i++)
+	{
+		if (frames[i] - previous < MIN_STEP_FRAMES) continue;
+		// a touchdown right before the loop point is the same step as one at frame 0
+		if (!_times.empty() && _num_frames - frames[i] + frames[0] < MIN_STEP_FRAMES) continue;
+		_times.push_back(_duration * frames[i] / _num_frames);
+		previous = frames[i];
+	}
+}
+
+bool StepWarp::build(FootContacts& _contacts, long _num_frames, float _duration)
+{
+	vector<float> times;
+	stepTimes(_contacts, _num_frames, _duration, times);
+	if (times.empty() || _duration <= 0.0f) return false;
+
+	// step k of each loop is at phase k
+	vector<float> phases(times.size());
+	for (unsigned int k = 0; k < times.size(); k++) phases[k] = float(k);
+	float steps_per_loop = float(times.size());
+	phase_curve.setKnots(times, phases, _duration, steps_per_loop);
+	time_curve.setKnots(phases, times, steps_per_loop, _duration);
+	return true;
+}
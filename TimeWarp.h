@@ -0,0 +1,67 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// TimeWarp.h
+//    Step-synchronizing time warps. A character's warp maps global time
+//    to its own clip time so that its steps land on the steps of a lead
+//    clip. This goes through step phase (a running count of steps):
+//      global time --lead curve--> phase --character curve--> clip time
+//    Both curves are monotone and piecewise linear, with one knot per
+//    step, and repeat every loop of their clip.
+//-----------------------------------------------------------------------------
+#ifndef TIMEWARP_DOT_H
+#define TIMEWARP_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <vector>
+using namespace std;
+
+struct FootContacts;
+
+// A monotone piecewise-linear curve through knots (x[k], y[k]) that
+// repeats, with each repeat shifted by (x_period, y_period).
+class WarpCurve
+{
+public:
+	WarpCurve() : x_period(0.0f), y_period(0.0f) { }
+
+	// setKnots() takes one period of knots with strictly increasing x
+	// and y, all x within [x[0], x[0] + _x_period).
+	void setKnots(const vector<float>& _x, const vector<float>& _y, float _x_period, float _y_period);
+	bool isValid() { return !x.empty(); }
+
+	// evaluate() finds the segment holding _x by binary search, O(log knots).
+	// With a cursor, the segment found last time is tried first, which
+	// makes steadily advancing lookups O(1).
+	float evaluate(float _x) { size_t segment = 0; return evaluate(_x, segment, false); }
+	float evaluate(float _x, size_t& _cursor) { return evaluate(_x, _cursor, true); }
+
+private:
+	// one period of knots, closed by a copy of the first shifted one period on
+	vector<float> x;
+	vector<float> y;
+	float x_period;
+	float y_period;
+
+	float evaluate(float _x, size_t& _cursor, bool _use_cursor);
+};
+
+// stepTimes() lists the clip times (in seconds) at which either foot
+// touches down, in order, for a clip of _num_frames frames over _duration.
+void stepTimes(FootContacts& _contacts, long _num_frames, float _duration, vector<float>& _times);
+
+// StepWarp holds the two curves of one clip: clip time to step phase
+// (for the lead) and step phase back to clip time (for followers).
+struct StepWarp {
+	// time -> phase
+	WarpCurve phase_curve;
+	// phase -> time
+	WarpCurve time_curve;
+
+	// build() returns false if the clip has no steps
+	bool build(FootContacts& _contacts, long _num_frames, float _duration);
+	bool isValid() { return phase_curve.isValid(); }
+};
+
+#endif // TIMEWARP_DOT_H
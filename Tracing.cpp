@@ -0,0 +1,217 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// Tracing.cpp
+//    Chrome trace-event timeline of loading, updating and rendering.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <cstring>
+// local application
+#include "Tracing.h"
+
+Tracer tracer;
+
+// the calling thread's trace state, created by its first event
+static thread_local void* thread_trace = NULL;
+static thread_local const char* thread_name = NULL;
+
+// writes _text as a JSON string
+static void writeJSONString(FILE* _file, const char* _text)
+{
+	fputc('"', _file);
+	for (const char* c = _text; *c != '\0'; c++)
+	{
+		if (*c == '"' || *c == '\\') { fputc('\\', _file); fputc(*c, _file); }
+		else if ((unsigned char)*c < 0x20) fputc(' ', _file);
+		else fputc(*c, _file);
+	}
+	fputc('"', _file);
+}
+
+void TraceSpan::begin(const char* _category, const char* _name, const char* _arg_name, int _arg, const char* _text)
+{
+	event.name = _name;
+	event.category = _category;
+	event.arg_name = _arg_name;
+	event.int_arg = _arg;
+	event.text[0] = '\0';
+	if (_text != NULL)
+	{
+		strncpy(event.text, _text, sizeof(event.text) - 1);
+		event.text[sizeof(event.text) - 1] = '\0';
+	}
+	event.duration = 0;
+	event.start = tracer.now();
+}
+
+Tracer::Tracer()
+	: enabled(false), started(false), recording(false), file(NULL), first_event(true), writer_done(false)
+{ }
+
+Tracer::~Tracer()
+{
+	stop();
+	for (unsigned int t = 0; t < threads.size(); t++)
+	{
+		delete threads[t]->block;
+		delete threads[t];
+	}
+	for (unsigned int b = 0; b < free_blocks.size(); b++) delete free_blocks[b];
+}
+
+bool Tracer::start(const string& _path)
+{
+	lock_guard<mutex> lock(trace_mutex);
+	if (started) return false;
+	file = fopen(_path.c_str(), "w");
+	if (file == NULL) return false;
+	fprintf(file, "{\"traceEvents\":[\n");
+
+	started = true;
+	recording = true;
+	start_time = chrono::steady_clock::now();
+	writer = thread([this]() { writerLoop(); });
+	enabled.store(true, memory_order_relaxed);
+	return true;
+}
+
+void Tracer::stop()
+{
+	{
+		lock_guard<mutex> lock(trace_mutex);
+		if (!recording) return;
+		enabled.store(false, memory_order_relaxed);
+		recording = false;
+
+		// The rest of each thread's current block. A span that was already
+		// past its isEnabled() check may still append to a block, but only
+		// past the count taken here, so the writer never sees it half written.
+		for (unsigned int t = 0; t < threads.size(); t++)
+		{
+			Flush flush = { threads[t]->block, threads[t]->block->count.load(memory_order_acquire), false };
+			flush_queue.push_back(flush);
+		}
+		writer_done = true;
+	}
+	flush_ready.notify_one();
+	writer.join();
+
+	// thread names, as metadata events
+	lock_guard<mutex> lock(trace_mutex);
+	for (unsigned int t = 0; t < threads.size(); t++)
+	{
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+			first_event ? "" : ",\n", threads[t]->tid);
+		writeJSONString(file, threads[t]->name);
+		fprintf(file, "}}");
+		first_event = false;
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	file = NULL;
+}
+
+void Tracer::nameThread(const char* _name)
+{
+	thread_name = _name;
+	if (thread_trace != NULL)
+	{
+		lock_guard<mutex> lock(trace_mutex);
+		((ThreadTrace*)thread_trace)->name = _name;
+	}
+}
+
+int64_t Tracer::now()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+}
+
+Tracer::ThreadTrace* Tracer::threadTrace()
+{
+	if (thread_trace != NULL) return (ThreadTrace*)thread_trace;
+
+	lock_guard<mutex> lock(trace_mutex);
+	ThreadTrace* trace = new ThreadTrace;
+	trace->tid = (unsigned int)threads.size() + 1;
+	trace->name = (thread_name != NULL) ? thread_name : "thread";
+	trace->block = takeBlock(trace->tid);
+	threads.push_back(trace);
+	thread_trace = trace;
+	return trace;
+}
+
+// (trace_mutex must be held)
+Tracer::Block* Tracer::takeBlock(unsigned int _tid)
+{
+	Block* block;
+	if (free_blocks.empty()) block = new Block;
+	else
+	{
+		block = free_blocks.back();
+		free_blocks.pop_back();
+	}
+	block->count.store(0, memory_order_relaxed);
+	block->tid = _tid;
+	return block;
+}
+
+void Tracer::addEvent(const TraceEvent& _event)
+{
+	if (!isEnabled()) return;
+	ThreadTrace* trace = threadTrace();
+	Block* block = trace->block;
+	unsigned int count = block->count.load(memory_order_relaxed);
+	if (count == BLOCK_EVENTS)
+	{
+		// hand the full block to the writer and carry on in an empty one
+		{
+			lock_guard<mutex> lock(trace_mutex);
+			if (!recording) return;
+			Flush flush = { block, count, true };
+			flush_queue.push_back(flush);
+			trace->block = block = takeBlock(trace->tid);
+		}
+		flush_ready.notify_one();
+		count = 0;
+	}
+	block->events[count] = _event;
+	block->count.store(count + 1, memory_order_release);
+}
+
+void Tracer::writerLoop()
+{
+	unique_lock<mutex> lock(trace_mutex);
+	while (true)
+	{
+		flush_ready.wait(lock, [this]() { return !flush_queue.empty() || writer_done; });
+		if (flush_queue.empty()) break;
+		Flush flush = flush_queue.front();
+		flush_queue.pop_front();
+
+		lock.unlock();
+		writeEvents(flush.block, flush.count);
+		lock.lock();
+		if (flush.recycle) free_blocks.push_back(flush.block);
+	}
+}
+
+void Tracer::writeEvents(Block* _block, unsigned int _count)
+{
+	for (unsigned int e = 0; e < _count; e++)
+	{
+		const TraceEvent& event = _block->events[e];
+		fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",
+			first_event ? "" : ",\n", event.name, event.category, event.start / 1000.0, event.duration / 1000.0, _block->tid);
+		if (event.arg_name != NULL)
+		{
+			fprintf(file, ",\"args\":{\"%s\":", event.arg_name);
+			if (event.text[0] != '\0') writeJSONString(file, event.text);
+			else fprintf(file, "%d", event.int_arg);
+			fprintf(file, "}");
+		}
+		fprintf(file, "}");
+		first_event = false;
+	}
+}
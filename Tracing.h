@@ -0,0 +1,135 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// Tracing.h
+//    Optional timeline of loading, updating and rendering, written as
+//    Chrome trace-event JSON (open it in chrome://tracing or Perfetto).
+//    Code marks spans with TraceSpan objects. While tracing is off a span
+//    costs one relaxed atomic load. While it is on, each thread appends
+//    its spans to its own block of events with no locking; full blocks
+//    are handed to a writer thread, which formats and writes them to the
+//    file in the background.
+//-----------------------------------------------------------------------------
+#ifndef TRACING_DOT_H
+#define TRACING_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// one completed span
+struct TraceEvent {
+	// names and categories must be string literals (they are not copied)
+	const char* name;
+	const char* category;
+	// nanoseconds since tracing started
+	int64_t start;
+	int64_t duration;
+	// optional argument: arg_name = int_arg, or arg_name = text if text[0] is set
+	const char* arg_name;
+	int int_arg;
+	char text[48];
+};
+
+class Tracer
+{
+public:
+	Tracer();
+	~Tracer();
+
+	// start() begins writing a trace to _path. Tracing runs once per
+	// program; returns false if it has already run or _path cannot be opened.
+	bool start(const string& _path);
+	// stop() writes the remaining events and closes the file
+	void stop();
+	bool isEnabled() { return enabled.load(memory_order_relaxed); }
+
+	// nameThread() labels the calling thread in the trace; _name must be a string literal
+	void nameThread(const char* _name);
+
+	int64_t now();
+	void addEvent(const TraceEvent& _event);
+
+private:
+	static const unsigned int BLOCK_EVENTS = 1024;
+	struct Block {
+		TraceEvent events[BLOCK_EVENTS];
+		// events written so far; only the owning thread changes it
+		atomic<unsigned int> count;
+		unsigned int tid;
+	};
+	// per-thread state, kept until the tracer is destroyed
+	struct ThreadTrace {
+		unsigned int tid;
+		const char* name;
+		Block* block;
+	};
+	struct Flush {
+		Block* block;
+		unsigned int count;
+		bool recycle;
+	};
+
+	atomic<bool> enabled;
+	bool started;
+	bool recording;
+	chrono::steady_clock::time_point start_time;
+	FILE* file;
+	bool first_event;
+
+	// threads, free blocks and the writer's queue, under mutex
+	mutex trace_mutex;
+	condition_variable flush_ready;
+	vector<ThreadTrace*> threads;
+	vector<Block*> free_blocks;
+	deque<Flush> flush_queue;
+	bool writer_done;
+	thread writer;
+
+	ThreadTrace* threadTrace();
+	Block* takeBlock(unsigned int _tid);
+	void writerLoop();
+	void writeEvents(Block* _block, unsigned int _count);
+};
+
+extern Tracer tracer;
+
+// TraceSpan records the time from its construction to its destruction,
+// if tracing was on when it was constructed.
+class TraceSpan
+{
+public:
+	TraceSpan(const char* _category, const char* _name)
+		: active(tracer.isEnabled())
+	{ if (active) begin(_category, _name, NULL, 0, NULL); }
+	TraceSpan(const char* _category, const char* _name, const char* _arg_name, int _arg)
+		: active(tracer.isEnabled())
+	{ if (active) begin(_category, _name, _arg_name, _arg, NULL); }
+	TraceSpan(const char* _category, const char* _name, const char* _arg_name, const string& _text)
+		: active(tracer.isEnabled())
+	{ if (active) begin(_category, _name, _arg_name, 0, _text.c_str()); }
+	~TraceSpan()
+	{
+		if (!active) return;
+		event.duration = tracer.now() - event.start;
+		tracer.addEvent(event);
+	}
+
+private:
+	bool active;
+	TraceEvent event;
+
+	void begin(const char* _category, const char* _name, const char* _arg_name, int _arg, const char* _text);
+};
+
+#endif // TRACING_DOT_H
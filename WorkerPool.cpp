@@ -0,0 +1,137 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// WorkerPool.cpp
+//    Small pool of worker threads for data-parallel loops.
+//-----------------------------------------------------------------------------
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// local application
+#include "WorkerPool.h"
+#include "Tracing.h"
+
+WorkerPool::WorkerPool(unsigned short _num_threads)
+	: num_threads(1), shutting_down(false), job_generation(0), workers_busy(0),
+	job_task(NULL), job_count(0), job_chunk(1), job_cursor(0)
+{
+	setNumThreads(_num_threads);
+}
+
+WorkerPool::~WorkerPool()
+{
+	stopWorkers();
+}
+
+unsigned short WorkerPool::hardwareThreads()
+{
+	unsigned int n = thread::hardware_concurrency();
+	if (n == 0) n = 1;
+	return (unsigned short)n;
+}
+
+void WorkerPool::setNumThreads(unsigned short _num_threads)
+{
+	if (_num_threads == 0) _num_threads = hardwareThreads();
+	stopWorkers();
+	num_threads = _num_threads;
+	startWorkers();
+}
+
+void WorkerPool::startWorkers()
+{
+	shutting_down = false;
+	for (unsigned short t = 1; t < num_threads; t++)
+		workers.push_back(thread(&WorkerPool::workerLoop, this));
+}
+
+void WorkerPool::stopWorkers()
+{
+	{
+		lock_guard<mutex> lock(job_mutex);
+		shutting_down = true;
+	}
+	job_start.notify_all();
+	for (unsigned short t = 0; t < workers.size(); t++) workers[t].join();
+	workers.clear();
+}
+
+void WorkerPool::runChunks()
+{
+	while (true)
+	{
+		unsigned int begin = job_cursor.fetch_add(job_chunk);
+		if (begin >= job_count) break;
+		unsigned int end = begin + job_chunk;
+		if (end > job_count) end = job_count;
+		try
+		{
+			(*job_task)(begin, end);
+		}
+		catch (...)
+		{
+			lock_guard<mutex> lock(job_mutex);
+			if (!job_error) job_error = current_exception();
+			// skip whatever is left of the job
+			job_cursor.store(job_count);
+		}
+	}
+}
+
+void WorkerPool::workerLoop()
+{
+	tracer.nameThread("worker");
+	unsigned long seen_generation = 0;
+	while (true)
+	{
+		{
+			unique_lock<mutex> lock(job_mutex);
+			job_start.wait(lock, [&] { return shutting_down || job_generation != seen_generation; });
+			if (shutting_down) return;
+			seen_generation = job_generation;
+		}
+
+		runChunks();
+
+		{
+			lock_guard<mutex> lock(job_mutex);
+			workers_busy--;
+		}
+		job_done.notify_one();
+	}
+}
+
+void WorkerPool::parallelFor(unsigned int _count, unsigned int _chunk, const function<void(unsigned int, unsigned int)>& _task)
+{
+	if (_count == 0) return;
+	if (_chunk == 0) _chunk = 1;
+
+	// not worth waking anyone for a single chunk
+	if (workers.empty() || _count <= _chunk)
+	{
+		_task(0, _count);
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(job_mutex);
+		job_task = &_task;
+		job_count = _count;
+		job_chunk = _chunk;
+		job_cursor.store(0);
+		job_error = exception_ptr();
+		workers_busy = (unsigned short)workers.size();
+		job_generation++;
+	}
+	job_start.notify_all();
+
+	runChunks();
+
+	exception_ptr error;
+	{
+		unique_lock<mutex> lock(job_mutex);
+		job_done.wait(lock, [&] { return workers_busy == 0; });
+		job_task = NULL;
+		error = job_error;
+	}
+	if (error) rethrow_exception(error);
+}
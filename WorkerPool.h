@@ -0,0 +1,71 @@
+//-----------------------------------------------------------------------------
+// HW02 - Builds with SKA Version 4.0
+//-----------------------------------------------------------------------------
+// WorkerPool.h
+//    Small pool of worker threads for data-parallel loops.
+//    parallelFor() splits an index range into chunks; the calling thread
+//    and the workers claim chunks from a shared cursor until none are
+//    left, so threads that finish early keep taking work from the rest.
+//-----------------------------------------------------------------------------
+#ifndef WORKERPOOL_DOT_H
+#define WORKERPOOL_DOT_H
+// SKA configuration
+#include <Core/SystemConfiguration.h>
+// C/C++ libraries
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+class WorkerPool
+{
+public:
+	// _num_threads counts the calling thread; 0 means one per hardware core
+	WorkerPool(unsigned short _num_threads = 1);
+	~WorkerPool();
+
+	// setNumThreads() restarts the pool with a new thread count.
+	// 1 runs every loop serially on the calling thread.
+	void setNumThreads(unsigned short _num_threads);
+	unsigned short numThreads() { return num_threads; }
+
+	// parallelFor() calls _task(begin, end) for consecutive sub-ranges of
+	// [0, _count) of at most _chunk indices, and returns once all are done.
+	// The first exception thrown by a task is rethrown here.
+	void parallelFor(unsigned int _count, unsigned int _chunk, const function<void(unsigned int, unsigned int)>& _task);
+
+	static unsigned short hardwareThreads();
+
+private:
+	unsigned short num_threads;
+	vector<thread> workers;
+
+	mutex job_mutex;
+	condition_variable job_start;
+	condition_variable job_done;
+	bool shutting_down;
+	unsigned long job_generation;
+	unsigned short workers_busy;
+
+	// the current job
+	const function<void(unsigned int, unsigned int)>* job_task;
+	unsigned int job_count;
+	unsigned int job_chunk;
+	atomic<unsigned int> job_cursor;
+	exception_ptr job_error;
+
+	void startWorkers();
+	void stopWorkers();
+	void workerLoop();
+	void runChunks();
+
+	// no copying
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+};
+
+#endif // WORKERPOOL_DOT_H